@@ -0,0 +1,119 @@
+#ifndef ASYNCDATABASE_H
+#define ASYNCDATABASE_H
+
+#include "databasemanager.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+/**
+ * Асинхронный фасад над DatabaseManager.
+ * Запросы выполняются по очереди в отдельном потоке БД со своим соединением.
+ * Запросы одного канала схлопываются: новый запрос отменяет ожидающий в очереди,
+ * а результат выполнявшегося в этот момент устаревшего запроса не доставляется.
+ */
+class AsyncDatabase : public QThread
+{
+    Q_OBJECT
+public:
+    static AsyncDatabase& instance() {
+        static AsyncDatabase inst;
+        return inst;
+    }
+
+    /**
+     * Поставить запрос в очередь. fn выполняется в потоке БД и получает DatabaseManager,
+     * работающий через соединение этого потока. Пустой канал - без схлопывания.
+     */
+    template<typename F>
+    QFuture<std::invoke_result_t<F, DatabaseManager&>> submit(const QString &channel, F fn);
+
+    /**
+     * Вызвать callback в потоке context, когда future выполнится (отмененные пропускаются)
+     */
+    template<typename T, typename F>
+    static void then(QObject *context, const QFuture<T> &future, F callback);
+
+    /**
+     * Отменить ожидающий и выполняющийся запросы канала
+     */
+    void cancel(const QString &channel);
+    /**
+     * Остановить поток БД, ожидающие запросы отменяются
+     */
+    void shutdown();
+
+protected:
+    void run() override;
+
+private:
+    AsyncDatabase();
+    ~AsyncDatabase();
+
+    AsyncDatabase(const AsyncDatabase&) = delete;
+    AsyncDatabase& operator=(const AsyncDatabase&) = delete;
+
+    struct Task {
+        quint64 id = 0;
+        QString channel;
+        std::function<void()> exec;     // выполнить запрос (в потоке БД)
+        std::function<void()> deliver;  // отдать результат
+        std::function<void()> drop;     // отменить
+    };
+
+    void enqueue(Task task);
+    bool isStale(const Task &task);
+
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QQueue<Task> m_queue;
+    QHash<QString, quint64> m_latest;
+    quint64 m_lastId = 0;
+    bool m_stopping = false;
+};
+
+template<typename F>
+QFuture<std::invoke_result_t<F, DatabaseManager&>> AsyncDatabase::submit(const QString &channel, F fn)
+{
+    using T = std::invoke_result_t<F, DatabaseManager&>;
+    auto iface = std::make_shared<QFutureInterface<T>>();
+    auto result = std::make_shared<T>();
+    iface->reportStarted();
+
+    Task task;
+    task.channel = channel;
+    task.exec = [fn, result]() { *result = fn(DatabaseManager::instance()); };
+    task.deliver = [iface, result]() {
+        iface->reportResult(*result);
+        iface->reportFinished();
+    };
+    task.drop = [iface]() {
+        iface->reportCanceled();
+        iface->reportFinished();
+    };
+
+    QFuture<T> future = iface->future();
+    enqueue(task);
+    return future;
+}
+
+template<typename T, typename F>
+void AsyncDatabase::then(QObject *context, const QFuture<T> &future, F callback)
+{
+    auto *watcher = new QFutureWatcher<T>(context);
+    QObject::connect(watcher, &QFutureWatcherBase::finished, context, [watcher, callback]() {
+        if (!watcher->isCanceled()) callback(watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(future);
+}
+
+#endif // ASYNCDATABASE_H
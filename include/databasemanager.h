@@ -2,29 +2,400 @@
 #define DATABASEMANAGER_H
 
 #include "utils/settings.h"
+#include "elo.h"
 
 #include <QObject>
 #include <QtSql>
 #include <QVariantMap>
+#include <QThreadStorage>
+#include <QTimer>
+#include <QMutex>
+#include <atomic>
+#include <limits>
+#include <functional>
+
+/**
+ * Строки таблиц. Отсутствующий внешний ключ (NULL) представлен нулем.
+ */
+struct UserRow {
+    qint64 userId = 0;
+    QString surname;
+    QString name;
+    QString fatherName;
+};
+
+struct TeamRow {
+    qint64 teamId = 0;
+    QString title;
+};
+
+struct QuizRow {
+    qint64 quizId = 0;
+    QString topic;
+    qint64 timer = 0;
+};
+
+struct EventRow {
+    qint64 eventId = 0;
+    qint64 quizId = 0;
+    QString title;
+    qint64 time = 0; // секунды от эпохи
+    int type = 0;
+};
+
+struct QuestionRow {
+    qint64 questionId = 0;
+    qint64 quizId = 0;
+    QString text;
+    qint64 points = 0;
+    qint64 answer = 0;
+};
+
+struct AnswerRow {
+    qint64 answerId = 0;
+    qint64 questionId = 0;
+    QString text;
+};
+
+struct ParticipantRow {
+    qint64 participantId = 0;
+    qint64 eventId = 0;
+    qint64 userId = 0;
+    qint64 teamId = 0;
+    int number = 0;
+};
+
+/**
+ * Результат ответа участника на вопрос
+ */
+struct ResultRow {
+    qint64 resultId = 0;
+    qint64 questionId = 0;
+    qint64 participantId = 0;
+    qint64 eventId = 0;
+    bool result = false;
+};
+
+/**
+ * Итоги команды/участника за период, посчитанные в SQLite
+ */
+struct TeamScoreRow {
+    qint64 teamId = 0;
+    QString title;
+    int games = 0;
+    qint64 points = 0;
+    qint64 totalPoints = 0;
+    int percent = 0;
+};
+
+struct UserScoreRow {
+    qint64 userId = 0;
+    QString surname;
+    QString name;
+    QString fatherName;
+    int games = 0;
+    qint64 points = 0;
+    qint64 totalPoints = 0;
+    int percent = 0;
+};
+
+/**
+ * Участник мероприятия с его текущим счетом из participant_score
+ */
+struct ParticipantScoreRow {
+    ParticipantRow participant;
+    qint64 points = 0;
+    qint64 totalPoints = 0;
+    int answers = 0;
+};
+
+/**
+ * Найденный вопрос: snippet - фрагмент текста с совпадениями в [квадратных скобках]
+ */
+struct QuestionSearchRow {
+    qint64 questionId = 0;
+    qint64 quizId = 0;
+    QString topic;
+    QString snippet;
+    double rank = 0; // bm25, меньше - лучше
+};
+
+/**
+ * Ключ постраничной выборки: значение колонки сортировки и id последней прочитанной строки.
+ * Пустой ключ (id == 0) - первая страница.
+ */
+struct PageKey {
+    QVariant value;
+    qint64 id = 0;
+    bool isFirst() const { return id == 0; }
+};
+
+/**
+ * Квиз целиком: вопросы по порядку добавления, у каждого - его варианты ответа
+ */
+struct QuizQuestion {
+    QuestionRow question;
+    QVector<AnswerRow> answers;
+};
+
+struct QuizGraph {
+    QuizRow quiz;
+    QVector<QuizQuestion> questions;
+    bool isValid() const { return quiz.quizId != 0; }
+};
+
+/**
+ * Строки отчетов: один ответ команды/участника на вопрос
+ */
+struct TeamResultRow {
+    qint64 teamId = 0;
+    QString title;
+    qint64 quizId = 0;
+    int points = 0;
+    bool result = false;
+};
+
+struct UserResultRow {
+    qint64 userId = 0;
+    QString surname;
+    QString name;
+    QString fatherName;
+    qint64 quizId = 0;
+    int points = 0;
+    bool result = false;
+};
+
+/**
+ * Анализ вопроса по всем мероприятиям квиза.
+ * pValue - доля верных ответов (трудность, меньше - труднее),
+ * discrimination - точечно-бисериальная корреляция верного ответа с баллами участника
+ * без этого вопроса (различающая способность, 0 если не определена).
+ */
+struct ItemStatsRow {
+    QuestionRow question;
+    qint64 attempts = 0;
+    qint64 correct = 0;
+    double pValue = 0;
+    double discrimination = 0;
+};
+
+/**
+ * Строка таблицы рейтинга: name - ФИО физлица или название команды
+ */
+struct RatingRow {
+    int kind = 0; // DatabaseManager::RatingKind
+    qint64 entityId = 0;
+    QString name;
+    double rating = 0;
+    int games = 0;
+};
+
+struct RatingHistoryRow {
+    qint64 eventId = 0;
+    qint64 time = 0; // секунды от эпохи
+    double ratingBefore = 0;
+    double ratingAfter = 0;
+};
+
+/**
+ * Строка выгрузки ответов: один ответ участника или команды на вопрос с подписями.
+ * У командного участника userId == 0, у личного teamId == 0.
+ */
+struct AnswerExportRow {
+    qint64 resultId = 0;
+    qint64 eventId = 0;
+    QString eventTitle;
+    qint64 eventTime = 0; // секунды от эпохи
+    qint64 quizId = 0;
+    QString topic;
+    qint64 participantId = 0;
+    int number = 0;
+    qint64 userId = 0;
+    QString surname;
+    QString name;
+    QString fatherName;
+    qint64 teamId = 0;
+    QString teamTitle;
+    qint64 questionId = 0;
+    QString questionText;
+    int points = 0;
+    int result = 0;
+};
+
+// невалидная дата - без ограничения, пустой список - все мероприятия
+struct AnswerExportFilter {
+    QDateTime dateFrom;
+    QDateTime dateTo;
+    QVector<qint64> eventIds;
+};
 
 class DatabaseManager : public QObject
 {
     Q_OBJECT
 public:
+    /**
+     * RAII-обертка над транзакцией. Если commit() не вызван, в деструкторе выполняется откат.
+     * Вложенные транзакции реализуются через SAVEPOINT. Read - снимок для согласованного
+     * чтения нескольких запросов: блокировку на запись не берет и писателей не держит.
+     */
+    class Transaction
+    {
+    public:
+        enum Mode { Write, Read };
+        explicit Transaction(DatabaseManager &db, Mode mode = Write);
+        ~Transaction();
+        bool commit();
+        void rollback();
+        bool isActive() const { return m_active; }
+    private:
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+        DatabaseManager &m_manager;
+        int m_level = 0;
+        int m_changeMark = 0;
+        bool m_active = false;
+    };
+
+    // --- Уведомления об изменениях ---
+    // TableParticipantScore - производная таблица счета, id 0 - изменены все строки
+    enum Table { TableUser, TableTeam, TableQuiz, TableEvent, TableQuestion, TableAnswer, TableParticipant, TableResult,
+                 TableParticipantScore };
+    Q_ENUM(Table)
+
     static DatabaseManager& instance() {
         static DatabaseManager inst(QString::fromStdString(Settings::dbDir()) + "/quiz.db");
         return inst;
     }
 
+    /**
+     * Открыть соединение текущего потока. У каждого потока свое соединение к quiz.db,
+     * GUI поток использует соединение по умолчанию.
+     */
     bool open();
+    /**
+     * Закрыть соединение текущего потока. Соединения рабочих потоков закрываются
+     * автоматически при завершении потока.
+     */
     void close();
 
+    // --- WAL ---
+    enum CheckpointMode { CheckpointPassive, CheckpointFull, CheckpointTruncate };
+    bool checkpoint(CheckpointMode mode = CheckpointPassive);
+    // периодический пассивный checkpoint в фоне, 0 - выключить
+    void startBackgroundCheckpoint(int intervalMs);
+    QString synchronous() const { return m_synchronous; }
+
+    // --- Резервные копии ---
+    /**
+     * Горячая копия БД в path через VACUUM INTO соединением QSQLITE: писатели в WAL не ждут.
+     * Годовые архивы копируются рядом, в каталог <path без .db>-archive. progress(0..100)
+     * вызывается в потоке вызывающего. Копия пишется во временные файлы, проверяется
+     * verifyBackup и только потом заменяет path. Вызывать не из GUI потока.
+     */
+    bool backupTo(const QString &path, std::function<void(int)> progress = nullptr);
+    // каталог копий архивов для копии path
+    static QString backupArchiveDir(const QString &path);
+    // PRAGMA integrity_check и версия схемы файла копии
+    bool verifyBackup(const QString &path);
+    /**
+     * Снимок в каталог backup/ рядом с БД, хранится keep последних снимков.
+     * Возвращает путь снимка или пустую строку при ошибке.
+     */
+    QString snapshot(int keep);
+    QString snapshotDir() const;
+    // снимки по расписанию в фоне, 0 - выключить
+    void startSnapshotSchedule(int intervalMs, int keep);
+
+    // --- Рейтинги ---
+    // командный участник мероприятия рейтингуется как команда, личный - как физлицо
+    enum RatingKind { RatingUser = 0, RatingTeam = 1 };
+    /**
+     * Довести рейтинги до текущих результатов. Измененные мероприятия отмечают триггеры
+     * в rating_dirty (счет, состав участников, время, удаление); рейтинги откатываются
+     * по rating_history до самого раннего отмеченного и пересчитываются только дальше него.
+     * Чтение и расчет идут в снимке, блокировка на запись берется только на запись итога.
+     */
+    bool updateRatings(int &ratedEvents);
+    /**
+     * Пересчитать все рейтинги с нуля с новыми параметрами. Независимые группы участников
+     * (кто ни разу не встречался на одном мероприятии) считаются параллельно.
+     */
+    bool rebuildRatings(const RatingParams &params);
+    RatingParams ratingParams();
+    // по убыванию рейтинга, читается по индексу (kind, rating)
+    QVector<RatingRow> leaderboard(RatingKind kind, int limit, int offset = 0);
+    // место в рейтинге с 1, 0 - нет рейтинга
+    int ratingRank(RatingKind kind, qint64 entityId);
+    QVector<RatingHistoryRow> ratingHistory(RatingKind kind, qint64 entityId);
+    // фоновый updateRatings через delayMs после изменения результатов, 0 - выключить
+    void startRatingUpdates(int delayMs);
+
+    // --- Обслуживание ---
+    struct StorageStats {
+        qint64 pageCount = 0;
+        qint64 freePages = 0;
+        qint64 pageSize = 0;
+        int autoVacuum = 0; // 0 - NONE, 1 - FULL, 2 - INCREMENTAL
+    };
+    StorageStats storageStats();
+    /**
+     * Обслуживание в простое: PRAGMA optimize/ANALYZE, incremental vacuum, раз в сутки
+     * integrity_check по таблицам. Проход запускается в фоне, когда пользователь
+     * ничего не делал idleMs, и прерывается между шагами при любом вводе. 0 - выключить.
+     */
+    void startMaintenance(int idleMs);
+    // один проход обслуживания в текущем потоке, false - прерван или ошибка
+    bool runMaintenance();
+    /**
+     * Перевести существующий файл в auto_vacuum = INCREMENTAL. Это полный VACUUM: файл
+     * переписывается целиком, прервать нельзя, писатели ждут до конца. Только явно -
+     * при запуске до открытия окна (db_vacuum_convert=1).
+     */
+    bool convertIncrementalVacuum();
+    // действие пользователя: отложить обслуживание и прервать идущий проход
+    void userActivity();
+    /**
+     * Перед выходом, из GUI потока до close(): остановить таймеры фоновых задач, отменить
+     * длинные расчеты (isStopping) и дождаться задач глобального пула потоков.
+     */
+    void stopBackground();
+    bool isStopping() const { return m_stopping; }
+
+    // --- Архив ---
+    /**
+     * Перенести мероприятия старше cutoff вместе с участниками, результатами и счетом
+     * в годовые архивы archive/quiz-YYYY.db. Архивы подключаются через ATTACH к каждому
+     * соединению, отчеты за период читают представления all_event, all_participant,
+     * all_result и all_participant_score - UNION ALL основной базы и архивов.
+     * Справочники (физлица, команды, квизы, вопросы) остаются в основной базе.
+     */
+    bool archiveEvents(const QDateTime &cutoff, int &moved);
+    QString archiveDir() const;
+    // схемы подключенных архивов текущего соединения (arch_YYYY)
+    QStringList attachedArchives() const { return conn().archives; }
+    /**
+     * Время, с которого all_* видят все данные: при числе архивов больше ARCHIVE_ATTACH_LIMIT
+     * самые старые не подключаются. Минимум qint64 - подключены все.
+     */
+    qint64 archivesFrom() const { return conn().archivesFrom; }
+
     // init
     bool createTables();
+    // миграции схемы по PRAGMA user_version
+    bool migrate();
+    int schemaVersion();
+    /**
+     * Поколение данных: увеличивается триггерами при каждом изменении строки, в той же транзакции.
+     * Одинаковое поколение - те же данные (ключ кэша отчетов). -1 - ошибка чтения.
+     */
+    qint64 dataGeneration();
 
     // --- CRUD: user ---
     bool addUser(const QString &surname, const QString &name, const QString &fatherName, qint64 &outId);
     QVariantMap getUser(qint64 userId);
+    // пакетное чтение через кэш, результат в порядке ids (пустая запись - нет такого)
+    QVector<QVariantMap> getUsers(const QVector<qint64> &userIds);
     int getUser(const QString &surname, const QString &name, const QString &fatherName);
     QVector<QVariantMap> listUsers();
     bool updateUser(qint64 userId, const QString &surname, const QString &name, const QString &fatherName);
@@ -43,12 +414,15 @@ public:
     bool addTeamUser(qint64 userId, qint64 teamId);
     QVector<QVariantMap> listTeamUsers();
     bool removeTeamUser(qint64 userId, qint64 teamId);
+    // привести состав команды к userIds одной транзакцией
+    bool syncTeamUsers(qint64 teamId, const QSet<int> &userIds);
 
     // --- CRUD: quiz ---
     bool addQuiz(const QString &topic, qint64 timer, qint64 &outId);
     QVariantMap getQuiz(qint64 quizId);
     QVector<QVariantMap> listQuizzes();
     bool updateQuiz(qint64 quizId, const QString &topic, qint64 timer);
+    // квиз мероприятий, перенесенных в архив, не удаляется (триггер, ошибка в lastError)
     bool removeQuiz(qint64 quizId);
 
     // --- CRUD: question ---
@@ -56,6 +430,7 @@ public:
     QVariantMap getQuestion(qint64 questionId);
     QVector<QVariantMap> listQuestionsByQuiz(qint64 quizId);
     bool updateQuestion(qint64 questionId, qint64 quizId, const QString &text, qint64 points, qint64 answerId);
+    // как и removeQuiz - вопросы квиза архивных мероприятий не удаляются
     bool removeQuestion(qint64 questionId);
 
     // --- CRUD: answer ---
@@ -64,6 +439,8 @@ public:
     QVector<QVariantMap> listAnswersByQuestion(qint64 questionId);
     bool updateAnswer(qint64 answerId, qint64 questionId, const QString &text);
     bool removeAnswer(qint64 answerId);
+    // заменить все варианты ответа на вопрос одной транзакцией
+    bool replaceAnswers(qint64 questionId, const QStringList &answers);
 
     // --- CRUD: participant ---
     bool addParticipant(qint64 eventId, qint64 userId, qint64 teamId, int number, qint64 &outId);
@@ -75,6 +452,8 @@ public:
 
     // --- CRUD: result ---
     bool addResult(qint64 questionId, qint64 participantId, qint64 eventId, bool result, qint64 &outId);
+    // записать пакет результатов одной транзакцией
+    bool addResults(const QVector<ResultRow> &rows);
     QVariantMap getResult(qint64 resultId);
     QVector<QVariantMap> listResultsByParticipant(qint64 participantId);
     QVector<QVariantMap> listResultsByQuestion(qint64 questionId);
@@ -93,9 +472,110 @@ public:
     QVector<QVariantMap> resultTeams(const QDateTime dateFrom, const QDateTime dateTo);
     QVector<QVariantMap> resultUsers(const QDateTime dateFrom, const QDateTime dateTo);
 
+    // --- Типизированные списки: колонки читаются по индексу, без QVariantMap на строку ---
+    QVector<UserRow> listUserRows();
+    QVector<TeamRow> listTeamRows();
+    QVector<QuizRow> listQuizRows();
+    QVector<EventRow> listEventRows();
+    EventRow getEventRow(qint64 eventId);
+    QuizRow getQuizRow(qint64 quizId);
+
+    // --- Постраничные списки: WHERE (колонка, id) > ключ ORDER BY колонка, id LIMIT n ---
+    // Сортировка и фильтр по подстроке выполняются в SQLite, страница читается по индексу
+    enum EventSort { EventSortId, EventSortTitle, EventSortTime, EventSortType };
+    QVector<EventRow> listEventsPage(const PageKey &after, int limit, EventSort sort = EventSortTime,
+                                     Qt::SortOrder order = Qt::DescendingOrder, const QString &filter = QString());
+    static PageKey eventPageKey(const EventRow &row, EventSort sort);
+    // фильтр страниц для строк вне SQL (уведомления): те же правила, что у LIKE
+    static bool matchesFilter(const QString &text, const QString &filter);
+    enum QuizSort { QuizSortId, QuizSortTopic };
+    QVector<QuizRow> listQuizzesPage(const PageKey &after, int limit, QuizSort sort = QuizSortId,
+                                     Qt::SortOrder order = Qt::AscendingOrder, const QString &filter = QString());
+    static PageKey quizPageKey(const QuizRow &row, QuizSort sort);
+    QVector<QuestionRow> listQuestionRowsByQuiz(qint64 quizId);
+    QVector<AnswerRow> listAnswerRowsByQuestion(qint64 questionId);
+    QVector<ParticipantRow> listParticipantRowsByEvent(qint64 eventId);
+    QVector<ResultRow> listResultRowsByParticipant(qint64 participantId);
+    QVector<ResultRow> listResultRowsByQuestion(qint64 questionId);
+    /**
+     * Загрузить квиз с вопросами и ответами набором запросов, а не запросом на каждый вопрос.
+     * Для несуществующего квиза возвращается граф с isValid() == false.
+     */
+    QuizGraph loadQuizGraph(qint64 quizId);
+    QVector<TeamResultRow> resultTeamRows(const QDateTime dateFrom, const QDateTime dateTo);
+    QVector<UserResultRow> resultUserRows(const QDateTime dateFrom, const QDateTime dateTo);
+    /**
+     * Потоковый обход ответов (включая архивные) для выгрузки: курсор только вперед,
+     * строки по одной передаются в visit и нигде не накапливаются. visit вернул false - остановить.
+     */
+    bool forEachAnswerRow(const AnswerExportFilter &filter, const std::function<bool(const AnswerExportRow&)> &visit);
+    // одна строка на команду/участника: игры, набранные и возможные баллы, процент
+    QVector<TeamScoreRow> teamScores(const QDateTime dateFrom, const QDateTime dateTo);
+    QVector<UserScoreRow> userScores(const QDateTime dateFrom, const QDateTime dateTo);
+    // участники мероприятия по убыванию баллов
+    QVector<ParticipantScoreRow> eventScores(qint64 eventId);
+    /**
+     * Анализ вопросов квиза за один проход по ответам всех его мероприятий (включая архивные),
+     * в порядке вопросов квиза. Вопросы без ответов - с attempts == 0.
+     */
+    QVector<ItemStatsRow> itemAnalysis(qint64 quizId);
+    // те же выборки потоком: строки по одной передаются в visit, false - остановить
+    bool forEachTeamScore(const QDateTime dateFrom, const QDateTime dateTo, const std::function<bool(const TeamScoreRow&)> &visit);
+    bool forEachUserScore(const QDateTime dateFrom, const QDateTime dateTo, const std::function<bool(const UserScoreRow&)> &visit);
+    bool forEachEventScore(qint64 eventId, const std::function<bool(const ParticipantScoreRow&)> &visit);
+    // число строк в таблице (оценка объема для прогресса)
+    qint64 rowCount(Table table);
+    /**
+     * Пересчитать participant_score по таблице result. Таблица поддерживается триггерами,
+     * пересчет нужен только для восстановления после правок базы в обход приложения.
+     */
+    bool rebuildScores();
+
+    /**
+     * Полнотекстовый поиск по тексту вопросов и ответов (FTS5), лучшие совпадения первыми.
+     * Слова запроса ищутся по префиксу, все должны встретиться в вопросе или его ответах.
+     */
+    QVector<QuestionSearchRow> searchQuestions(const QString &query, int limit = 50);
+
     // utility
-    QString lastError() const { return m_lastError; }
-    QSqlDatabase database() const { return m_db; }
+    QString lastError() const { return conn().lastError; }
+    QSqlDatabase database() const { return conn().db; }
+
+    // кэш подготовленных запросов (ключ - текст SQL)
+    void setStatementCacheEnabled(bool enabled);
+    bool statementCacheEnabled() const { return m_statementCacheEnabled; }
+    void clearStatementCache();
+    int statementCacheSize() const { return conn().statements.size(); }
+
+    /**
+     * Кэш сущностей, общий для всех потоков: getUser/getUsers, getTeam, getQuiz, getEvent(id),
+     * listQuizRows и listParticipantRowsByEvent. Записи сбрасываются методами записи
+     * (сразу и еще раз после фиксации транзакции). Внутри транзакции кэш не пополняется.
+     */
+    struct CacheStats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        int entries = 0;
+    };
+    CacheStats entityCacheStats() const;
+    void setEntityCacheEnabled(bool enabled);
+    bool entityCacheEnabled() const { return m_entityCacheEnabled; }
+    void clearEntityCache();
+
+protected:
+    // ввод пользователя для планировщика обслуживания
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
+signals:
+    /**
+     * Изменения, сделанные через DatabaseManager. Внутри транзакции копятся и отправляются
+     * после фиксации (при откате отбрасываются). Отправляются из потока, выполнившего запись,
+     * получатели в GUI потоке получают их через очередь событий.
+     * Каскадные удаления сообщаются только там, где это нужно интерфейсу (мероприятия квиза).
+     */
+    void rowInserted(DatabaseManager::Table table, qint64 id);
+    void rowUpdated(DatabaseManager::Table table, qint64 id);
+    void rowDeleted(DatabaseManager::Table table, qint64 id);
 
 private:
     DatabaseManager(const QString &dbPath);
@@ -104,12 +584,164 @@ private:
     DatabaseManager(const DatabaseManager&) = delete;
     DatabaseManager& operator=(const DatabaseManager&) = delete;
 
+    enum ChangeKind { RowInserted, RowUpdated, RowDeleted };
+    struct Change {
+        ChangeKind kind;
+        Table table;
+        qint64 id;
+    };
+    void notify(ChangeKind kind, Table table, qint64 id);
+    void emitChange(const Change &change);
+    void invalidateCache(const Change &change);
+    // мероприятия с ответами: id -> время и суммы ответов/баллов для rating_event
+    struct RatingEventState {
+        qint64 time = 0;
+        qint64 answers = 0;
+        qint64 points = 0;
+    };
+    // вся история разом - для полного пересчета
+    bool loadRatingEvents(QHash<qint64, RatingEventState> &events);
+    using RatingKey = QPair<int, qint64>; // вид и id физлица/команды
+    struct RatingState {
+        double rating = 0;
+        int games = 0;
+    };
+    struct RatingEntry {
+        RatingKey key;
+        double points = 0;
+    };
+    struct RatingWrite {
+        qint64 eventId = 0;
+        RatingKey key;
+        double before = 0;
+        double after = 0;
+    };
+    /**
+     * Рассчитать мероприятия по порядку поверх ratings (отсутствующие - с начальным рейтингом)
+     */
+    static void rateEvents(const QVector<qint64> &events, const QHash<qint64, QVector<RatingEntry>> &entries,
+                           const RatingParams &params, QHash<RatingKey, RatingState> &ratings, QVector<RatingWrite> &history,
+                           const std::atomic<bool> *cancel = nullptr);
+    // вставка rows пачками по RATING_WRITE_ROWS строк в одном операторе; insert - без VALUES
+    bool insertRows(const QString &insert, int columns, const QVector<QVariantList> &rows);
+    // записать историю, итоговые рейтинги и отметки учтенных мероприятий (в транзакции вызывающего)
+    bool writeRatings(const QVector<qint64> &events, const QHash<qint64, RatingEventState> &state,
+                      const QVector<RatingWrite> &history, const QHash<RatingKey, RatingState> &ratings);
+    // integrity_check файла и, если expectedVersion >= 0, версия схемы
+    bool verifyFile(const QString &path, int expectedVersion);
+    // create - архив создается переносом: таблицы создаются один раз, здесь
+    bool attachArchive(const QString &year, bool create = false);
+    bool attachArchives();
+    bool ensureArchives();
+    // ensureArchives и ошибка, если данные начиная с fromTime лежат в неподключенных архивах
+    bool ensureArchivesFrom(qint64 fromTime);
+    QVariantMap cachedRow(QHash<qint64, QVariantMap> &cache, qint64 id, const QString &sql);
+    bool cacheLookup(QHash<qint64, QVariantMap> &cache, qint64 id, QVariantMap &row);
+    void cacheStore(QHash<qint64, QVariantMap> &cache, qint64 id, const QVariantMap &row, quint64 generation);
+
+    // подготовленный запрос кэша и момент последнего использования для вытеснения LRU
+    struct CachedStatement {
+        QSqlQuery query;
+        quint64 lastUse = 0;
+    };
+    /**
+     * Соединение потока со своим кэшем запросов и уровнем вложенности транзакций
+     */
+    struct Connection {
+        QSqlDatabase db;
+        QHash<QString, CachedStatement> statements;
+        quint64 statementClock = 0;
+        int transactionLevel = 0;
+        QString lastError;
+        // размер прошлой выборки по тексту запроса - для reserve()
+        QHash<QString, int> rowHints;
+        // изменения незафиксированной транзакции
+        QVector<Change> pendingChanges;
+        // подключенные архивы и поколение набора архивов, под которое построены представления
+        QStringList archives;
+        int archiveGeneration = -1;
+        qint64 archivesFrom = std::numeric_limits<qint64>::min();
+        ~Connection();
+    };
+    Connection &conn() const;
+    QSqlDatabase &db() const { return conn().db; }
+    bool isMainThread() const;
+
+    /**
+     * Подготовленный запрос из кэша соединения. Кэшируется только постоянный текст SQL:
+     * запросы, собранные под параметры вызова, выполняются через execUncached.
+     */
+    bool prepareCached(QSqlQuery &query, const QString &sql);
+    // запрос читается: выполнен и курсор еще не дошел до конца и не закрыт
+    static bool statementInUse(const QSqlQuery &query);
     bool execPrepared(QSqlQuery &query, const QVariantList &bindValues = QVariantList());
+    bool execPrepared(QSqlQuery &query, const QString &sql, const QVariantList &bindValues = QVariantList());
+    // подготовка и выполнение без кэша - для SQL, собранного под вызов
+    bool execUncached(QSqlQuery &query, const QString &sql, const QVariantList &bindValues = QVariantList());
+    // QSqlQuery::exec(sql) с замером времени для QueryProfiler
+    bool exec(QSqlQuery &query, const QString &sql);
+    QVariantMap fetchOne(QSqlQuery &query);
+    QVector<QVariantMap> fetchAll(QSqlQuery &query);
+    template<typename Row, typename Decode>
+    QVector<Row> fetchRows(QSqlQuery &query, Decode decode);
+    template<typename Decode, typename Row>
+    bool forEachRow(QSqlQuery &query, Decode decode, const std::function<bool(const Row&)> &visit);
     QVariantMap recordToMap(const QSqlRecord &rec);
 
+    static const int STATEMENT_CACHE_LIMIT = 128;
+    // опрос размера файла копии для хода копирования
+    static const int BACKUP_POLL_MS = 200;
+    static const int ENTITY_CACHE_LIMIT = 10000;
+    // строк рейтинга в одном INSERT: до 500 параметров, ниже лимита старых SQLite (999)
+    static const int RATING_WRITE_ROWS = 100;
+    // SQLite по умолчанию позволяет подключить не больше 10 баз
+    static const int ARCHIVE_ATTACH_LIMIT = 8;
+    // проход обслуживания не чаще раза в час
+    static const qint64 MAINTENANCE_INTERVAL_MS = 3600 * 1000;
+
     QString m_dbPath;
-    QSqlDatabase m_db;
-    QString m_lastError;
+    QString m_synchronous = "NORMAL";
+    mutable QThreadStorage<Connection*> m_connections;
+    QTimer *m_checkpointTimer = nullptr;
+    QTimer *m_snapshotTimer = nullptr;
+    int m_snapshotKeep = 7;
+    std::atomic<bool> m_backupRunning{false};
+    // выход: длинные задачи прерываются, таймеры не перезапускаются
+    std::atomic<bool> m_stopping{false};
+    // перенос в архив и копия не идут одновременно: набор файлов копии согласован
+    QMutex m_archiveMutex;
+    QTimer *m_maintenanceTimer = nullptr;
+    int m_maintenanceIdleMs = 0;
+    std::atomic<qint64> m_lastActivity{0};       // мс от эпохи
+    std::atomic<qint64> m_lastMaintenance{0};
+    std::atomic<qint64> m_lastIntegrityCheck{0};
+    std::atomic<bool> m_maintenanceRunning{false};
+    std::atomic<bool> m_maintenanceYield{false};
+    QTimer *m_ratingTimer = nullptr;
+    int m_ratingDelayMs = 0;
+    std::atomic<bool> m_ratingRunning{false};
+    std::atomic<bool> m_ratingPending{false};
+    // один пересчет рейтингов за раз, защищает и m_ratingParams
+    QMutex m_ratingMutex;
+    RatingParams m_ratingParams;
+    // меняется при создании архива: соединения других потоков переподключают архивы
+    std::atomic<int> m_archiveGeneration{0};
+    bool m_statementCacheEnabled = true;
+
+    // кэш сущностей, защищен m_cacheMutex
+    mutable QMutex m_cacheMutex;
+    bool m_entityCacheEnabled = true;
+    QHash<qint64, QVariantMap> m_users;
+    QHash<qint64, QVariantMap> m_teams;
+    QHash<qint64, QVariantMap> m_quizzes;
+    QHash<qint64, QVariantMap> m_events;
+    QVector<QuizRow> m_quizList;
+    bool m_quizListValid = false;
+    QHash<qint64, QVector<ParticipantRow>> m_participants; // по event_id
+    // меняется при каждом сбросе: чтение, начатое до записи, не попадет в кэш
+    quint64 m_cacheGeneration = 0;
+    quint64 m_cacheHits = 0;
+    quint64 m_cacheMisses = 0;
 };
 
 #endif // DATABASEMANAGER_H
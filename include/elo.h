@@ -0,0 +1,43 @@
+#ifndef ELO_H
+#define ELO_H
+
+#include <QVector>
+
+/**
+ * Параметры рейтинга. Новичок с games < provisionalGames меняет рейтинг с двойным K,
+ * чтобы быстрее дойти до своего уровня.
+ */
+struct RatingParams {
+    double initial = 1500;
+    double k = 32;
+    int provisionalGames = 10;
+    // rating_initial, rating_k, rating_provisional из настроек
+    static RatingParams fromSettings();
+    bool operator==(const RatingParams &o) const { return initial == o.initial && k == o.k && provisionalGames == o.provisionalGames; }
+};
+
+/**
+ * Эло для мероприятия с несколькими участниками: мероприятие - круговой турнир,
+ * каждая пара сравнивается по набранным баллам (больше - победа, поровну - ничья).
+ * Изменение = K * (фактический - ожидаемый результат), оба усреднены по n - 1 соперникам.
+ */
+class Elo
+{
+public:
+    struct Entry {
+        double rating = 0;
+        int games = 0;
+        double points = 0;
+        double newRating = 0; // результат rateEvent
+    };
+
+    /**
+     * Посчитать newRating всех участников мероприятия. O(n^2) по числу участников.
+     * Меньше двух участников - рейтинг не меняется.
+     */
+    static void rateEvent(QVector<Entry> &entries, const RatingParams &params);
+    // вероятность победы a над b
+    static double expected(double ratingA, double ratingB);
+};
+
+#endif // ELO_H
@@ -8,6 +8,10 @@
 #include <QFile>
 #include <QTextStream>
 #include <QResource>
+#include <functional>
+
+class DatabaseManager;
+struct AnswerExportFilter;
 
 class ExportHelper : public QObject
 {
@@ -15,6 +19,32 @@ class ExportHelper : public QObject
 public:
     static bool exportQuiz(quint64 id, QWidget *parent = nullptr);
 
+    /**
+     * Выгрузка ответов для BI: CSV (RFC 4180, разделитель запятая) или JSON Lines,
+     * по желанию сжатые gzip. Строки пишутся потоком через буфер BUFFER_SIZE,
+     * память не зависит от числа строк. Файл пишется в path.part и переименовывается в конце.
+     */
+    enum Format { Csv, JsonLines };
+    struct Result {
+        bool ok = false;
+        bool canceled = false;
+        QString error;
+        qint64 rows = 0;
+        qint64 bytes = 0; // размер файла
+    };
+    // выгружено строк; false - отменить
+    using Progress = std::function<bool(qint64 rows)>;
+
+    static const int BUFFER_SIZE = 1 << 20;
+    static const int PROGRESS_ROWS = 10000;
+
+    static Result exportAnswers(DatabaseManager &db, const QString &path, Format format, bool gzip,
+                                const AnswerExportFilter &filter, Progress progress = nullptr);
+    /**
+     * Выбор файла (формат и сжатие - по расширению), выгрузка в потоке БД с окном прогресса
+     */
+    static void exportAnswersDialog(const AnswerExportFilter &filter, QWidget *parent = nullptr);
+
 protected:
     static QString readFile(const QString &filePath);
     static bool writeFile(const QString &filePath, const QString &content);
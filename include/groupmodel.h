@@ -1,6 +1,7 @@
 #pragma once
 #include <QAbstractListModel>
 #include <QList>
+#include "databasemanager.h"
 
 struct Group {
     int groupId = -1;
@@ -24,6 +25,14 @@ public:
     int addGroupToModel(const Group &g); // append, returns row
     void removeGroupAtRow(int row);
 
+private slots:
+    // изменения команд и их состава применяются точечно
+    void onRowInserted(DatabaseManager::Table table, qint64 id);
+    void onRowUpdated(DatabaseManager::Table table, qint64 id);
+    void onRowDeleted(DatabaseManager::Table table, qint64 id);
+
 private:
+    Group loadGroup(qint64 groupId) const;
+
     QList<Group> m_groups;
 };
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QObject>
+#include <QWidget>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+class DatabaseManager;
+
+/**
+ * Потоковый импорт физлиц и вопросов из CSV (разделитель ; или ,) и JSON Lines.
+ * Файл читается построчно, строки проверяются, физлица сверяются с базой по
+ * фамилии/имени/отчеству через хэш, запись идет пакетами в транзакциях.
+ *
+ * Физлица: surname;name;father_name или {"surname", "name", "father_name"}.
+ * Вопросы: topic;timer;text;points;answer;ответ1;ответ2;... или
+ * {"topic", "timer", "text", "points", "answer", "answers": [...]},
+ * answer - номер правильного ответа с 1, квиз ищется или создается по теме.
+ */
+class ImportHelper : public QObject
+{
+    Q_OBJECT
+public:
+    enum Kind { Users, Questions };
+
+    struct RowError {
+        qint64 line = 0;
+        QString message;
+    };
+    struct Result {
+        bool ok = false;
+        bool canceled = false;
+        QString error;          // ошибка файла или базы, импорт прерван
+        qint64 rows = 0;        // прочитано записей
+        qint64 inserted = 0;
+        qint64 duplicates = 0;
+        qint64 failed = 0;      // отклонено при проверке
+        QVector<RowError> errors; // первые MAX_ERRORS ошибок строк
+    };
+    // прочитано байт из total; false - отменить импорт
+    using Progress = std::function<bool(qint64 done, qint64 total)>;
+
+    static const int BATCH_SIZE = 5000;
+    static const int MAX_ERRORS = 1000;
+
+    /**
+     * Импорт в текущем потоке через db. Уже записанные пакеты при ошибке или отмене сохраняются.
+     */
+    static Result importFile(DatabaseManager &db, Kind kind, const QString &path, Progress progress = nullptr);
+    /**
+     * Выбор файла, импорт в потоке пула на своем соединении с окном прогресса и итоговое сообщение
+     */
+    static void importDialog(Kind kind, QWidget *parent = nullptr);
+};
@@ -18,6 +18,8 @@
 #include <QLineEdit>
 #include <QSortFilterProxyModel>
 #include <QComboBox>
+#include <QListWidget>
+#include <QTimer>
 
 class ParticipantSelectorWidget;
 
@@ -82,15 +84,18 @@ private:
     QWidget* createQuizWidget();
     QWidget* createStatisticWidget();
 
-    QSortFilterProxyModel *proxyModel;
-    QSortFilterProxyModel *quizProxyModel;
-
     QPushButton* addEventButton;
     QPushButton* addQuizButton;
 
+    // поиск по тексту вопросов во всех квизах
+    QLineEdit* questionSearchEdit;
+    QListWidget* questionSearchList;
+    QTimer* questionSearchTimer;
+
 private slots:
     void onAddEventButtonClicked();
     void onAddQuizButtonClicked();
+    void onQuestionSearch();
 };
 
 #endif // MAINWINDOW_H
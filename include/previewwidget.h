@@ -5,7 +5,10 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QComboBox>
+#include <QVariantMap>
+#include <QVector>
 #include "groupmanager.h"
+#include "databasemanager.h"
 
 class ParticipantSelectorWidget;
 
@@ -29,6 +32,9 @@ public:
     void onTableRowClicked(int index);
 
     int eventId = -1;
+
+private:
+    void showEventPreview(const QVariantMap &event, const QVector<QuizRow> &quizes);
 };
 
 #endif
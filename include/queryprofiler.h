@@ -0,0 +1,71 @@
+#ifndef QUERYPROFILER_H
+#define QUERYPROFILER_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <QSqlDatabase>
+#include <atomic>
+
+/**
+ * Профилировщик SQL: гистограмма времени выполнения по тексту запроса
+ * и журнал медленных запросов с планом (EXPLAIN QUERY PLAN) в логгер "SQL".
+ * Выключенный профилировщик стоит одного атомарного чтения на запрос.
+ */
+class QueryProfiler
+{
+public:
+    static QueryProfiler& instance() {
+        static QueryProfiler inst;
+        return inst;
+    }
+
+    /**
+     * Статистика одного запроса. Гистограмма по степеням двойки в микросекундах:
+     * корзина i - от 2^i до 2^(i+1) мкс, p99 оценивается верхней границей корзины.
+     */
+    struct Stat {
+        static const int BUCKETS = 24;
+        QString sql;
+        quint64 count = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+        quint32 buckets[BUCKETS] = {};
+        bool planLogged = false;
+        qint64 percentileNs(double p) const;
+    };
+
+    bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+    // запросы дольше порога пишутся в журнал, 0 - не писать
+    void setSlowThresholdMs(int ms) { m_slowNs.store(qint64(ms) * 1000000, std::memory_order_relaxed); }
+    int slowThresholdMs() const { return int(m_slowNs.load(std::memory_order_relaxed) / 1000000); }
+
+    /**
+     * Учесть выполнение запроса. db - соединение, на котором он выполнялся:
+     * план медленного запроса снимается на нем же.
+     */
+    void record(const QString &sql, qint64 ns, const QSqlDatabase &db);
+
+    // копия статистики, по убыванию суммарного времени
+    QVector<Stat> stats() const;
+    // вывести статистику в логгер "SQL"
+    void dump() const;
+    void reset();
+
+private:
+    QueryProfiler();
+
+    QueryProfiler(const QueryProfiler&) = delete;
+    QueryProfiler& operator=(const QueryProfiler&) = delete;
+
+    QString explain(const QString &sql, const QSqlDatabase &db) const;
+
+    std::atomic<bool> m_enabled{false};
+    std::atomic<qint64> m_slowNs{0};
+    mutable QMutex m_mutex;
+    QHash<QString, Stat> m_stats;
+};
+
+#endif // QUERYPROFILER_H
@@ -11,6 +11,7 @@
 #include <QMessageBox>
 #include <QSpinBox>
 #include "lm.h"
+#include "databasemanager.h"
 
 class QuestionWidget : public QWidget
 {
@@ -18,7 +19,12 @@ class QuestionWidget : public QWidget
 
 public:
     explicit QuestionWidget(QString topic, qint64 quizId, qint64 questionId, QWidget *parent = nullptr);
+    // вопрос и ответы уже загружены из БД
+    QuestionWidget(QString topic, qint64 quizId, const QuizQuestion &question, QWidget *parent = nullptr);
 protected:
+    void initUi();
+    void fillQuestion(const QuizQuestion &question);
+
     QPushButton* getLMButton;
     QComboBox* difficultyComboBox;
     QLineEdit* questionEdit;
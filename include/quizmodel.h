@@ -4,6 +4,7 @@
 #include <QAbstractTableModel>
 #include <QVector>
 #include <QDate>
+#include "databasemanager.h"
 
 struct Quiz {
     int id;
@@ -22,13 +23,38 @@ public:
     QVariant data(const QModelIndex &index, int role) const override;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
     Qt::ItemFlags flags(const QModelIndex &index) const override;
+    // строки подгружаются страницами по мере прокрутки
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    // сортировка и фильтр выполняются в БД, модель перечитывается с первой страницы
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+    void setFilter(const QString &filter);
 
     void loadSampleData();
 
     bool addQuiz(const Quiz& ev);
 
+private slots:
+    // изменения в БД применяются точечно, без сброса модели
+    void onRowInserted(DatabaseManager::Table table, qint64 id);
+    void onRowUpdated(DatabaseManager::Table table, qint64 id);
+    void onRowDeleted(DatabaseManager::Table table, qint64 id);
+
 private:
+    void appendPage(const QVector<QuizRow> &rows);
+    void placeQuiz(const QuizRow &row);
+    int rowOfId(qint64 id) const;
+    bool lessThan(const Quiz &a, const Quiz &b) const;
+
+    static const int PAGE_SIZE = 100;
+
     QVector<Quiz> m_events;
+    PageKey m_lastKey;
+    bool m_hasMore = false;
+    bool m_loading = false;
+    DatabaseManager::QuizSort m_sort = DatabaseManager::QuizSortId;
+    Qt::SortOrder m_order = Qt::AscendingOrder;
+    QString m_filter;
 };
 
 #endif // EVENTSMODEL_H
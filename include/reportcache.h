@@ -0,0 +1,76 @@
+#ifndef REPORTCACHE_H
+#define REPORTCACHE_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QMutex>
+#include <QDir>
+#include <atomic>
+
+/**
+ * Кэш готовых отчетов в Settings::dbDir()/report_cache.
+ * Ключ - вид отчета, параметры и поколение данных (DatabaseManager::dataGeneration),
+ * поэтому после любой записи в базу старые файлы просто перестают находиться.
+ * Время последнего использования - mtime файла, вытеснение LRU по объему и числу файлов.
+ */
+class ReportCache
+{
+public:
+    static ReportCache& instance() {
+        static ReportCache inst;
+        return inst;
+    }
+
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        int entries = 0;
+        qint64 bytes = 0;
+    };
+
+    static QString key(const QString &kind, const QStringList &params, qint64 generation);
+
+    /**
+     * Путь к готовому отчету или пустая строка
+     */
+    QString lookup(const QString &key);
+    /**
+     * Перенести сформированный файл в кэш, возвращает новый путь (при ошибке - исходный)
+     */
+    QString store(const QString &key, const QString &fileName);
+
+    bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+    void setLimits(qint64 maxBytes, int maxEntries);
+    void clear();
+    Stats stats();
+    QString directory() const { return m_dir.path(); }
+
+private:
+    ReportCache();
+
+    ReportCache(const ReportCache&) = delete;
+    ReportCache& operator=(const ReportCache&) = delete;
+
+    struct Entry {
+        qint64 size = 0;
+        qint64 lastUsed = 0; // мс от эпохи
+    };
+    QString filePath(const QString &key) const;
+    void load();
+    void evict();
+
+    QDir m_dir;
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries; // имя файла -> запись
+    bool m_loaded = false;
+    qint64 m_bytes = 0;
+    qint64 m_maxBytes = 64ll * 1024 * 1024;
+    int m_maxEntries = 200;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+    std::atomic<bool> m_enabled{true};
+};
+
+#endif // REPORTCACHE_H
@@ -8,11 +8,26 @@
 #include <QFile>
 #include <QTextStream>
 #include <QResource>
+#include <functional>
+
+class DatabaseManager;
 
 class ReportHelper : public QObject
 {
     Q_OBJECT
 public:
+    /**
+     * Итог формирования отчета без участия GUI: можно вызывать из любого потока
+     */
+    struct Output {
+        bool ok = false;
+        bool canceled = false;
+        QString fileName;
+        QString error;
+    };
+    // процент готовности; false - отменить
+    using Progress = std::function<bool(int percent)>;
+
     /**
      * Отчет по eventId
      */
@@ -25,4 +40,35 @@ public:
      * Отчет по участникам
      */
     static bool reportUsers(QDateTime dateFrom, QDateTime dateTo);
+    /**
+     * Анализ вопросов квиза по всем его мероприятиям: трудность и различающая способность
+     */
+    static bool reportItems(quint64 quizId);
+    /**
+     * Таблица рейтинга физлиц (kind = 0) или команд (kind = 1), DatabaseManager::RatingKind
+     */
+    static bool reportRatings(int kind);
+
+    /**
+     * Те же отчеты через переданное соединение, без окон и браузера - для фоновых задач
+     */
+    static Output writeQuiz(DatabaseManager &db, quint64 id, const Progress &progress = nullptr);
+    static Output writeTeams(DatabaseManager &db, QDateTime dateFrom, QDateTime dateTo, const Progress &progress = nullptr);
+    static Output writeUsers(DatabaseManager &db, QDateTime dateFrom, QDateTime dateTo, const Progress &progress = nullptr);
+    static Output writeItems(DatabaseManager &db, quint64 quizId, const Progress &progress = nullptr);
+    static Output writeRatings(DatabaseManager &db, int kind, const Progress &progress = nullptr);
+
+    /**
+     * Открыть готовый отчет в браузере, если это разрешено
+     */
+    static void openReport(const QString &fileName);
+    /**
+     * Открывать ли готовый отчет в браузере (по умолчанию да, бенчмарк выключает)
+     */
+    static void setOpenInBrowser(bool open) { s_openInBrowser = open; }
+private:
+    static QString newFileName();
+    static bool show(const Output &output);
+
+    static bool s_openInBrowser;
 };
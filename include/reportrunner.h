@@ -0,0 +1,76 @@
+#ifndef REPORTRUNNER_H
+#define REPORTRUNNER_H
+
+#include "reporthelper.h"
+#include <QObject>
+#include <QHash>
+#include <QThreadPool>
+#include <QDateTime>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+class DatabaseManager;
+
+/**
+ * Фоновое формирование отчетов. Каждая задача выполняется в своем потоке пула
+ * со своим соединением (DatabaseManager работает через соединение потока),
+ * одновременно идет не больше maxConcurrent() задач, остальные ждут в очереди.
+ * Сигналы доставляются в поток раннера (GUI).
+ */
+class ReportRunner : public QObject
+{
+    Q_OBJECT
+public:
+    static ReportRunner& instance() {
+        static ReportRunner inst;
+        return inst;
+    }
+
+    using Job = std::function<ReportHelper::Output(DatabaseManager&, const ReportHelper::Progress&)>;
+
+    /**
+     * Поставить задачу в очередь, возвращает id задачи
+     */
+    int start(const QString &title, Job job);
+    int startQuiz(quint64 eventId);
+    int startTeams(const QDateTime &dateFrom, const QDateTime &dateTo);
+    int startUsers(const QDateTime &dateFrom, const QDateTime &dateTo);
+    /**
+     * То же с немодальным окном прогресса и кнопкой отмены; готовый отчет открывается в браузере
+     */
+    int startWithProgress(const QString &title, Job job, QWidget *parent = nullptr);
+
+    /**
+     * Отменить задачу: ожидающая не запустится, выполняющаяся остановится на следующей строке
+     */
+    void cancel(int id);
+    void cancelAll();
+    int activeJobs() const { return m_jobs.size(); }
+
+    int maxConcurrent() const { return m_pool.maxThreadCount(); }
+    void setMaxConcurrent(int count) { m_pool.setMaxThreadCount(qMax(count, 1)); }
+    /**
+     * Дождаться завершения всех задач (при выходе из программы)
+     */
+    void waitForDone() { m_pool.waitForDone(); }
+
+signals:
+    void started(int id, const QString &title);
+    void progress(int id, int percent);
+    void finished(int id, const QString &fileName);
+    void failed(int id, const QString &error);
+    void canceled(int id);
+
+private:
+    ReportRunner();
+
+    ReportRunner(const ReportRunner&) = delete;
+    ReportRunner& operator=(const ReportRunner&) = delete;
+
+    QThreadPool m_pool;
+    QHash<int, std::shared_ptr<std::atomic<bool>>> m_jobs; // id -> флаг отмены
+    int m_lastId = 0;
+};
+
+#endif // REPORTRUNNER_H
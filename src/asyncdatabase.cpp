@@ -0,0 +1,108 @@
+#include "asyncdatabase.h"
+#include "unilog/unilog.h"
+
+AsyncDatabase::AsyncDatabase()
+    : QThread(nullptr)
+{
+    setObjectName("db-worker");
+    start();
+}
+
+AsyncDatabase::~AsyncDatabase()
+{
+    shutdown();
+}
+
+void AsyncDatabase::enqueue(Task task)
+{
+    QList<Task> dropped;
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_stopping) {
+            dropped.append(task);
+        } else {
+            task.id = ++m_lastId;
+            if (!task.channel.isEmpty()) {
+                // новый запрос вытесняет еще не начатый запрос того же канала
+                for (auto it = m_queue.begin(); it != m_queue.end(); ) {
+                    if (it->channel == task.channel) {
+                        dropped.append(*it);
+                        it = m_queue.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                m_latest[task.channel] = task.id;
+            }
+            m_queue.enqueue(task);
+            m_cond.wakeOne();
+        }
+    }
+    for (auto &t : dropped) t.drop();
+}
+
+bool AsyncDatabase::isStale(const Task &task)
+{
+    if (task.channel.isEmpty()) return false;
+    QMutexLocker lock(&m_mutex);
+    return m_latest.value(task.channel) != task.id;
+}
+
+void AsyncDatabase::cancel(const QString &channel)
+{
+    QList<Task> dropped;
+    {
+        QMutexLocker lock(&m_mutex);
+        for (auto it = m_queue.begin(); it != m_queue.end(); ) {
+            if (it->channel == channel) {
+                dropped.append(*it);
+                it = m_queue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        // выполняющийся запрос канала станет устаревшим
+        m_latest[channel] = 0;
+    }
+    for (auto &t : dropped) t.drop();
+}
+
+void AsyncDatabase::shutdown()
+{
+    QList<Task> dropped;
+    {
+        QMutexLocker lock(&m_mutex);
+        m_stopping = true;
+        while (!m_queue.isEmpty()) dropped.append(m_queue.dequeue());
+        m_cond.wakeAll();
+    }
+    for (auto &t : dropped) t.drop();
+    wait();
+}
+
+void AsyncDatabase::run()
+{
+    DatabaseManager &db = DatabaseManager::instance();
+    if (!db.open()) {
+        G_ERROR() << "Database worker: failed to open connection:" << db.lastError();
+    }
+
+    forever {
+        Task task;
+        {
+            QMutexLocker lock(&m_mutex);
+            while (m_queue.isEmpty() && !m_stopping) m_cond.wait(&m_mutex);
+            if (m_stopping) break;
+            task = m_queue.dequeue();
+        }
+        if (isStale(task)) {
+            task.drop();
+            continue;
+        }
+        task.exec();
+        if (isStale(task)) task.drop();
+        else task.deliver();
+    }
+
+    db.close();
+}
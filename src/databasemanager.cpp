@@ -1,9 +1,403 @@
 #include "include/databasemanager.h"
+#include "unilog/unilog.h"
+#include "queryprofiler.h"
+#include <QtConcurrent>
+#include <QRegularExpression>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+/**
+ * Шаг миграции схемы. Шаги применяются по возрастанию version,
+ * каждый в своей транзакции, и должны быть идемпотентными.
+ */
+struct Migration {
+    int version;
+    const char *description;
+    QStringList statements;
+};
+
+// Пересчет participant_score с нуля по сырым результатам
+static const char *REBUILD_SCORES_SQL = R"sql(
+    INSERT INTO participant_score (participant_id, event_id, points, total_points, answers)
+    SELECT participant.participant_id, participant.event_id,
+           IFNULL(SUM(CASE WHEN result.result THEN question.points ELSE 0 END), 0),
+           IFNULL(SUM(question.points), 0),
+           COUNT(result.result_id)
+    FROM participant
+    LEFT JOIN result ON result.participant_id = participant.participant_id
+    LEFT JOIN question ON question.question_id = result.question_id
+    GROUP BY participant.participant_id;
+)sql";
+
+// Схема годового архива: те же таблицы мероприятий без связей со справочниками основной базы
+static const QStringList ARCHIVE_SCHEMA = {
+    R"sql(
+    CREATE TABLE IF NOT EXISTS %1.event (
+        event_id INTEGER PRIMARY KEY,
+        quiz_id INTEGER,
+        title TEXT,
+        time TEXT,
+        type INTEGER
+    );)sql",
+    R"sql(
+    CREATE TABLE IF NOT EXISTS %1.participant (
+        participant_id INTEGER PRIMARY KEY,
+        event_id INTEGER,
+        user_id INTEGER,
+        team_id INTEGER,
+        number INTEGER
+    );)sql",
+    R"sql(
+    CREATE TABLE IF NOT EXISTS %1.result (
+        result_id INTEGER PRIMARY KEY,
+        question_id INTEGER,
+        participant_id INTEGER,
+        event_id INTEGER,
+        result INTEGER
+    );)sql",
+    R"sql(
+    CREATE TABLE IF NOT EXISTS %1.participant_score (
+        participant_id INTEGER PRIMARY KEY,
+        event_id INTEGER,
+        points INTEGER NOT NULL DEFAULT 0,
+        total_points INTEGER NOT NULL DEFAULT 0,
+        answers INTEGER NOT NULL DEFAULT 0
+    );)sql",
+    "CREATE INDEX IF NOT EXISTS %1.idx_event_time ON event(time);",
+    "CREATE INDEX IF NOT EXISTS %1.idx_participant_event_cover ON participant(event_id, team_id, user_id);",
+    "CREATE INDEX IF NOT EXISTS %1.idx_result_participant_cover ON result(participant_id, question_id, result);",
+    "CREATE INDEX IF NOT EXISTS %1.idx_participant_score_event ON participant_score(event_id, points);",
+};
+
+// Колонки архивируемых таблиц - общие для копирования и представлений all_*
+static const QList<QPair<QString, QString>> ARCHIVE_TABLES = {
+    { "event", "event_id, quiz_id, title, time, type" },
+    { "participant", "participant_id, event_id, user_id, team_id, number" },
+    { "result", "result_id, question_id, participant_id, event_id, result" },
+    { "participant_score", "participant_id, event_id, points, total_points, answers" },
+};
+
+// Поколение данных растет в той же транзакции, что и запись: отдельной фиксации
+// (и лишнего fsync) на одиночную запись нет, учитываются и записи сырым SQL
+static QStringList generationTriggers()
+{
+    static const char *const tables[] = { "user", "team", "team_user", "quiz", "event", "question", "answer",
+                                          "participant", "result", "participant_score",
+                                          "rating", "rating_history", "rating_event" };
+    static const char *const ops[][2] = { { "ins", "INSERT" }, { "upd", "UPDATE" }, { "del", "DELETE" } };
+    QStringList statements;
+    for (const char *table : tables) {
+        for (const auto &op : ops) {
+            statements << QString("CREATE TRIGGER IF NOT EXISTS gen_%1_%2 AFTER %3 ON \"%1\" "
+                                  "BEGIN UPDATE db_generation SET value = value + 1 WHERE id = 1; END;")
+                              .arg(table, op[0], op[1]);
+        }
+    }
+    return statements;
+}
+
+// отметка мероприятия строки row (NEW/OLD) в rating_dirty для триггера
+static QString ratingDirtyMark(const char *row)
+{
+    return QString("INSERT OR REPLACE INTO rating_dirty (event_id, seq) "
+                   "SELECT %1.event_id, next FROM (SELECT IFNULL(MAX(seq), 0) + 1 AS next FROM rating_dirty) "
+                   "WHERE %1.event_id IS NOT NULL;").arg(row);
+}
+
+static const QVector<Migration>& migrations()
+{
+    static const QVector<Migration> list = {
+        { 1, "foreign key indexes", {
+            "CREATE INDEX IF NOT EXISTS idx_team_user_team ON team_user(team_id);",
+            "CREATE INDEX IF NOT EXISTS idx_event_quiz ON event(quiz_id);",
+            "CREATE INDEX IF NOT EXISTS idx_question_quiz ON question(quiz_id);",
+            "CREATE INDEX IF NOT EXISTS idx_answer_question ON answer(question_id);",
+            "CREATE INDEX IF NOT EXISTS idx_participant_event ON participant(event_id);",
+            "CREATE INDEX IF NOT EXISTS idx_participant_user ON participant(user_id);",
+            "CREATE INDEX IF NOT EXISTS idx_participant_team ON participant(team_id);",
+            "CREATE INDEX IF NOT EXISTS idx_result_participant ON result(participant_id);",
+            "CREATE INDEX IF NOT EXISTS idx_result_event ON result(event_id);",
+        } },
+        { 2, "event time index", {
+            "CREATE INDEX IF NOT EXISTS idx_event_time ON event(time);",
+        } },
+        { 3, "unique result per question and participant", {
+            // без уникального индекса INSERT OR REPLACE плодил дубликаты - оставляем последний
+            "DELETE FROM result WHERE result_id NOT IN "
+            "(SELECT MAX(result_id) FROM result GROUP BY question_id, participant_id);",
+            "CREATE UNIQUE INDEX IF NOT EXISTS idx_result_question_participant ON result(question_id, participant_id);",
+        } },
+        { 4, "covering indexes for score reports", {
+            // время мероприятия храним секундами от эпохи, updateEvent раньше писал строку ISO
+            "UPDATE event SET time = strftime('%s', time, 'utc') WHERE time GLOB '*-*';",
+            "CREATE INDEX IF NOT EXISTS idx_participant_event_cover ON participant(event_id, team_id, user_id);",
+            "DROP INDEX IF EXISTS idx_participant_event;",
+            "CREATE INDEX IF NOT EXISTS idx_result_participant_cover ON result(participant_id, question_id, result);",
+            "DROP INDEX IF EXISTS idx_result_participant;",
+            "CREATE INDEX IF NOT EXISTS idx_team_user_team_cover ON team_user(team_id, user_id);",
+            "DROP INDEX IF EXISTS idx_team_user_team;",
+        } },
+        { 5, "participant score table", {
+            R"sql(
+            CREATE TABLE IF NOT EXISTS participant_score (
+                participant_id INTEGER PRIMARY KEY,
+                event_id INTEGER,
+                points INTEGER NOT NULL DEFAULT 0,       -- набрано
+                total_points INTEGER NOT NULL DEFAULT 0, -- возможно по отвеченным вопросам
+                answers INTEGER NOT NULL DEFAULT 0,
+                FOREIGN KEY (participant_id) REFERENCES participant(participant_id) ON DELETE CASCADE
+            );)sql",
+            "CREATE INDEX IF NOT EXISTS idx_participant_score_event ON participant_score(event_id, points);",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_result_insert AFTER INSERT ON result
+            BEGIN
+                INSERT OR IGNORE INTO participant_score (participant_id, event_id)
+                    SELECT participant_id, event_id FROM participant WHERE participant_id = NEW.participant_id;
+                UPDATE participant_score SET
+                    points = points + IFNULL((SELECT CASE WHEN NEW.result THEN question.points ELSE 0 END FROM question WHERE question.question_id = NEW.question_id), 0),
+                    total_points = total_points + IFNULL((SELECT question.points FROM question WHERE question.question_id = NEW.question_id), 0),
+                    answers = answers + 1
+                WHERE participant_id = NEW.participant_id;
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_result_delete AFTER DELETE ON result
+            BEGIN
+                UPDATE participant_score SET
+                    points = points - IFNULL((SELECT CASE WHEN OLD.result THEN question.points ELSE 0 END FROM question WHERE question.question_id = OLD.question_id), 0),
+                    total_points = total_points - IFNULL((SELECT question.points FROM question WHERE question.question_id = OLD.question_id), 0),
+                    answers = answers - 1
+                WHERE participant_id = OLD.participant_id;
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_result_update AFTER UPDATE OF question_id, participant_id, result ON result
+            BEGIN
+                UPDATE participant_score SET
+                    points = points - IFNULL((SELECT CASE WHEN OLD.result THEN question.points ELSE 0 END FROM question WHERE question.question_id = OLD.question_id), 0),
+                    total_points = total_points - IFNULL((SELECT question.points FROM question WHERE question.question_id = OLD.question_id), 0),
+                    answers = answers - 1
+                WHERE participant_id = OLD.participant_id;
+                INSERT OR IGNORE INTO participant_score (participant_id, event_id)
+                    SELECT participant_id, event_id FROM participant WHERE participant_id = NEW.participant_id;
+                UPDATE participant_score SET
+                    points = points + IFNULL((SELECT CASE WHEN NEW.result THEN question.points ELSE 0 END FROM question WHERE question.question_id = NEW.question_id), 0),
+                    total_points = total_points + IFNULL((SELECT question.points FROM question WHERE question.question_id = NEW.question_id), 0),
+                    answers = answers + 1
+                WHERE participant_id = NEW.participant_id;
+            END;)sql",
+            // каскадное удаление результатов идет уже без вопроса - баллы вопроса вычитаем заранее
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_question_delete BEFORE DELETE ON question
+            BEGIN
+                UPDATE participant_score SET
+                    points = points - IFNULL(OLD.points, 0) * (SELECT COUNT(*) FROM result WHERE result.question_id = OLD.question_id AND result.participant_id = participant_score.participant_id AND result.result),
+                    total_points = total_points - IFNULL(OLD.points, 0) * (SELECT COUNT(*) FROM result WHERE result.question_id = OLD.question_id AND result.participant_id = participant_score.participant_id)
+                WHERE participant_id IN (SELECT participant_id FROM result WHERE question_id = OLD.question_id);
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_question_points AFTER UPDATE OF points ON question
+            BEGIN
+                UPDATE participant_score SET
+                    points = points + (IFNULL(NEW.points, 0) - IFNULL(OLD.points, 0)) * (SELECT COUNT(*) FROM result WHERE result.question_id = NEW.question_id AND result.participant_id = participant_score.participant_id AND result.result),
+                    total_points = total_points + (IFNULL(NEW.points, 0) - IFNULL(OLD.points, 0)) * (SELECT COUNT(*) FROM result WHERE result.question_id = NEW.question_id AND result.participant_id = participant_score.participant_id)
+                WHERE participant_id IN (SELECT participant_id FROM result WHERE question_id = NEW.question_id);
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_participant_event AFTER UPDATE OF event_id ON participant
+            BEGIN
+                UPDATE participant_score SET event_id = NEW.event_id WHERE participant_id = NEW.participant_id;
+            END;)sql",
+            "DELETE FROM participant_score;",
+            REBUILD_SCORES_SQL,
+        } },
+        { 6, "full-text search over questions and answers", {
+            // строка индекса на вопрос: rowid = question_id, ответы склеены в одну колонку
+            "CREATE VIRTUAL TABLE IF NOT EXISTS question_fts USING fts5("
+            "text, answers, tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3');",
+            // текст вопроса весит больше текста ответов
+            "INSERT INTO question_fts (question_fts, rank) VALUES ('rank', 'bm25(2.0, 1.0)');",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_question_fts_insert AFTER INSERT ON question
+            BEGIN
+                INSERT INTO question_fts (rowid, text, answers) VALUES (NEW.question_id, NEW.text, '');
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_question_fts_update AFTER UPDATE OF text ON question
+            BEGIN
+                UPDATE question_fts SET text = NEW.text WHERE rowid = NEW.question_id;
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_question_fts_delete AFTER DELETE ON question
+            BEGIN
+                DELETE FROM question_fts WHERE rowid = OLD.question_id;
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_answer_fts_insert AFTER INSERT ON answer
+            BEGIN
+                UPDATE question_fts SET answers = (SELECT group_concat(text, ' ') FROM answer WHERE question_id = NEW.question_id)
+                WHERE rowid = NEW.question_id;
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_answer_fts_update AFTER UPDATE OF question_id, text ON answer
+            BEGIN
+                UPDATE question_fts SET answers = IFNULL((SELECT group_concat(text, ' ') FROM answer WHERE question_id = OLD.question_id), '')
+                WHERE rowid = OLD.question_id;
+                UPDATE question_fts SET answers = (SELECT group_concat(text, ' ') FROM answer WHERE question_id = NEW.question_id)
+                WHERE rowid = NEW.question_id;
+            END;)sql",
+            R"sql(
+            CREATE TRIGGER IF NOT EXISTS trg_answer_fts_delete AFTER DELETE ON answer
+            BEGIN
+                UPDATE question_fts SET answers = IFNULL((SELECT group_concat(text, ' ') FROM answer WHERE question_id = OLD.question_id), '')
+                WHERE rowid = OLD.question_id;
+            END;)sql",
+            "DELETE FROM question_fts;",
+            R"sql(
+            INSERT INTO question_fts (rowid, text, answers)
+            SELECT question_id, text, IFNULL((SELECT group_concat(answer.text, ' ') FROM answer WHERE answer.question_id = question.question_id), '')
+            FROM question;)sql",
+        } },
+        { 7, "sort indexes for paged lists", {
+            // выражения должны совпадать с сортировкой в listEventsPage/listQuizzesPage
+            "CREATE INDEX IF NOT EXISTS idx_event_title ON event(IFNULL(title, ''));",
+            "CREATE INDEX IF NOT EXISTS idx_quiz_topic ON quiz(IFNULL(topic, ''));",
+        } },
+        { 8, "incremental auto vacuum", {
+            // для существующего файла режим включится после VACUUM - его делает
+            // convertIncrementalVacuum по запросу (VACUUM невозможен внутри транзакции)
+            "PRAGMA auto_vacuum = INCREMENTAL;",
+        } },
+        { 9, "data generation counter", {
+            // растет с каждой зафиксированной записью - ключ для кэша отчетов между запусками
+            "CREATE TABLE IF NOT EXISTS db_generation (id INTEGER PRIMARY KEY CHECK (id = 1), value INTEGER NOT NULL);",
+            "INSERT OR IGNORE INTO db_generation (id, value) VALUES (1, 0);",
+        } },
+        { 10, "ratings", {
+            // kind: 0 - физлицо, 1 - команда (DatabaseManager::RatingKind)
+            "CREATE TABLE IF NOT EXISTS rating (kind INTEGER NOT NULL, entity_id INTEGER NOT NULL, "
+            "rating REAL NOT NULL, games INTEGER NOT NULL DEFAULT 0, PRIMARY KEY (kind, entity_id)) WITHOUT ROWID;",
+            "CREATE INDEX IF NOT EXISTS idx_rating_board ON rating(kind, rating DESC);",
+            // учтенные мероприятия с суммами на момент расчета - по ним видно, что мероприятие изменилось
+            "CREATE TABLE IF NOT EXISTS rating_event (event_id INTEGER PRIMARY KEY, time INTEGER NOT NULL, "
+            "answers INTEGER NOT NULL, points INTEGER NOT NULL);",
+            "CREATE INDEX IF NOT EXISTS idx_rating_event_time ON rating_event(time, event_id);",
+            "CREATE TABLE IF NOT EXISTS rating_history (event_id INTEGER NOT NULL, kind INTEGER NOT NULL, entity_id INTEGER NOT NULL, "
+            "rating_before REAL NOT NULL, rating_after REAL NOT NULL, PRIMARY KEY (event_id, kind, entity_id)) WITHOUT ROWID;",
+            "CREATE INDEX IF NOT EXISTS idx_rating_history_entity ON rating_history(kind, entity_id, event_id);",
+        } },
+        { 11, "data generation triggers", generationTriggers() },
+        { 12, "rating dirty events", {
+            // мероприятия, чей вклад в рейтинг мог измениться; 0 - пересчет с начала истории.
+            // seq растет с каждой отметкой: расчет снимает только отметки, прочитанные им до записи
+            "CREATE TABLE IF NOT EXISTS rating_dirty (event_id INTEGER PRIMARY KEY, seq INTEGER NOT NULL);",
+            "INSERT OR IGNORE INTO rating_dirty (event_id, seq) VALUES (0, 1);",
+            "CREATE TRIGGER IF NOT EXISTS trg_rating_score_insert AFTER INSERT ON participant_score BEGIN "
+            + ratingDirtyMark("NEW") + " END;",
+            "CREATE TRIGGER IF NOT EXISTS trg_rating_score_update AFTER UPDATE OF event_id, points, answers ON participant_score BEGIN "
+            + ratingDirtyMark("OLD") + " " + ratingDirtyMark("NEW") + " END;",
+            "CREATE TRIGGER IF NOT EXISTS trg_rating_score_delete AFTER DELETE ON participant_score BEGIN "
+            + ratingDirtyMark("OLD") + " END;",
+            // смена участника переносит баллы между физлицами и командами при тех же суммах
+            "CREATE TRIGGER IF NOT EXISTS trg_rating_participant_update AFTER UPDATE OF event_id, user_id, team_id ON participant BEGIN "
+            + ratingDirtyMark("OLD") + " " + ratingDirtyMark("NEW") + " END;",
+            "CREATE TRIGGER IF NOT EXISTS trg_rating_event_update AFTER UPDATE OF time ON event BEGIN "
+            + ratingDirtyMark("NEW") + " END;",
+            "CREATE TRIGGER IF NOT EXISTS trg_rating_event_delete AFTER DELETE ON event BEGIN "
+            + ratingDirtyMark("OLD") + " END;",
+        } },
+        { 13, "archived quiz references", {
+            // результаты в архивах ссылаются на квизы и вопросы основной базы: удаление таких
+            // квизов и вопросов оставило бы в представлениях all_* строки без вопросов
+            "CREATE TABLE IF NOT EXISTS archive_quiz (quiz_id INTEGER PRIMARY KEY);",
+            "CREATE TRIGGER IF NOT EXISTS trg_archive_quiz_delete BEFORE DELETE ON quiz "
+            "WHEN EXISTS (SELECT 1 FROM archive_quiz WHERE quiz_id = OLD.quiz_id) "
+            "BEGIN SELECT RAISE(ABORT, 'Quiz is used by archived events'); END;",
+            "CREATE TRIGGER IF NOT EXISTS trg_archive_question_delete BEFORE DELETE ON question "
+            "WHEN EXISTS (SELECT 1 FROM archive_quiz WHERE quiz_id = OLD.quiz_id) "
+            "BEGIN SELECT RAISE(ABORT, 'Question is used by archived events'); END;",
+        } },
+    };
+    return list;
+}
+
+DatabaseManager::Connection::~Connection()
+{
+    for (auto it = statements.begin(); it != statements.end(); ++it) {
+        it.value().query.finish();
+    }
+    statements.clear();
+    QString name = db.connectionName();
+    if (db.isOpen()) {
+        db.close();
+    }
+    db = QSqlDatabase(); // clear
+    if (!name.isEmpty()) QSqlDatabase::removeDatabase(name);
+}
 
 DatabaseManager::DatabaseManager(const QString &dbPath)
     : QObject(nullptr), m_dbPath(dbPath)
 {
-    // nothing
+    // Уровень синхронизации: OFF, NORMAL (по умолчанию для WAL) или FULL
+    QString sync = QString::fromStdString(Settings::getParam("db_synchronous")).toUpper();
+    if (sync == "OFF" || sync == "NORMAL" || sync == "FULL" || sync == "EXTRA") m_synchronous = sync;
+
+    // сигналы изменений ходят между потоками
+    qRegisterMetaType<DatabaseManager::Table>("DatabaseManager::Table");
+
+    m_checkpointTimer = new QTimer(this);
+    connect(m_checkpointTimer, &QTimer::timeout, this, [this]() {
+        // пассивный checkpoint не блокирует писателей, но делает I/O - уводим с GUI потока
+        QtConcurrent::run([this]() { checkpoint(CheckpointPassive); });
+    });
+
+    m_snapshotTimer = new QTimer(this);
+    connect(m_snapshotTimer, &QTimer::timeout, this, [this]() {
+        // копия, не начатая до выхода, уже не нужна
+        QtConcurrent::run([this]() { if (!m_stopping) snapshot(m_snapshotKeep); });
+    });
+
+    m_maintenanceTimer = new QTimer(this);
+    connect(m_maintenanceTimer, &QTimer::timeout, this, [this]() {
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        if (now - m_lastActivity < m_maintenanceIdleMs) return;
+        if (now - m_lastMaintenance < MAINTENANCE_INTERVAL_MS) return;
+        if (m_maintenanceRunning.exchange(true)) return;
+        m_maintenanceYield = false;
+        // время попытки, а не успеха: ошибка (BUSY, нет места) не повторяется каждым тиком
+        m_lastMaintenance = now;
+        QtConcurrent::run([this]() {
+            runMaintenance();
+            m_maintenanceRunning = false;
+        });
+    });
+
+    m_ratingParams = RatingParams::fromSettings();
+    m_ratingTimer = new QTimer(this);
+    m_ratingTimer->setSingleShot(true);
+    connect(m_ratingTimer, &QTimer::timeout, this, [this]() {
+        // изменения во время расчета - еще один проход после него
+        if (m_ratingRunning.exchange(true)) {
+            m_ratingPending = true;
+            return;
+        }
+        QtConcurrent::run([this]() {
+            int rated = 0;
+            if (!updateRatings(rated)) G_WARN() << "Rating update failed:" << lastError();
+            m_ratingRunning = false;
+            if (m_ratingPending.exchange(false) && m_ratingDelayMs > 0 && !m_stopping) {
+                QMetaObject::invokeMethod(m_ratingTimer, "start", Qt::QueuedConnection);
+            }
+        });
+    });
+    // таймер не перезапускается каждым ответом: расчет идет через delay после первого изменения
+    auto onChange = [this](Table table, qint64) {
+        if (m_ratingDelayMs <= 0 || m_ratingTimer->isActive()) return;
+        if (table == TableResult || table == TableParticipant || table == TableEvent || table == TableQuestion
+            || table == TableParticipantScore) m_ratingTimer->start();
+    };
+    connect(this, &DatabaseManager::rowInserted, this, onChange);
+    connect(this, &DatabaseManager::rowUpdated, this, onChange);
+    connect(this, &DatabaseManager::rowDeleted, this, onChange);
 }
 
 DatabaseManager::~DatabaseManager()
@@ -11,25 +405,73 @@ DatabaseManager::~DatabaseManager()
     // nothing
 }
 
+DatabaseManager::Connection &DatabaseManager::conn() const
+{
+    if (!m_connections.hasLocalData()) m_connections.setLocalData(new Connection);
+    return *m_connections.localData();
+}
+
+bool DatabaseManager::isMainThread() const
+{
+    return QThread::currentThread() == thread();
+}
+
 bool DatabaseManager::open()
 {
-    if (QSqlDatabase::contains("qt_sql_default_connection")) {
-        m_db = QSqlDatabase::database();
-    } else {
-        m_db = QSqlDatabase::addDatabase("QSQLITE");
-        m_db.setDatabaseName(m_dbPath);
+    Connection &c = conn();
+    if (!c.db.isValid()) {
+        // GUI поток работает через соединение по умолчанию, остальные потоки - через свои
+        QString name = isMainThread()
+                ? QString(QSqlDatabase::defaultConnection)
+                : QString("viktorium_%1").arg(quintptr(QThread::currentThreadId()));
+        if (QSqlDatabase::contains(name)) {
+            c.db = QSqlDatabase::database(name, false);
+        } else {
+            c.db = QSqlDatabase::addDatabase("QSQLITE", name);
+            c.db.setDatabaseName(m_dbPath);
+        }
+        if (!isMainThread()) G_DEBUG() << "Database connection" << name << "created";
     }
 
-    if (!m_db.open()) {
-        m_lastError = m_db.lastError().text();
+    if (!c.db.isOpen() && !c.db.open()) {
+        c.lastError = c.db.lastError().text();
         return false;
     }
 
-    // ensure foreign keys
-    QSqlQuery q(m_db);
-    if (!q.exec("PRAGMA foreign_keys = ON;")) {
-        m_lastError = q.lastError().text();
-        return false;
+    // ensure foreign keys, WAL: читатели не блокируют писателя и наоборот
+    QSqlQuery q(c.db);
+    const QStringList pragmas = {
+        "PRAGMA foreign_keys = ON;",
+        // INSERT OR REPLACE в result должен вызывать триггеры удаления - иначе participant_score разойдется
+        "PRAGMA recursive_triggers = ON;",
+        "PRAGMA busy_timeout = 5000;",
+        "PRAGMA journal_mode = WAL;",
+        QString("PRAGMA synchronous = %1;").arg(m_synchronous),
+    };
+    for (const QString &pragma : pragmas) {
+        if (!exec(q, pragma)) {
+            c.lastError = q.lastError().text();
+            return false;
+        }
+    }
+
+    // архивы и представления all_* нужны каждому соединению
+    c.archiveGeneration = -1;
+    if (!attachArchives()) return false;
+
+    if (isMainThread() && QCoreApplication::instance() && !m_checkpointTimer->isActive()) {
+        int interval = QString::fromStdString(Settings::getParam("db_checkpoint_interval")).toInt();
+        startBackgroundCheckpoint((interval > 0 ? interval : 60) * 1000);
+        // снимки по расписанию, интервал в минутах, по умолчанию выключены
+        int snapshotInterval = QString::fromStdString(Settings::getParam("db_snapshot_interval")).toInt();
+        int keep = QString::fromStdString(Settings::getParam("db_snapshot_keep")).toInt();
+        startSnapshotSchedule(snapshotInterval * 60 * 1000, keep > 0 ? keep : 7);
+        // обслуживание после db_maintenance_idle секунд простоя, по умолчанию 120
+        std::string idle = Settings::getParam("db_maintenance_idle");
+        startMaintenance((idle.empty() ? 120 : QString::fromStdString(idle).toInt()) * 1000);
+        // рейтинги через rating_update_delay секунд после изменения результатов, по умолчанию 10
+        std::string ratingDelay = Settings::getParam("rating_update_delay");
+        startRatingUpdates((ratingDelay.empty() ? 10 : QString::fromStdString(ratingDelay).toInt()) * 1000);
     }
 
     return true;
@@ -37,23 +479,595 @@ bool DatabaseManager::open()
 
 void DatabaseManager::close()
 {
-    if (m_db.isOpen()) {
-        m_db.close();
+    if (isMainThread()) {
+        m_checkpointTimer->stop();
+        m_snapshotTimer->stop();
+        startMaintenance(0);
+        startRatingUpdates(0);
+        // при выходе переносим WAL в основной файл и обрезаем его
+        if (db().isOpen()) checkpoint(CheckpointTruncate);
+    }
+    m_connections.setLocalData(nullptr);
+}
+
+// ---------- WAL checkpoint ----------
+bool DatabaseManager::checkpoint(CheckpointMode mode)
+{
+    if (!db().isOpen() && !open()) return false;
+    static const char* modes[] = { "PASSIVE", "FULL", "TRUNCATE" };
+    QSqlQuery q(db());
+    if (!exec(q, QString("PRAGMA wal_checkpoint(%1);").arg(modes[mode]))) {
+        conn().lastError = q.lastError().text();
+        return false;
+    }
+    // busy, кадров в WAL, перенесено в БД
+    if (q.next() && q.value(0).toInt() != 0) {
+        G_DEBUG() << "WAL checkpoint" << modes[mode] << "is busy:" << q.value(1).toInt() << "frames," << q.value(2).toInt() << "done";
+    }
+    return true;
+}
+
+void DatabaseManager::startBackgroundCheckpoint(int intervalMs)
+{
+    if (intervalMs <= 0) {
+        m_checkpointTimer->stop();
+        return;
+    }
+    m_checkpointTimer->start(intervalMs);
+}
+
+// ---------- Backup ----------
+/**
+ * Копия файла базы source в path через VACUUM INTO на отдельном соединении QSQLITE -
+ * той же библиотекой SQLite, что и у драйвера. Читающая транзакция в WAL писателей
+ * не держит; копия получается в режиме журнала DELETE и открывается только для чтения.
+ */
+static QString vacuumInto(const QString &source, const QString &path)
+{
+    const QString name = QString("viktorium_backup_%1").arg(quintptr(QThread::currentThreadId()));
+    QString error;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(source);
+        db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+        if (!db.open()) {
+            error = db.lastError().text();
+        } else {
+            QSqlQuery q(db);
+            q.prepare("VACUUM INTO ?;");
+            q.addBindValue(path);
+            if (!q.exec()) error = q.lastError().text();
+            q.finish();
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    return error;
+}
+
+QString DatabaseManager::backupArchiveDir(const QString &path)
+{
+    QFileInfo info(path);
+    return info.absoluteDir().filePath(info.completeBaseName() + "-archive");
+}
+
+bool DatabaseManager::backupTo(const QString &path, std::function<void(int)> progress)
+{
+    if (!db().isOpen() && !open()) return false;
+    if (m_backupRunning.exchange(true)) {
+        conn().lastError = "Backup is already running";
+        return false;
+    }
+    struct Guard { std::atomic<bool> &flag; ~Guard() { flag = false; } } guard{m_backupRunning};
+
+    // перенос в архив меняет и основную базу, и архив - на время копии он ждет
+    QMutexLocker archiveLock(&m_archiveMutex);
+    const QStringList archives = QDir(archiveDir()).entryList({"quiz-????.db"}, QDir::Files, QDir::Name);
+
+    // ход копирования по размеру файлов, до 95% - копия, дальше - проверка
+    QVector<qint64> sizes;
+    sizes << QFileInfo(m_dbPath).size();
+    for (const QString &file : archives) sizes << QFileInfo(QDir(archiveDir()).filePath(file)).size();
+    qint64 totalBytes = 0;
+    for (qint64 size : sizes) totalBytes += size;
+    totalBytes = qMax<qint64>(totalBytes, 1);
+    qint64 doneBytes = 0;
+    int lastPercent = -1;
+    auto report = [&](qint64 fileDone) {
+        if (!progress) return;
+        int percent = int(qBound<qint64>(0, (doneBytes + fileDone) * 95 / totalBytes, 95));
+        if (percent == lastPercent) return;
+        lastPercent = percent;
+        progress(percent);
+    };
+
+    const QString part = path + ".part";
+    const QString archivePart = backupArchiveDir(path) + ".part";
+    auto cleanup = [&]() {
+        QFile::remove(part);
+        QDir(archivePart).removeRecursively();
+    };
+    cleanup();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    if (progress) progress(0);
+
+    // основная база и архивы по очереди; ход - по размеру растущего файла копии
+    QStringList sources, targets;
+    sources << m_dbPath;
+    targets << part;
+    if (!archives.isEmpty()) QDir().mkpath(archivePart);
+    for (const QString &file : archives) {
+        sources << QDir(archiveDir()).filePath(file);
+        targets << QDir(archivePart).filePath(file);
+    }
+    QString error;
+    for (int i = 0; error.isEmpty() && i < sources.size(); ++i) {
+        const QString source = sources[i], target = targets[i];
+        QFuture<QString> copy = QtConcurrent::run([source, target]() { return vacuumInto(source, target); });
+        while (!copy.isFinished()) {
+            QThread::msleep(BACKUP_POLL_MS);
+            report(qMin(QFileInfo(target).size(), sizes[i]));
+        }
+        error = copy.result();
+        doneBytes += sizes[i];
+    }
+    if (!error.isEmpty()) {
+        conn().lastError = error;
+        cleanup();
+        G_ERROR() << "Backup to" << path << "failed:" << error;
+        return false;
+    }
+    if (progress) progress(95);
+
+    if (!verifyBackup(part)) {
+        cleanup();
+        return false;
+    }
+    for (const QString &file : archives) {
+        if (!verifyFile(QDir(archivePart).filePath(file), -1)) {
+            cleanup();
+            return false;
+        }
+    }
+    QFile::remove(path);
+    if (!QFile::rename(part, path)) {
+        conn().lastError = QString("Cannot rename %1 to %2").arg(part, path);
+        cleanup();
+        return false;
+    }
+    QDir(backupArchiveDir(path)).removeRecursively();
+    if (!archives.isEmpty() && !QDir().rename(archivePart, backupArchiveDir(path))) {
+        conn().lastError = QString("Cannot rename %1 to %2").arg(archivePart, backupArchiveDir(path));
+        cleanup();
+        return false;
+    }
+    if (progress) progress(100);
+    G_INFO() << "Backup written to" << path << "with" << archives.size() << "archives";
+    return true;
+}
+
+bool DatabaseManager::verifyBackup(const QString &path)
+{
+    return verifyFile(path, schemaVersion());
+}
+
+bool DatabaseManager::verifyFile(const QString &path, int expected)
+{
+    const QString name = QString("viktorium_verify_%1").arg(quintptr(QThread::currentThreadId()));
+    QString error;
+    {
+        QSqlDatabase check = QSqlDatabase::addDatabase("QSQLITE", name);
+        check.setDatabaseName(path);
+        check.setConnectOptions("QSQLITE_OPEN_READONLY");
+        if (!check.open()) {
+            error = check.lastError().text();
+        } else {
+            QSqlQuery q(check);
+            if (!q.exec("PRAGMA integrity_check;") || !q.next()) {
+                error = q.lastError().text();
+            } else if (q.value(0).toString() != "ok") {
+                error = "integrity_check: " + q.value(0).toString();
+            } else if (expected >= 0 && (!q.exec("PRAGMA user_version;") || !q.next() || q.value(0).toInt() != expected)) {
+                error = QString("Backup schema version %1, expected %2").arg(q.value(0).toInt()).arg(expected);
+            }
+            q.finish();
+            check.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    if (!error.isEmpty()) {
+        conn().lastError = error;
+        G_ERROR() << "Backup" << path << "verification failed:" << error;
+        return false;
+    }
+    return true;
+}
+
+QString DatabaseManager::snapshotDir() const
+{
+    return QFileInfo(m_dbPath).absolutePath() + "/backup";
+}
+
+QString DatabaseManager::snapshot(int keep)
+{
+    QDir dir(snapshotDir());
+    QString path = dir.filePath(QString("quiz-%1.db").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss")));
+    if (!backupTo(path)) return QString();
+
+    // имена сортируются по времени, удаляем самые старые
+    QStringList files = dir.entryList({"quiz-*.db"}, QDir::Files, QDir::Name);
+    for (int i = 0; i < files.size() - qMax(keep, 1); ++i) {
+        dir.remove(files[i]);
+        QDir(backupArchiveDir(dir.filePath(files[i]))).removeRecursively();
+    }
+    return path;
+}
+
+void DatabaseManager::startSnapshotSchedule(int intervalMs, int keep)
+{
+    m_snapshotKeep = keep;
+    if (intervalMs <= 0) {
+        m_snapshotTimer->stop();
+        return;
+    }
+    m_snapshotTimer->start(intervalMs);
+}
+
+// ---------- Maintenance ----------
+DatabaseManager::StorageStats DatabaseManager::storageStats()
+{
+    StorageStats st;
+    if (!db().isOpen() && !open()) return st;
+    QSqlQuery q(db());
+    auto pragma = [&](const char *name) {
+        return exec(q, QString("PRAGMA %1;").arg(name)) && q.next() ? q.value(0).toLongLong() : 0;
+    };
+    st.pageCount = pragma("page_count");
+    st.freePages = pragma("freelist_count");
+    st.pageSize = pragma("page_size");
+    st.autoVacuum = int(pragma("auto_vacuum"));
+    return st;
+}
+
+void DatabaseManager::startMaintenance(int idleMs)
+{
+    m_maintenanceIdleMs = idleMs;
+    if (idleMs <= 0) {
+        m_maintenanceYield = true;
+        m_maintenanceTimer->stop();
+        if (QCoreApplication::instance()) QCoreApplication::instance()->removeEventFilter(this);
+        return;
+    }
+    m_lastActivity = QDateTime::currentMSecsSinceEpoch();
+    if (QCoreApplication::instance()) QCoreApplication::instance()->installEventFilter(this);
+    m_maintenanceTimer->start(qMin(idleMs, 15000));
+}
+
+void DatabaseManager::userActivity()
+{
+    m_lastActivity = QDateTime::currentMSecsSinceEpoch();
+    if (m_maintenanceRunning) m_maintenanceYield = true;
+}
+
+bool DatabaseManager::eventFilter(QObject *watched, QEvent *event)
+{
+    switch (event->type()) {
+    case QEvent::MouseButtonPress:
+    case QEvent::KeyPress:
+    case QEvent::Wheel:
+    case QEvent::TouchBegin:
+        userActivity();
+        break;
+    default:
+        break;
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+bool DatabaseManager::runMaintenance()
+{
+    if (!db().isOpen() && !open()) return false;
+    QElapsedTimer timer;
+    timer.start();
+    auto yield = [this]() {
+        if (!m_maintenanceYield) return false;
+        G_DEBUG() << "Maintenance interrupted by user activity";
+        return true;
+    };
+    const StorageStats before = storageStats();
+    G_INFO() << "Maintenance started:" << before.pageCount << "pages," << before.freePages << "free ("
+             << (before.pageCount > 0 ? 100 * before.freePages / before.pageCount : 0) << "% fragmentation), auto_vacuum" << before.autoVacuum;
+    QSqlQuery q(db());
+
+    // полный VACUUM здесь не делаем: он переписывает весь файл и держит писателей до конца
+    if (before.autoVacuum != 2) {
+        G_INFO() << "Maintenance: incremental auto_vacuum is off, free pages are kept until convertIncrementalVacuum";
+    }
+
+    // статистика планировщика; analysis_limit ограничивает ANALYZE выборкой строк
+    if (yield()) return false;
+    exec(q, "PRAGMA analysis_limit = 400;");
+    bool hasStats = exec(q, "SELECT 1 FROM sqlite_master WHERE name = 'sqlite_stat1';") && q.next();
+    q.finish();
+    if (!exec(q, hasStats ? "PRAGMA optimize;" : "ANALYZE;")) {
+        G_WARN() << "Maintenance: optimize failed:" << q.lastError().text();
+    }
+
+    // освобождаем страницы порциями: каждая - короткая транзакция записи
+    while (!yield()) {
+        if (!exec(q, "PRAGMA incremental_vacuum(256);")) {
+            G_WARN() << "Maintenance: incremental_vacuum failed:" << q.lastError().text();
+            break;
+        }
+        while (q.next()) {}
+        q.finish();
+        if (storageStats().freePages == 0) break;
+    }
+    if (m_maintenanceYield) return false;
+
+    // проверка целостности не чаще раза в сутки, по таблице за раз
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - m_lastIntegrityCheck >= 24 * 3600 * 1000LL) {
+        QStringList tables;
+        if (exec(q, "SELECT name FROM main.sqlite_master WHERE type = 'table' AND name NOT LIKE 'sqlite_%' AND sql NOT LIKE 'CREATE VIRTUAL%';")) {
+            while (q.next()) tables << q.value(0).toString();
+        }
+        q.finish();
+        for (const QString &table : tables) {
+            if (yield()) return false;
+            if (!exec(q, QString("PRAGMA integrity_check(\"%1\");").arg(table))) continue;
+            while (q.next()) {
+                QString result = q.value(0).toString();
+                if (result != "ok") G_ERROR() << "Maintenance: integrity_check" << table << ":" << result;
+            }
+            q.finish();
+        }
+        m_lastIntegrityCheck = now;
+    }
+
+    const StorageStats after = storageStats();
+    G_INFO() << "Maintenance finished in" << timer.elapsed() << "ms:" << after.pageCount << "pages,"
+             << after.freePages << "free, released" << (before.pageCount - after.pageCount) * before.pageSize / 1024 << "KB";
+    return true;
+}
+
+bool DatabaseManager::convertIncrementalVacuum()
+{
+    if (!db().isOpen() && !open()) return false;
+    const StorageStats before = storageStats();
+    if (before.autoVacuum == 2) return true;
+    QElapsedTimer timer;
+    timer.start();
+    QSqlQuery q(db());
+    // VACUUM не выполнится, пока на соединении есть незавершенные запросы
+    clearStatementCache();
+    if (!exec(q, "PRAGMA auto_vacuum = INCREMENTAL;") || !exec(q, "VACUUM;")) {
+        conn().lastError = q.lastError().text();
+        G_ERROR() << "VACUUM failed:" << conn().lastError;
+        return false;
+    }
+    G_INFO() << "Database converted to incremental auto_vacuum in" << timer.elapsed() << "ms," << before.pageCount << "pages before";
+    return true;
+}
+
+void DatabaseManager::stopBackground()
+{
+    m_stopping = true;
+    m_maintenanceYield = true;
+    m_checkpointTimer->stop();
+    m_snapshotTimer->stop();
+    m_maintenanceTimer->stop();
+    m_ratingTimer->stop();
+    // задачи таймеров, выгрузка, импорт и пересчет рейтинга идут в глобальном пуле
+    // на своих соединениях - ждем их до закрытия базы и журнала
+    QElapsedTimer timer;
+    timer.start();
+    QThreadPool::globalInstance()->waitForDone();
+    G_INFO() << "Background database tasks finished in" << timer.elapsed() << "ms";
+}
+
+// ---------- Archive ----------
+QString DatabaseManager::archiveDir() const
+{
+    return QFileInfo(m_dbPath).absolutePath() + "/archive";
+}
+
+bool DatabaseManager::attachArchive(const QString &year, bool create)
+{
+    Connection &c = conn();
+    const QString schema = "arch_" + year;
+    if (c.archives.contains(schema)) return true;
+    QDir().mkpath(archiveDir());
+    QSqlQuery q(c.db);
+    q.prepare(QString("ATTACH DATABASE ? AS %1;").arg(schema));
+    q.addBindValue(QDir(archiveDir()).filePath(QString("quiz-%1.db").arg(year)));
+    if (!q.exec()) {
+        c.lastError = q.lastError().text();
+        G_ERROR() << "Attach archive" << year << "failed:" << c.lastError;
+        return false;
+    }
+    // схема уже есть в архиве, созданном переносом - обычному соединению она не нужна
+    for (int i = 0; create && i < ARCHIVE_SCHEMA.size(); ++i) {
+        if (!exec(q, ARCHIVE_SCHEMA[i].arg(schema))) {
+            c.lastError = q.lastError().text();
+            return false;
+        }
+    }
+    c.archives.append(schema);
+    return true;
+}
+
+bool DatabaseManager::attachArchives()
+{
+    Connection &c = conn();
+    const int generation = m_archiveGeneration;
+    QSqlQuery q(c.db);
+    // новая база: представления создаст createTables
+    if (!exec(q, "SELECT 1 FROM main.sqlite_master WHERE type = 'table' AND name = 'participant_score';") || !q.next()) {
+        return true;
+    }
+
+    // свежие годы важнее: при превышении лимита подключаем последние
+    QStringList files = QDir(archiveDir()).entryList({"quiz-????.db"}, QDir::Files, QDir::Name | QDir::Reversed);
+    c.archivesFrom = std::numeric_limits<qint64>::min();
+    if (files.size() > ARCHIVE_ATTACH_LIMIT) {
+        G_WARN() << "Too many archives," << files.size() - ARCHIVE_ATTACH_LIMIT << "oldest are not attached";
+        files = files.mid(0, ARCHIVE_ATTACH_LIMIT);
+        // годы архивов - по локальному времени мероприятий
+        c.archivesFrom = QDateTime(QDate(files.last().mid(5, 4).toInt(), 1, 1), QTime(0, 0)).toSecsSinceEpoch();
+    }
+    for (const QString &file : files) {
+        if (!attachArchive(file.mid(5, 4))) return false;
+    }
+
+    // без архивов представления - простая выборка из main и разворачиваются планировщиком
+    for (const auto &table : ARCHIVE_TABLES) {
+        QStringList parts;
+        parts << QString("SELECT %1 FROM main.%2").arg(table.second, table.first);
+        for (const QString &schema : c.archives) {
+            parts << QString("SELECT %1 FROM %2.%3").arg(table.second, schema, table.first);
+        }
+        if (!exec(q, QString("DROP VIEW IF EXISTS temp.all_%1;").arg(table.first))
+            || !exec(q, QString("CREATE TEMP VIEW all_%1 AS %2;").arg(table.first, parts.join(" UNION ALL ")))) {
+            c.lastError = q.lastError().text();
+            return false;
+        }
+    }
+    c.archiveGeneration = generation;
+    return true;
+}
+
+bool DatabaseManager::ensureArchives()
+{
+    if (!db().isOpen() && !open()) return false;
+    Connection &c = conn();
+    // ATTACH внутри транзакции невозможен - читаем с тем набором, что есть
+    if (c.archiveGeneration == m_archiveGeneration || c.transactionLevel > 0) return true;
+    return attachArchives();
+}
+
+bool DatabaseManager::ensureArchivesFrom(qint64 fromTime)
+{
+    if (!ensureArchives()) return false;
+    if (fromTime >= conn().archivesFrom) return true;
+    // молча неполные итоги хуже отказа
+    conn().lastError = QString("Data before %1 is in archives that are not attached (limit %2 archives)")
+                           .arg(QDateTime::fromSecsSinceEpoch(conn().archivesFrom).toString("dd.MM.yyyy"))
+                           .arg(ARCHIVE_ATTACH_LIMIT);
+    G_WARN() << conn().lastError;
+    return false;
+}
+
+bool DatabaseManager::archiveEvents(const QDateTime &cutoff, int &moved)
+{
+    moved = 0;
+    QMutexLocker archiveLock(&m_archiveMutex);
+    if (!db().isOpen() && !open()) return false;
+    if (conn().transactionLevel > 0) {
+        conn().lastError = "archiveEvents cannot run inside a transaction";
+        return false;
+    }
+    QElapsedTimer timer;
+    timer.start();
+
+    // год по локальному времени мероприятия, time хранится секундами
+    static const QString yearExpr = "strftime('%Y', CAST(time AS INTEGER), 'unixepoch', 'localtime')";
+    QSqlQuery q(db());
+    QMap<QString, QVector<qint64>> byYear;
+    if (!execPrepared(q, QString("SELECT event_id, %1 FROM main.event WHERE time < ?;").arg(yearExpr), {cutoff.toSecsSinceEpoch()})) return false;
+    while (q.next()) byYear[q.value(1).toString()].append(q.value(0).toLongLong());
+    q.finish();
+    if (byYear.isEmpty()) return true;
+
+    for (const QString &year : byYear.keys()) {
+        if (!attachArchive(year, true)) return false;
     }
-    QString connection = m_db.connectionName();
-    m_db = QSqlDatabase(); // clear
-    QSqlDatabase::removeDatabase(connection);
+
+    {
+        Transaction tr(*this);
+        if (!tr.isActive()) return false;
+        QSqlQuery w(db());
+        if (!exec(w, "CREATE TEMP TABLE IF NOT EXISTS archive_ids (event_id INTEGER PRIMARY KEY);")
+            || !exec(w, "CREATE TEMP TABLE IF NOT EXISTS archive_dirty (event_id INTEGER PRIMARY KEY);")) {
+            conn().lastError = w.lastError().text();
+            return false;
+        }
+        for (auto it = byYear.constBegin(); it != byYear.constEnd(); ++it) {
+            const QString schema = "arch_" + it.key();
+            exec(w, "DELETE FROM temp.archive_ids;");
+            exec(w, "DELETE FROM temp.archive_dirty;");
+            w.prepare("INSERT INTO temp.archive_ids (event_id) VALUES (?);");
+            for (qint64 id : it.value()) {
+                w.addBindValue(id);
+                if (!w.exec()) {
+                    conn().lastError = w.lastError().text();
+                    return false;
+                }
+            }
+            // участники выбираются по мероприятию, результаты и счет - по участнику
+            const QStringList copy = {
+                "INSERT OR REPLACE INTO %1.event (event_id, quiz_id, title, time, type) "
+                "SELECT event_id, quiz_id, title, time, type FROM main.event WHERE event_id IN (SELECT event_id FROM temp.archive_ids);",
+                "INSERT OR REPLACE INTO %1.participant (participant_id, event_id, user_id, team_id, number) "
+                "SELECT participant_id, event_id, user_id, team_id, number FROM main.participant WHERE event_id IN (SELECT event_id FROM temp.archive_ids);",
+                "INSERT OR REPLACE INTO %1.result (result_id, question_id, participant_id, event_id, result) "
+                "SELECT result.result_id, result.question_id, result.participant_id, participant.event_id, result.result "
+                "FROM main.result JOIN main.participant ON participant.participant_id = result.participant_id "
+                "WHERE participant.event_id IN (SELECT event_id FROM temp.archive_ids);",
+                "INSERT OR REPLACE INTO %1.participant_score (participant_id, event_id, points, total_points, answers) "
+                "SELECT participant_id, event_id, points, total_points, answers FROM main.participant_score "
+                "WHERE participant_id IN (SELECT participant_id FROM main.participant WHERE event_id IN (SELECT event_id FROM temp.archive_ids));",
+                // квизы всех мероприятий архива года, включая перенесенные раньше, защищены от удаления
+                "INSERT OR IGNORE INTO main.archive_quiz (quiz_id) SELECT DISTINCT quiz_id FROM %1.event WHERE quiz_id IS NOT NULL;",
+                // перенос в архив рейтинг не меняет: отметки, поставленные триггерами удаления,
+                // снимаем, а поставленные до переноса оставляем
+                "INSERT INTO temp.archive_dirty (event_id) "
+                "SELECT event_id FROM main.rating_dirty WHERE event_id IN (SELECT event_id FROM temp.archive_ids);",
+                // участники, результаты и счет удаляются каскадом
+                "DELETE FROM main.event WHERE event_id IN (SELECT event_id FROM temp.archive_ids);",
+                "DELETE FROM main.rating_dirty WHERE event_id IN (SELECT event_id FROM temp.archive_ids) "
+                "AND event_id NOT IN (SELECT event_id FROM temp.archive_dirty);",
+            };
+            for (const QString &sql : copy) {
+                if (!exec(w, sql.arg(schema))) {
+                    conn().lastError = w.lastError().text();
+                    G_ERROR() << "Archive" << it.key() << "failed:" << conn().lastError;
+                    return false;
+                }
+            }
+            for (qint64 id : it.value()) notify(RowDeleted, TableEvent, id);
+            moved += it.value().size();
+        }
+        exec(w, "DELETE FROM temp.archive_ids;");
+        exec(w, "DELETE FROM temp.archive_dirty;");
+        if (!tr.commit()) {
+            moved = 0;
+            return false;
+        }
+    }
+
+    // новые архивы должны попасть в представления всех соединений
+    ++m_archiveGeneration;
+    if (!attachArchives()) return false;
+    G_INFO() << "Archived" << moved << "events to" << byYear.size() << "yearly files in" << timer.elapsed() << "ms";
+    return true;
 }
 
 bool DatabaseManager::createTables()
 {
-    if (!m_db.isOpen() && !open()) return false;
+    if (!db().isOpen() && !open()) return false;
 
-    QSqlQuery q(m_db);
+    // схема меняется - подготовленные запросы больше не годятся
+    clearStatementCache();
+
+    QSqlQuery q(db());
     bool ok = true;
 
+    // в пустом файле режим применяется сразу, в существующем - после VACUUM в обслуживании
+    exec(q, "PRAGMA auto_vacuum = INCREMENTAL;");
+
     // user
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS "user" (
             user_id INTEGER PRIMARY KEY AUTOINCREMENT,
             surname TEXT,
@@ -63,7 +1077,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // team
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS team (
             team_id INTEGER PRIMARY KEY AUTOINCREMENT,
             title TEXT
@@ -71,7 +1085,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // team_user (many-to-many)
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS team_user (
             user_id INTEGER NOT NULL,
             team_id INTEGER NOT NULL,
@@ -82,7 +1096,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // quiz
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS quiz (
             quiz_id INTEGER PRIMARY KEY AUTOINCREMENT,
             topic TEXT,
@@ -91,7 +1105,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // event
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS event (
             event_id INTEGER PRIMARY KEY AUTOINCREMENT,
             quiz_id INTEGER,
@@ -103,7 +1117,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // question
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS question (
             question_id INTEGER PRIMARY KEY AUTOINCREMENT,
             quiz_id INTEGER,
@@ -115,7 +1129,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // answer
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS answer (
             answer_id INTEGER PRIMARY KEY AUTOINCREMENT,
             question_id INTEGER,
@@ -125,7 +1139,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // participant
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS participant (
             participant_id INTEGER PRIMARY KEY AUTOINCREMENT,
             event_id INTEGER,
@@ -139,7 +1153,7 @@ bool DatabaseManager::createTables()
     )sql");
 
     // result
-    ok &= q.exec(R"sql(
+    ok &= exec(q, R"sql(
         CREATE TABLE IF NOT EXISTS result (
             result_id INTEGER PRIMARY KEY AUTOINCREMENT,
             question_id INTEGER,
@@ -153,548 +1167,2158 @@ bool DatabaseManager::createTables()
     )sql");
 
     if (!ok) {
-        m_lastError = q.lastError().text();
+        conn().lastError = q.lastError().text();
+        return false;
     }
 
-    return ok;
+    if (!migrate()) return false;
+    // представления all_* ссылаются на таблицы, созданные выше
+    return attachArchives();
 }
 
-// ---------- Utility helpers ----------
-bool DatabaseManager::execPrepared(QSqlQuery &query, const QVariantList &bindValues)
+int DatabaseManager::schemaVersion()
 {
-    for (int i = 0; i < bindValues.size(); ++i) {
-        query.bindValue(i, bindValues.at(i));
+    if (!db().isOpen() && !open()) return -1;
+    QSqlQuery q(db());
+    if (!exec(q, "PRAGMA user_version;") || !q.next()) {
+        conn().lastError = q.lastError().text();
+        return -1;
     }
-    if (!query.exec()) {
-        m_lastError = query.lastError().text();
-        return false;
+    return q.value(0).toInt();
+}
+
+bool DatabaseManager::migrate()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    int from = schemaVersion();
+    if (from < 0) return false;
+
+    int version = from;
+    for (const Migration &m : migrations()) {
+        if (m.version <= version) continue;
+
+        Transaction tr(*this);
+        if (!tr.isActive()) return false;
+        QSqlQuery q(db());
+        for (const QString &sql : m.statements) {
+            if (!exec(q, sql)) {
+                conn().lastError = q.lastError().text();
+                G_ERROR() << "Migration" << m.version << "failed:" << conn().lastError;
+                return false;
+            }
+        }
+        // PRAGMA user_version транзакционна - версия меняется вместе со схемой
+        if (!exec(q, QString("PRAGMA user_version = %1;").arg(m.version))) {
+            conn().lastError = q.lastError().text();
+            G_ERROR() << "Migration" << m.version << "failed:" << conn().lastError;
+            return false;
+        }
+        if (!tr.commit()) {
+            G_ERROR() << "Migration" << m.version << "failed:" << conn().lastError;
+            return false;
+        }
+        version = m.version;
+        G_INFO() << "Database migrated to version" << version << "-" << m.description;
     }
+
+    if (version != from) clearStatementCache();
+    G_INFO() << "Database schema version" << version << "(was" << from << "), checked in" << timer.elapsed() << "ms";
     return true;
 }
 
-QVariantMap DatabaseManager::recordToMap(const QSqlRecord &rec)
+// ---------- Prepared statements cache ----------
+void DatabaseManager::setStatementCacheEnabled(bool enabled)
 {
-    QVariantMap m;
-    for (int i = 0; i < rec.count(); ++i) {
-        m.insert(rec.fieldName(i), rec.value(i));
+    m_statementCacheEnabled = enabled;
+    if (!enabled) clearStatementCache();
+}
+
+void DatabaseManager::clearStatementCache()
+{
+    // читаемые курсоры остаются у вызывающих: запрос живет, пока на него есть ссылка
+    for (auto it = conn().statements.begin(); it != conn().statements.end(); ++it) {
+        if (!statementInUse(it.value().query)) it.value().query.finish();
     }
-    return m;
+    conn().statements.clear();
 }
 
-// ---------- USER ----------
-bool DatabaseManager::addUser(const QString &surname, const QString &name, const QString &fatherName, qint64 &outId)
+bool DatabaseManager::statementInUse(const QSqlQuery &query)
+{
+    return query.isActive() && query.isSelect() && query.at() != QSql::AfterLastRow;
+}
+
+bool DatabaseManager::prepareCached(QSqlQuery &query, const QString &sql)
 {
-    if (!m_db.isOpen() && !open()) return false;
+    Connection &c = conn();
+    if (m_statementCacheEnabled) {
+        auto it = c.statements.find(sql);
+        if (it != c.statements.end()) {
+            it.value().lastUse = ++c.statementClock;
+            // тот же запрос еще читается выше по стеку - ему нужен свой экземпляр, курсор не трогаем
+            if (statementInUse(it.value().query)) {
+                query = QSqlQuery(db());
+                query.setForwardOnly(true);
+                if (!query.prepare(sql)) {
+                    c.lastError = query.lastError().text();
+                    return false;
+                }
+                return true;
+            }
+            // сбрасываем курсор от предыдущего использования, план остается
+            it.value().query.finish();
+            query = it.value().query;
+            return true;
+        }
+    }
 
-    QSqlQuery q(m_db);
-    q.prepare("INSERT INTO \"user\" (surname, name, father_name) VALUES (?, ?, ?);");
-    if (!execPrepared(q, {surname, name, fatherName})) return false;
-    outId = q.lastInsertId().toLongLong();
+    query = QSqlQuery(db());
+    // результаты читаются только вперед - драйвер не копит уже прочитанные строки
+    query.setForwardOnly(true);
+    if (!query.prepare(sql)) {
+        c.lastError = query.lastError().text();
+        return false;
+    }
+    if (m_statementCacheEnabled) {
+        if (c.statements.size() >= STATEMENT_CACHE_LIMIT) {
+            // вытесняем давно не использованный запрос, читаемые не трогаем
+            auto victim = c.statements.end();
+            for (auto it = c.statements.begin(); it != c.statements.end(); ++it) {
+                if (statementInUse(it.value().query)) continue;
+                if (victim == c.statements.end() || it.value().lastUse < victim.value().lastUse) victim = it;
+            }
+            if (victim == c.statements.end()) return true;
+            victim.value().query.finish();
+            c.statements.erase(victim);
+        }
+        c.statements.insert(sql, { query, ++c.statementClock });
+    }
     return true;
 }
 
-QVariantMap DatabaseManager::getUser(qint64 userId)
+// ---------- Transaction ----------
+DatabaseManager::Transaction::Transaction(DatabaseManager &db, Mode mode)
+    : m_manager(db)
 {
-    QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
+    if (!m_manager.db().isOpen() && !m_manager.open()) return;
+    m_level = m_manager.conn().transactionLevel;
+    m_changeMark = m_manager.conn().pendingChanges.size();
+    QSqlQuery q(m_manager.db());
+    // IMMEDIATE - сразу берем блокировку на запись, чтобы не упасть на середине пакета;
+    // DEFERRED только читает: снимок WAL фиксируется первым SELECT
+    QString sql = m_level > 0 ? QString("SAVEPOINT sp%1;").arg(m_level)
+                              : QString(mode == Read ? "BEGIN DEFERRED;" : "BEGIN IMMEDIATE;");
+    if (!m_manager.exec(q, sql)) {
+        m_manager.conn().lastError = q.lastError().text();
+        return;
+    }
+    m_manager.conn().transactionLevel = m_level + 1;
+    m_active = true;
+}
 
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM \"user\" WHERE user_id = ?;");
-    if (!execPrepared(q, {userId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+DatabaseManager::Transaction::~Transaction()
+{
+    rollback();
 }
 
-int DatabaseManager::getUser(const QString &surname, const QString &name, const QString &fatherName)
+bool DatabaseManager::Transaction::commit()
 {
-    QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return -1;
+    if (!m_active) return false;
+    QSqlQuery q(m_manager.db());
+    QString sql = m_level == 0 ? QString("COMMIT;") : QString("RELEASE sp%1;").arg(m_level);
+    if (!m_manager.exec(q, sql)) {
+        m_manager.conn().lastError = q.lastError().text();
+        rollback();
+        return false;
+    }
+    m_manager.conn().transactionLevel = m_level;
+    m_active = false;
+    if (m_level == 0) {
+        // внешняя транзакция зафиксирована - отдаем накопленные изменения
+        QVector<Change> changes;
+        changes.swap(m_manager.conn().pendingChanges);
+        for (const Change &c : changes) m_manager.emitChange(c);
+    }
+    return true;
+}
 
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM \"user\" WHERE surname = ? and name = ? and father_name = ?;");
-    if (!execPrepared(q, {surname, name, fatherName})) return -1;
-    if (q.next()) return recordToMap(q.record())["user_id"].toInt();
-    return -1;
+void DatabaseManager::Transaction::rollback()
+{
+    if (!m_active) return;
+    QSqlQuery q(m_manager.db());
+    if (m_level == 0) {
+        m_manager.exec(q, "ROLLBACK;");
+    } else {
+        m_manager.exec(q, QString("ROLLBACK TO sp%1;").arg(m_level));
+        m_manager.exec(q, QString("RELEASE sp%1;").arg(m_level));
+    }
+    m_manager.conn().transactionLevel = m_level;
+    m_manager.conn().pendingChanges.resize(m_changeMark);
+    m_active = false;
 }
 
-QVector<QVariantMap> DatabaseManager::listUsers()
+// ---------- Change notifications ----------
+void DatabaseManager::notify(ChangeKind kind, Table table, qint64 id)
 {
-    QVector<QVariantMap> res;
-    if (!m_db.isOpen() && !open()) return res;
-    QSqlQuery q("SELECT * FROM \"user\";", m_db);
-    while (q.next()) res.append(recordToMap(q.record()));
-    return res;
+    Change change{kind, table, id};
+    // сбрасываем сразу, чтобы этот поток видел свою запись
+    invalidateCache(change);
+    if (conn().transactionLevel > 0) conn().pendingChanges.append(change);
+    else emitChange(change);
 }
 
-bool DatabaseManager::updateUser(qint64 userId, const QString &surname, const QString &name, const QString &fatherName)
+// поколение увеличивают триггеры gen_* в транзакции самой записи
+qint64 DatabaseManager::dataGeneration()
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE \"user\" SET surname = ?, name = ?, father_name = ? WHERE user_id = ?;");
-    return execPrepared(q, {surname, name, fatherName, userId});
+    if (!db().isOpen() && !open()) return -1;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT value FROM db_generation WHERE id = 1;")) return -1;
+    qint64 value = q.next() ? q.value(0).toLongLong() : -1;
+    q.finish();
+    return value;
 }
 
-bool DatabaseManager::removeUser(qint64 userId)
+void DatabaseManager::emitChange(const Change &change)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM \"user\" WHERE user_id = ?;");
-    return execPrepared(q, {userId});
+    // и еще раз после фиксации: другой поток мог закэшировать старое значение
+    invalidateCache(change);
+    switch (change.kind) {
+    case RowInserted: emit rowInserted(change.table, change.id); break;
+    case RowUpdated: emit rowUpdated(change.table, change.id); break;
+    case RowDeleted: emit rowDeleted(change.table, change.id); break;
+    }
 }
 
-// ---------- TEAM ----------
-bool DatabaseManager::addTeam(const QString &title, qint64 &outId)
+// ---------- Entity cache ----------
+void DatabaseManager::invalidateCache(const Change &change)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("INSERT INTO team (title) VALUES (?);");
-    if (!execPrepared(q, {title})) return false;
-    outId = q.lastInsertId().toLongLong();
-    return true;
+    QMutexLocker lock(&m_cacheMutex);
+    ++m_cacheGeneration;
+    switch (change.table) {
+    case TableUser:
+        m_users.remove(change.id);
+        // ON DELETE SET NULL меняет участников
+        if (change.kind == RowDeleted) m_participants.clear();
+        break;
+    case TableTeam:
+        m_teams.remove(change.id);
+        if (change.kind == RowDeleted) m_participants.clear();
+        break;
+    case TableQuiz:
+        m_quizzes.remove(change.id);
+        m_quizListValid = false;
+        m_quizList.clear();
+        break;
+    case TableEvent:
+        m_events.remove(change.id);
+        m_participants.remove(change.id);
+        break;
+    case TableParticipant:
+        // известен только id участника, а кэш по мероприятиям
+        m_participants.clear();
+        break;
+    default:
+        break;
+    }
 }
 
-QVariantMap DatabaseManager::getTeam(qint64 teamId)
+bool DatabaseManager::cacheLookup(QHash<qint64, QVariantMap> &cache, qint64 id, QVariantMap &row)
 {
-    QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM team WHERE team_id = ?;");
-    if (!execPrepared(q, {teamId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    QMutexLocker lock(&m_cacheMutex);
+    auto it = cache.constFind(id);
+    if (m_entityCacheEnabled && it != cache.constEnd()) {
+        ++m_cacheHits;
+        row = it.value();
+        return true;
+    }
+    ++m_cacheMisses;
+    return false;
 }
 
-QVector<QVariantMap> DatabaseManager::listTeams()
+void DatabaseManager::cacheStore(QHash<qint64, QVariantMap> &cache, qint64 id, const QVariantMap &row, quint64 generation)
 {
-    QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q("SELECT * FROM team;", m_db);
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    // внутри транзакции могли прочитать незафиксированное
+    if (row.isEmpty() || conn().transactionLevel > 0) return;
+    QMutexLocker lock(&m_cacheMutex);
+    if (!m_entityCacheEnabled || generation != m_cacheGeneration) return;
+    if (cache.size() >= ENTITY_CACHE_LIMIT) cache.clear();
+    cache.insert(id, row);
 }
 
-QVector<QVariantMap> DatabaseManager::listTeamMembers(qint64 teamId)
+QVariantMap DatabaseManager::cachedRow(QHash<qint64, QVariantMap> &cache, qint64 id, const QString &sql)
 {
-    QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q("SELECT * FROM participant where team_id = ?;", m_db);
-    if (!execPrepared(q, {teamId})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    QVariantMap row;
+    if (cacheLookup(cache, id, row)) return row;
+    quint64 generation;
+    {
+        QMutexLocker lock(&m_cacheMutex);
+        generation = m_cacheGeneration;
+    }
+    if (!db().isOpen() && !open()) return row;
+    QSqlQuery q(db());
+    if (!execPrepared(q, sql, {id})) return row;
+    row = fetchOne(q);
+    cacheStore(cache, id, row, generation);
+    return row;
 }
 
-QVector<QVariantMap> DatabaseManager::listTeamUsers(qint64 teamId)
+DatabaseManager::CacheStats DatabaseManager::entityCacheStats() const
 {
-    QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q("SELECT * FROM team_user where team_id = ?;", m_db);
-    if (!execPrepared(q, {teamId})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    QMutexLocker lock(&m_cacheMutex);
+    CacheStats stats;
+    stats.hits = m_cacheHits;
+    stats.misses = m_cacheMisses;
+    stats.entries = m_users.size() + m_teams.size() + m_quizzes.size() + m_events.size()
+                  + m_participants.size() + (m_quizListValid ? 1 : 0);
+    return stats;
 }
 
-bool DatabaseManager::updateTeam(qint64 teamId, const QString &title)
+void DatabaseManager::setEntityCacheEnabled(bool enabled)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE team SET title = ? WHERE team_id = ?;");
-    return execPrepared(q, {title, teamId});
+    {
+        QMutexLocker lock(&m_cacheMutex);
+        m_entityCacheEnabled = enabled;
+    }
+    if (!enabled) clearEntityCache();
 }
 
-bool DatabaseManager::removeTeam(qint64 teamId)
+void DatabaseManager::clearEntityCache()
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM team WHERE team_id = ?;");
-    return execPrepared(q, {teamId});
+    QMutexLocker lock(&m_cacheMutex);
+    ++m_cacheGeneration;
+    m_users.clear();
+    m_teams.clear();
+    m_quizzes.clear();
+    m_events.clear();
+    m_quizList.clear();
+    m_quizListValid = false;
+    m_participants.clear();
 }
 
-// ---------- team_user ----------
-bool DatabaseManager::addTeamUser(qint64 userId, qint64 teamId)
+// ---------- Utility helpers ----------
+bool DatabaseManager::execPrepared(QSqlQuery &query, const QVariantList &bindValues)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("INSERT OR IGNORE INTO team_user (user_id, team_id) VALUES (?, ?);");
-    return execPrepared(q, {userId, teamId});
+    for (int i = 0; i < bindValues.size(); ++i) {
+        query.bindValue(i, bindValues.at(i));
+    }
+    // время до первой строки: для выборок с сортировкой и агрегатами это почти весь запрос
+    QueryProfiler &profiler = QueryProfiler::instance();
+    const bool profile = profiler.isEnabled();
+    QElapsedTimer timer;
+    if (profile) timer.start();
+    bool ok = query.exec();
+    if (profile) profiler.record(query.lastQuery(), timer.nsecsElapsed(), db());
+    if (!ok) {
+        conn().lastError = query.lastError().text();
+        return false;
+    }
+    return true;
 }
 
-QVector<QVariantMap> DatabaseManager::listTeamUsers()
+bool DatabaseManager::exec(QSqlQuery &query, const QString &sql)
 {
-    QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q("SELECT * FROM team_user;", m_db);
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    QueryProfiler &profiler = QueryProfiler::instance();
+    if (!profiler.isEnabled()) return query.exec(sql);
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = query.exec(sql);
+    profiler.record(sql, timer.nsecsElapsed(), db());
+    return ok;
 }
 
-bool DatabaseManager::removeTeamUser(qint64 userId, qint64 teamId)
+bool DatabaseManager::execPrepared(QSqlQuery &query, const QString &sql, const QVariantList &bindValues)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM team_user WHERE user_id = ? AND team_id = ?;");
-    return execPrepared(q, {userId, teamId});
+    if (!prepareCached(query, sql)) return false;
+    return execPrepared(query, bindValues);
 }
 
-// ---------- quiz ----------
-bool DatabaseManager::addQuiz(const QString &topic, qint64 timer, qint64 &outId)
+bool DatabaseManager::execUncached(QSqlQuery &query, const QString &sql, const QVariantList &bindValues)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("INSERT INTO quiz (topic, timer) VALUES (?, ?);");
-    if (!execPrepared(q, {topic, timer })) return false;
-    outId = q.lastInsertId().toLongLong();
-    return true;
+    query = QSqlQuery(db());
+    query.setForwardOnly(true);
+    if (!query.prepare(sql)) {
+        conn().lastError = query.lastError().text();
+        return false;
+    }
+    return execPrepared(query, bindValues);
 }
 
-QVariantMap DatabaseManager::getQuiz(qint64 quizId)
+QVariantMap DatabaseManager::fetchOne(QSqlQuery &query)
 {
-    QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM quiz WHERE quiz_id = ?;");
-    if (!execPrepared(q, {quizId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    QVariantMap m;
+    if (query.next()) m = recordToMap(query.record());
+    query.finish();
+    return m;
 }
 
-QVector<QVariantMap> DatabaseManager::listQuizzes()
+QVector<QVariantMap> DatabaseManager::fetchAll(QSqlQuery &query)
 {
     QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q("SELECT * FROM quiz;", m_db);
-    while (q.next()) v.append(recordToMap(q.record()));
+    while (query.next()) v.append(recordToMap(query.record()));
+    query.finish();
     return v;
 }
 
-bool DatabaseManager::updateQuiz(qint64 quizId, const QString &topic, qint64 timer)
+template<typename Row, typename Decode>
+QVector<Row> DatabaseManager::fetchRows(QSqlQuery &query, Decode decode)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE quiz SET topic = ?, timer = ? WHERE quiz_id = ?;");
-    return execPrepared(q, {topic, timer, quizId });
+    QVector<Row> v;
+    // резервируем по размеру прошлой выборки того же запроса
+    int &hint = conn().rowHints[query.lastQuery()];
+    v.reserve(hint);
+    while (query.next()) v.append(decode(query));
+    query.finish();
+    hint = v.size();
+    return v;
 }
 
-bool DatabaseManager::removeQuiz(qint64 quizId)
+template<typename Decode, typename Row>
+bool DatabaseManager::forEachRow(QSqlQuery &query, Decode decode, const std::function<bool(const Row&)> &visit)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM quiz WHERE quiz_id = ?;");
-    return execPrepared(q, {quizId});
+    // строки не накапливаются: в памяти только текущая
+    while (query.next()) {
+        if (!visit(decode(query))) break;
+    }
+    bool ok = !query.lastError().isValid();
+    if (!ok) conn().lastError = query.lastError().text();
+    query.finish();
+    return ok;
+}
+
+QVariantMap DatabaseManager::recordToMap(const QSqlRecord &rec)
+{
+    QVariantMap m;
+    for (int i = 0; i < rec.count(); ++i) {
+        m.insert(rec.fieldName(i), rec.value(i));
+    }
+    return m;
+}
+
+// ---------- USER ----------
+bool DatabaseManager::addUser(const QString &surname, const QString &name, const QString &fatherName, qint64 &outId)
+{
+    if (!db().isOpen() && !open()) return false;
+
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT INTO \"user\" (surname, name, father_name) VALUES (?, ?, ?);", {surname, name, fatherName})) return false;
+    outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableUser, outId);
+    return true;
+}
+
+QVariantMap DatabaseManager::getUser(qint64 userId)
+{
+    return cachedRow(m_users, userId, "SELECT * FROM \"user\" WHERE user_id = ?;");
+}
+
+QVector<QVariantMap> DatabaseManager::getUsers(const QVector<qint64> &userIds)
+{
+    // пакет фиксированного размера: один подготовленный запрос, хвост добивается повтором id
+    static const int CHUNK = 64;
+    QVector<QVariantMap> result(userIds.size());
+    QHash<qint64, QVector<int>> missing;
+    for (int i = 0; i < userIds.size(); ++i) {
+        if (!cacheLookup(m_users, userIds[i], result[i])) missing[userIds[i]].append(i);
+    }
+    if (missing.isEmpty()) return result;
+    if (!db().isOpen() && !open()) return result;
+
+    quint64 generation;
+    {
+        QMutexLocker lock(&m_cacheMutex);
+        generation = m_cacheGeneration;
+    }
+    QStringList marks;
+    for (int i = 0; i < CHUNK; ++i) marks << "?";
+    const QString sql = QString("SELECT * FROM \"user\" WHERE user_id IN (%1);").arg(marks.join(", "));
+    const QVector<qint64> ids = missing.keys().toVector();
+    QSqlQuery q(db());
+    for (int from = 0; from < ids.size(); from += CHUNK) {
+        QVariantList binds;
+        for (int i = 0; i < CHUNK; ++i) binds << ids[qMin(from + i, ids.size() - 1)];
+        if (!execPrepared(q, sql, binds)) return result;
+        for (const QVariantMap &row : fetchAll(q)) {
+            qint64 id = row.value("user_id").toLongLong();
+            for (int i : missing.value(id)) result[i] = row;
+            cacheStore(m_users, id, row, generation);
+        }
+    }
+    return result;
+}
+int DatabaseManager::getUser(const QString &surname, const QString &name, const QString &fatherName)
+{
+    if (!db().isOpen() && !open()) return -1;
+
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT user_id FROM \"user\" WHERE surname = ? and name = ? and father_name = ?;", {surname, name, fatherName})) return -1;
+    int id = q.next() ? q.value(0).toInt() : -1;
+    q.finish();
+    return id;
+}
+
+QVector<QVariantMap> DatabaseManager::listUsers()
+{
+    QVector<QVariantMap> res;
+    if (!db().isOpen() && !open()) return res;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM \"user\";")) return res;
+    return fetchAll(q);
+}
+
+bool DatabaseManager::updateUser(qint64 userId, const QString &surname, const QString &name, const QString &fatherName)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE \"user\" SET surname = ?, name = ?, father_name = ? WHERE user_id = ?;", {surname, name, fatherName, userId})) return false;
+    notify(RowUpdated, TableUser, userId);
+    return true;
+}
+
+bool DatabaseManager::removeUser(qint64 userId)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM \"user\" WHERE user_id = ?;", {userId})) return false;
+    notify(RowDeleted, TableUser, userId);
+    return true;
+}
+
+// ---------- TEAM ----------
+bool DatabaseManager::addTeam(const QString &title, qint64 &outId)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT INTO team (title) VALUES (?);", {title})) return false;
+    outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableTeam, outId);
+    return true;
+}
+
+QVariantMap DatabaseManager::getTeam(qint64 teamId)
+{
+    return cachedRow(m_teams, teamId, "SELECT * FROM team WHERE team_id = ?;");
+}
+QVector<QVariantMap> DatabaseManager::listTeams()
+{
+    QVector<QVariantMap> v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM team;")) return v;
+    return fetchAll(q);
+}
+
+QVector<QVariantMap> DatabaseManager::listTeamMembers(qint64 teamId)
+{
+    QVector<QVariantMap> v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM participant where team_id = ?;", {teamId})) return v;
+    return fetchAll(q);
+}
+
+QVector<QVariantMap> DatabaseManager::listTeamUsers(qint64 teamId)
+{
+    QVector<QVariantMap> v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM team_user where team_id = ?;", {teamId})) return v;
+    return fetchAll(q);
+}
+
+bool DatabaseManager::updateTeam(qint64 teamId, const QString &title)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE team SET title = ? WHERE team_id = ?;", {title, teamId})) return false;
+    notify(RowUpdated, TableTeam, teamId);
+    return true;
+}
+
+bool DatabaseManager::removeTeam(qint64 teamId)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM team WHERE team_id = ?;", {teamId})) return false;
+    notify(RowDeleted, TableTeam, teamId);
+    return true;
+}
+
+// ---------- team_user ----------
+bool DatabaseManager::addTeamUser(qint64 userId, qint64 teamId)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT OR IGNORE INTO team_user (user_id, team_id) VALUES (?, ?);", {userId, teamId})) return false;
+    notify(RowUpdated, TableTeam, teamId);
+    return true;
+}
+
+QVector<QVariantMap> DatabaseManager::listTeamUsers()
+{
+    QVector<QVariantMap> v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM team_user;")) return v;
+    return fetchAll(q);
+}
+
+bool DatabaseManager::removeTeamUser(qint64 userId, qint64 teamId)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM team_user WHERE user_id = ? AND team_id = ?;", {userId, teamId})) return false;
+    notify(RowUpdated, TableTeam, teamId);
+    return true;
+}
+
+bool DatabaseManager::syncTeamUsers(qint64 teamId, const QSet<int> &userIds)
+{
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT user_id FROM team_user WHERE team_id = ?;", {teamId})) return false;
+    QSet<int> current;
+    while (q.next()) current.insert(q.value(0).toInt());
+    q.finish();
+
+    for (int uid : current) {
+        if (userIds.contains(uid)) continue;
+        if (!execPrepared(q, "DELETE FROM team_user WHERE user_id = ? AND team_id = ?;", {uid, teamId})) return false;
+    }
+    for (int uid : userIds) {
+        if (current.contains(uid)) continue;
+        if (!execPrepared(q, "INSERT OR IGNORE INTO team_user (user_id, team_id) VALUES (?, ?);", {uid, teamId})) return false;
+    }
+    notify(RowUpdated, TableTeam, teamId);
+    return tr.commit();
+}
+
+// ---------- quiz ----------
+bool DatabaseManager::addQuiz(const QString &topic, qint64 timer, qint64 &outId)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT INTO quiz (topic, timer) VALUES (?, ?);", {topic, timer })) return false;
+    outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableQuiz, outId);
+    return true;
+}
+
+QVariantMap DatabaseManager::getQuiz(qint64 quizId)
+{
+    return cachedRow(m_quizzes, quizId, "SELECT * FROM quiz WHERE quiz_id = ?;");
+}
+QVector<QVariantMap> DatabaseManager::listQuizzes()
+{
+    QVector<QVariantMap> v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM quiz;")) return v;
+    return fetchAll(q);
+}
+
+bool DatabaseManager::updateQuiz(qint64 quizId, const QString &topic, qint64 timer)
+{
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE quiz SET topic = ?, timer = ? WHERE quiz_id = ?;", {topic, timer, quizId })) return false;
+    notify(RowUpdated, TableQuiz, quizId);
+    return true;
+}
+
+bool DatabaseManager::removeQuiz(qint64 quizId)
+{
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+    QSqlQuery q(db());
+    // мероприятия квиза удаляются каскадно - сообщаем и о них
+    if (!execPrepared(q, "SELECT event_id FROM event WHERE quiz_id = ?;", {quizId})) return false;
+    QVector<qint64> events;
+    while (q.next()) events.append(q.value(0).toLongLong());
+    q.finish();
+    if (!execPrepared(q, "DELETE FROM quiz WHERE quiz_id = ?;", {quizId})) return false;
+    for (qint64 eventId : events) notify(RowDeleted, TableEvent, eventId);
+    notify(RowDeleted, TableQuiz, quizId);
+    return tr.commit();
 }
 
 // ---------- question ----------
 bool DatabaseManager::addQuestion(qint64 quizId, const QString &text, qint64 points, qint64 answerId, qint64 &outId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("INSERT INTO question (quiz_id, text, points, answer) VALUES (?, ?, ?, ?);");
-    if (!execPrepared(q, {quizId, text, points, answerId == 0 ? QVariant(QVariant::Int) : QVariant(answerId)})) return false;
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT INTO question (quiz_id, text, points, answer) VALUES (?, ?, ?, ?);",
+                      {quizId, text, points, answerId == 0 ? QVariant(QVariant::Int) : QVariant(answerId)})) return false;
     outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableQuestion, outId);
     return true;
 }
 
 QVariantMap DatabaseManager::getQuestion(qint64 questionId)
 {
     QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM question WHERE question_id = ?;");
-    if (!execPrepared(q, {questionId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    if (!db().isOpen() && !open()) return empty;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM question WHERE question_id = ?;", {questionId})) return empty;
+    return fetchOne(q);
 }
 
 QVector<QVariantMap> DatabaseManager::listQuestionsByQuiz(qint64 quizId)
 {
     QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM question WHERE quiz_id = ?;");
-    if (!execPrepared(q, {quizId})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM question WHERE quiz_id = ?;", {quizId})) return v;
+    return fetchAll(q);
 }
 
 bool DatabaseManager::updateQuestion(qint64 questionId, qint64 quizId, const QString &text, qint64 points, qint64 answerId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE question SET quiz_id = ?, text = ?, points = ?, answer = ? WHERE question_id = ?;");
-    return execPrepared(q, {quizId, text, points, answerId == 0 ? QVariant(QVariant::Int) : QVariant(answerId), questionId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE question SET quiz_id = ?, text = ?, points = ?, answer = ? WHERE question_id = ?;",
+                        {quizId, text, points, answerId == 0 ? QVariant(QVariant::Int) : QVariant(answerId), questionId})) return false;
+    notify(RowUpdated, TableQuestion, questionId);
+    return true;
 }
 
 bool DatabaseManager::removeQuestion(qint64 questionId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM question WHERE question_id = ?;");
-    return execPrepared(q, {questionId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM question WHERE question_id = ?;", {questionId})) return false;
+    notify(RowDeleted, TableQuestion, questionId);
+    return true;
 }
 
 // ---------- answer ----------
 bool DatabaseManager::addAnswer(qint64 questionId, const QString &text, qint64 &outId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("INSERT INTO answer (question_id, text) VALUES (?, ?);");
-    if (!execPrepared(q, {questionId, text})) return false;
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT INTO answer (question_id, text) VALUES (?, ?);", {questionId, text})) return false;
     outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableAnswer, outId);
     return true;
 }
 
 QVariantMap DatabaseManager::getAnswer(qint64 answerId)
 {
     QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM answer WHERE answer_id = ?;");
-    if (!execPrepared(q, {answerId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    if (!db().isOpen() && !open()) return empty;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM answer WHERE answer_id = ?;", {answerId})) return empty;
+    return fetchOne(q);
 }
 
 QVector<QVariantMap> DatabaseManager::listAnswersByQuestion(qint64 questionId)
 {
     QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM answer WHERE question_id = ?;");
-    if (!execPrepared(q, {questionId})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM answer WHERE question_id = ?;", {questionId})) return v;
+    return fetchAll(q);
 }
 
 bool DatabaseManager::updateAnswer(qint64 answerId, qint64 questionId, const QString &text)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE answer SET question_id = ?, text = ? WHERE answer_id = ?;");
-    return execPrepared(q, {questionId, text, answerId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE answer SET question_id = ?, text = ? WHERE answer_id = ?;", {questionId, text, answerId})) return false;
+    notify(RowUpdated, TableAnswer, answerId);
+    return true;
 }
 
 bool DatabaseManager::removeAnswer(qint64 answerId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM answer WHERE answer_id = ?;");
-    return execPrepared(q, {answerId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM answer WHERE answer_id = ?;", {answerId})) return false;
+    notify(RowDeleted, TableAnswer, answerId);
+    return true;
+}
+
+bool DatabaseManager::replaceAnswers(qint64 questionId, const QStringList &answers)
+{
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM answer WHERE question_id = ?;", {questionId})) return false;
+    for (const QString &text : answers) {
+        if (!execPrepared(q, "INSERT INTO answer (question_id, text) VALUES (?, ?);", {questionId, text})) return false;
+    }
+    // ответы заменяются целиком - сообщаем об изменении вопроса
+    notify(RowUpdated, TableQuestion, questionId);
+    return tr.commit();
 }
 
 // ---------- participant ----------
 bool DatabaseManager::addParticipant(qint64 eventId, qint64 userId, qint64 teamId, int number, qint64 &outId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("INSERT INTO participant (event_id, user_id, team_id, number) VALUES (?, ?, ?, ?);");
-    if (!execPrepared(q, {eventId, userId == 0 ? QVariant(QVariant::LongLong) : QVariant(userId), teamId == 0 ? QVariant(QVariant::LongLong) : QVariant(teamId), number})) return false;
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT INTO participant (event_id, user_id, team_id, number) VALUES (?, ?, ?, ?);",
+                      {eventId, userId == 0 ? QVariant(QVariant::LongLong) : QVariant(userId), teamId == 0 ? QVariant(QVariant::LongLong) : QVariant(teamId), number})) return false;
     outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableParticipant, outId);
     return true;
 }
 
 QVariantMap DatabaseManager::getParticipant(qint64 participantId)
 {
     QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM participant WHERE participant_id = ?;");
-    if (!execPrepared(q, {participantId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    if (!db().isOpen() && !open()) return empty;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM participant WHERE participant_id = ?;", {participantId})) return empty;
+    return fetchOne(q);
 }
 
 QVector<QVariantMap> DatabaseManager::listParticipantsByEvent(qint64 eventId)
 {
     QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM participant WHERE event_id = ?;");
-    if (!execPrepared(q, {eventId})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM participant WHERE event_id = ?;", {eventId})) return v;
+    return fetchAll(q);
 }
 
-bool DatabaseManager::updateParticipant(qint64 participantId, qint64 quizId, qint64 userId, qint64 teamId, int number)
+bool DatabaseManager::updateParticipant(qint64 participantId, qint64 eventId, qint64 userId, qint64 teamId, int number)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE participant SET quiz_id = ?, user_id = ?, team_id = ?, number = ? WHERE participant_id = ?;");
-    return execPrepared(q, {quizId, userId == 0 ? QVariant(QVariant::LongLong) : QVariant(userId), teamId == 0 ? QVariant(QVariant::LongLong) : QVariant(teamId), number, participantId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE participant SET event_id = ?, user_id = ?, team_id = ?, number = ? WHERE participant_id = ?;",
+                        {eventId, userId == 0 ? QVariant(QVariant::LongLong) : QVariant(userId), teamId == 0 ? QVariant(QVariant::LongLong) : QVariant(teamId), number, participantId})) return false;
+    notify(RowUpdated, TableParticipant, participantId);
+    return true;
 }
 
 bool DatabaseManager::removeParticipant(qint64 participantId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM participant WHERE participant_id = ?;");
-    return execPrepared(q, {participantId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM participant WHERE participant_id = ?;", {participantId})) return false;
+    notify(RowDeleted, TableParticipant, participantId);
+    return true;
 }
 
 bool DatabaseManager::removeParticipant(qint64 userId, quint64 eventId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM participant WHERE user_id = ? and event_id = ?;");
-    return execPrepared(q, {userId, eventId});
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT participant_id FROM participant WHERE user_id = ? and event_id = ?;", {userId, eventId})) return false;
+    QVector<qint64> removed;
+    while (q.next()) removed.append(q.value(0).toLongLong());
+    q.finish();
+    if (!execPrepared(q, "DELETE FROM participant WHERE user_id = ? and event_id = ?;", {userId, eventId})) return false;
+    for (qint64 id : removed) notify(RowDeleted, TableParticipant, id);
+    return tr.commit();
 }
 
 // ---------- result ----------
 bool DatabaseManager::addResult(qint64 questionId, qint64 participantId, qint64 eventId, bool result, qint64 &outId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("INSERT OR REPLACE INTO result (question_id, participant_id, event_id, result) VALUES (?, ?, ?, ?);");
-    if (!execPrepared(q, {questionId, participantId, eventId, result ? 1 : 0})) return false;
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT OR REPLACE INTO result (question_id, participant_id, event_id, result) VALUES (?, ?, ?, ?);",
+                      {questionId, participantId, eventId, result ? 1 : 0})) return false;
     outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableResult, outId);
     return true;
 }
 
+bool DatabaseManager::addResults(const QVector<ResultRow> &rows)
+{
+    if (rows.isEmpty()) return true;
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+
+    QSqlQuery q(db());
+    for (const ResultRow &r : rows) {
+        if (!execPrepared(q, "INSERT OR REPLACE INTO result (question_id, participant_id, event_id, result) VALUES (?, ?, ?, ?);",
+                          {r.questionId, r.participantId, r.eventId, r.result ? 1 : 0})) return false;
+        notify(RowInserted, TableResult, q.lastInsertId().toLongLong());
+    }
+    return tr.commit();
+}
+
 QVariantMap DatabaseManager::getResult(qint64 resultId)
 {
     QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM result WHERE result_id = ?;");
-    if (!execPrepared(q, {resultId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    if (!db().isOpen() && !open()) return empty;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM result WHERE result_id = ?;", {resultId})) return empty;
+    return fetchOne(q);
 }
 
 QVector<QVariantMap> DatabaseManager::listResultsByParticipant(qint64 participantId)
 {
     QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM result WHERE participant_id = ?;");
-    if (!execPrepared(q, {participantId})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM result WHERE participant_id = ?;", {participantId})) return v;
+    return fetchAll(q);
 }
 
 QVector<QVariantMap> DatabaseManager::listResultsByQuestion(qint64 questionId)
 {
     QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM result WHERE question_id = ?;");
-    if (!execPrepared(q, {questionId})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM result WHERE question_id = ?;", {questionId})) return v;
+    return fetchAll(q);
 }
 
 bool DatabaseManager::updateResult(qint64 resultId, bool result)
 {
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE result SET result = ? WHERE result_id = ?;");
-    return execPrepared(q, {result, resultId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE result SET result = ? WHERE result_id = ?;", {result, resultId})) return false;
+    notify(RowUpdated, TableResult, resultId);
+    return true;
 }
 
 bool DatabaseManager::removeResult(qint64 resultId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM result WHERE result_id = ?;");
-    return execPrepared(q, {resultId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM result WHERE result_id = ?;", {resultId})) return false;
+    notify(RowDeleted, TableResult, resultId);
+    return true;
 }
 
 bool DatabaseManager::addEvent(qint64 quizId, const QString& title, const QDateTime &time, int type, qint64 &outId)
 {
-    if (!m_db.isOpen() && !open()) return false;
+    if (!db().isOpen() && !open()) return false;
 
-    QSqlQuery q(m_db);
-    q.prepare("INSERT INTO event (quiz_id, title, time, type) VALUES (?, ?, ?, ?);");
-    if (!execPrepared(q, {quizId, title, time.toSecsSinceEpoch(), type})) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "INSERT INTO event (quiz_id, title, time, type) VALUES (?, ?, ?, ?);", {quizId, title, time.toSecsSinceEpoch(), type})) return false;
     outId = q.lastInsertId().toLongLong();
+    notify(RowInserted, TableEvent, outId);
     return true;
 }
 
 QVariantMap DatabaseManager::getEvent(qint64 eventId)
 {
-    QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
-
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM event WHERE event_id = ?;");
-    if (!execPrepared(q, {eventId})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    return cachedRow(m_events, eventId, "SELECT * FROM event WHERE event_id = ?;");
 }
-
 QVariantMap DatabaseManager::getEvent(const QDateTime &time)
 {
     QVariantMap empty;
-    if (!m_db.isOpen() && !open()) return empty;
+    if (!db().isOpen() && !open()) return empty;
 
-    QSqlQuery q(m_db);
-    q.prepare("SELECT * FROM event WHERE time = ?;");
-    if (!execPrepared(q, {time})) return empty;
-    if (q.next()) return recordToMap(q.record());
-    return empty;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM event WHERE time = ?;", {time.toSecsSinceEpoch()})) return empty;
+    return fetchOne(q);
 }
 
 QVector<QVariantMap> DatabaseManager::listEvents()
 {
     QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q("SELECT * FROM event;", m_db);
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    if (!db().isOpen() && !open()) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT * FROM event;")) return v;
+    return fetchAll(q);
 }
 
 bool DatabaseManager::updateEvent(qint64 eventId, qint64 quizId, const QString& title, const QDateTime &time, int type)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("UPDATE event SET quiz_id = ?, title = ?, time = ?, type = ? WHERE event_id = ?;");
-    return execPrepared(q, {quizId, title, time, type, eventId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "UPDATE event SET quiz_id = ?, title = ?, time = ?, type = ? WHERE event_id = ?;", {quizId, title, time.toSecsSinceEpoch(), type, eventId})) return false;
+    notify(RowUpdated, TableEvent, eventId);
+    return true;
 }
 
 bool DatabaseManager::removeEvent(qint64 eventId)
 {
-    if (!m_db.isOpen() && !open()) return false;
-    QSqlQuery q(m_db);
-    q.prepare("DELETE FROM event WHERE event_id = ?;");
-    return execPrepared(q, {eventId});
+    if (!db().isOpen() && !open()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "DELETE FROM event WHERE event_id = ?;", {eventId})) return false;
+    notify(RowDeleted, TableEvent, eventId);
+    return true;
 }
 
-QVector<QVariantMap> DatabaseManager::resultTeams(const QDateTime dateFrom, const QDateTime dateTo)
-{
-    QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q(m_db);
-    q.prepare(R"sql(
-        SELECT team.title as title, quiz.quiz_id as quiz_id, question.points as points, result.result as result
-        FROM team, participant, event, quiz, question, result
+// Колонки отчетов идут в фиксированном порядке - типизированные варианты читают их по индексу
+static const char *RESULT_TEAMS_SQL = R"sql(
+        SELECT team.team_id as team_id, team.title as title, quiz.quiz_id as quiz_id, question.points as points, result.result as result
+        FROM team, all_participant AS participant, all_event AS event, quiz, question, all_result AS result
         WHERE team.team_id=participant.team_id AND event.event_id=participant.event_id AND quiz.quiz_id=event.quiz_id
         AND question.quiz_id=quiz.quiz_id AND result.question_id=question.question_id and result.participant_id=participant.participant_id
         AND event.time >= ? AND event.time <= ?
         ORDER BY team.team_id, quiz.quiz_id;
-    )sql");
-    if (!execPrepared(q, {dateFrom, dateTo})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
-}
+    )sql";
 
-QVector<QVariantMap> DatabaseManager::resultUsers(const QDateTime dateFrom, const QDateTime dateTo)
-{
-    QVector<QVariantMap> v;
-    if (!m_db.isOpen() && !open()) return v;
-    QSqlQuery q(m_db);
-    q.prepare(R"sql(
-        SELECT user.user_id as user_id, user.name as name, user.father_name as father_name, user.surname as surname, quiz.quiz_id as quiz_id, question.points as points, result.result as result
-        FROM user, participant, event, quiz, question, result
+static const char *RESULT_USERS_SQL = R"sql(
+        SELECT user.user_id as user_id, user.surname as surname, user.name as name, user.father_name as father_name, quiz.quiz_id as quiz_id, question.points as points, result.result as result
+        FROM user, all_participant AS participant, all_event AS event, quiz, question, all_result AS result
         WHERE user.user_id=participant.user_id AND event.event_id=participant.event_id AND quiz.quiz_id=event.quiz_id
         AND question.quiz_id=quiz.quiz_id AND result.question_id=question.question_id and result.participant_id=participant.participant_id
         AND event.time >= ? AND event.time <= ?
-		     UNION
-        SELECT user.user_id as user_id, user.name as name, user.father_name as father_name, user.surname as surname, quiz.quiz_id as quiz_id, question.points as points, result.result as result
-        FROM user, team, team_user, participant, event, quiz, question, result
+        UNION
+        SELECT user.user_id as user_id, user.surname as surname, user.name as name, user.father_name as father_name, quiz.quiz_id as quiz_id, question.points as points, result.result as result
+        FROM user, team, team_user, all_participant AS participant, all_event AS event, quiz, question, all_result AS result
         WHERE team.team_id=participant.team_id AND event.event_id=participant.event_id AND quiz.quiz_id=event.quiz_id AND team_user.team_id = team.team_id AND team_user.user_id = user.user_id
         AND question.quiz_id=quiz.quiz_id AND result.question_id=question.question_id and result.participant_id=participant.participant_id
-        synAND event.time >= ? AND event.time <= ?
+        AND event.time >= ? AND event.time <= ?
         ORDER BY user.user_id, user.father_name, user.surname, quiz.quiz_id;
-    )sql");
-    if (!execPrepared(q, {dateFrom, dateTo, dateFrom, dateTo})) return v;
-    while (q.next()) v.append(recordToMap(q.record()));
-    return v;
+    )sql";
+
+QVector<QVariantMap> DatabaseManager::resultTeams(const QDateTime dateFrom, const QDateTime dateTo)
+{
+    QVector<QVariantMap> v;
+    if (!ensureArchivesFrom(dateFrom.toSecsSinceEpoch())) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, RESULT_TEAMS_SQL, {dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch()})) return v;
+    return fetchAll(q);
+}
+
+QVector<QVariantMap> DatabaseManager::resultUsers(const QDateTime dateFrom, const QDateTime dateTo)
+{
+    QVector<QVariantMap> v;
+    if (!ensureArchivesFrom(dateFrom.toSecsSinceEpoch())) return v;
+    QSqlQuery q(db());
+    if (!execPrepared(q, RESULT_USERS_SQL, {dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch(), dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch()})) return v;
+    return fetchAll(q);
+}
+
+// ---------- Typed rows ----------
+static UserRow toUserRow(const QSqlQuery &q)
+{
+    UserRow r;
+    r.userId = q.value(0).toLongLong();
+    r.surname = q.value(1).toString();
+    r.name = q.value(2).toString();
+    r.fatherName = q.value(3).toString();
+    return r;
+}
+
+static TeamRow toTeamRow(const QSqlQuery &q)
+{
+    TeamRow r;
+    r.teamId = q.value(0).toLongLong();
+    r.title = q.value(1).toString();
+    return r;
+}
+
+static QuizRow toQuizRow(const QSqlQuery &q)
+{
+    QuizRow r;
+    r.quizId = q.value(0).toLongLong();
+    r.topic = q.value(1).toString();
+    r.timer = q.value(2).toLongLong();
+    return r;
+}
+
+static EventRow toEventRow(const QSqlQuery &q)
+{
+    EventRow r;
+    r.eventId = q.value(0).toLongLong();
+    r.quizId = q.value(1).toLongLong();
+    r.title = q.value(2).toString();
+    QVariant time = q.value(3);
+    bool ok = false;
+    r.time = time.toLongLong(&ok);
+    // старые записи могли сохранить время строкой ISO
+    if (!ok) r.time = time.toDateTime().toSecsSinceEpoch();
+    r.type = q.value(4).toInt();
+    return r;
+}
+
+static QuestionRow toQuestionRow(const QSqlQuery &q)
+{
+    QuestionRow r;
+    r.questionId = q.value(0).toLongLong();
+    r.quizId = q.value(1).toLongLong();
+    r.text = q.value(2).toString();
+    r.points = q.value(3).toLongLong();
+    r.answer = q.value(4).toLongLong();
+    return r;
+}
+
+static AnswerRow toAnswerRow(const QSqlQuery &q)
+{
+    AnswerRow r;
+    r.answerId = q.value(0).toLongLong();
+    r.questionId = q.value(1).toLongLong();
+    r.text = q.value(2).toString();
+    return r;
+}
+
+static ParticipantRow toParticipantRow(const QSqlQuery &q)
+{
+    ParticipantRow r;
+    r.participantId = q.value(0).toLongLong();
+    r.eventId = q.value(1).toLongLong();
+    r.userId = q.value(2).toLongLong();
+    r.teamId = q.value(3).toLongLong();
+    r.number = q.value(4).toInt();
+    return r;
+}
+
+static ResultRow toResultRow(const QSqlQuery &q)
+{
+    ResultRow r;
+    r.resultId = q.value(0).toLongLong();
+    r.questionId = q.value(1).toLongLong();
+    r.participantId = q.value(2).toLongLong();
+    r.eventId = q.value(3).toLongLong();
+    r.result = q.value(4).toBool();
+    return r;
+}
+
+QVector<UserRow> DatabaseManager::listUserRows()
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT user_id, surname, name, father_name FROM \"user\";")) return {};
+    return fetchRows<UserRow>(q, toUserRow);
+}
+
+QVector<TeamRow> DatabaseManager::listTeamRows()
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT team_id, title FROM team;")) return {};
+    return fetchRows<TeamRow>(q, toTeamRow);
+}
+
+QVector<QuizRow> DatabaseManager::listQuizRows()
+{
+    quint64 generation;
+    {
+        QMutexLocker lock(&m_cacheMutex);
+        if (m_entityCacheEnabled && m_quizListValid) {
+            ++m_cacheHits;
+            return m_quizList;
+        }
+        ++m_cacheMisses;
+        generation = m_cacheGeneration;
+    }
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT quiz_id, topic, timer FROM quiz;")) return {};
+    QVector<QuizRow> rows = fetchRows<QuizRow>(q, toQuizRow);
+    QMutexLocker lock(&m_cacheMutex);
+    if (m_entityCacheEnabled && generation == m_cacheGeneration && conn().transactionLevel == 0) {
+        m_quizList = rows;
+        m_quizListValid = true;
+    }
+    return rows;
+}
+QVector<EventRow> DatabaseManager::listEventRows()
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT event_id, quiz_id, title, time, type FROM event;")) return {};
+    return fetchRows<EventRow>(q, toEventRow);
+}
+
+EventRow DatabaseManager::getEventRow(qint64 eventId)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT event_id, quiz_id, title, time, type FROM event WHERE event_id = ?;", {eventId})) return {};
+    QVector<EventRow> rows = fetchRows<EventRow>(q, toEventRow);
+    return rows.isEmpty() ? EventRow() : rows.first();
+}
+
+QuizRow DatabaseManager::getQuizRow(qint64 quizId)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT quiz_id, topic, timer FROM quiz WHERE quiz_id = ?;", {quizId})) return {};
+    QVector<QuizRow> rows = fetchRows<QuizRow>(q, toQuizRow);
+    return rows.isEmpty() ? QuizRow() : rows.first();
+}
+
+QVector<QuestionRow> DatabaseManager::listQuestionRowsByQuiz(qint64 quizId)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT question_id, quiz_id, text, points, answer FROM question WHERE quiz_id = ?;", {quizId})) return {};
+    return fetchRows<QuestionRow>(q, toQuestionRow);
+}
+
+QVector<AnswerRow> DatabaseManager::listAnswerRowsByQuestion(qint64 questionId)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT answer_id, question_id, text FROM answer WHERE question_id = ?;", {questionId})) return {};
+    return fetchRows<AnswerRow>(q, toAnswerRow);
+}
+
+QVector<ParticipantRow> DatabaseManager::listParticipantRowsByEvent(qint64 eventId)
+{
+    quint64 generation;
+    {
+        QMutexLocker lock(&m_cacheMutex);
+        auto it = m_participants.constFind(eventId);
+        if (m_entityCacheEnabled && it != m_participants.constEnd()) {
+            ++m_cacheHits;
+            return it.value();
+        }
+        ++m_cacheMisses;
+        generation = m_cacheGeneration;
+    }
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT participant_id, event_id, user_id, team_id, number FROM participant WHERE event_id = ?;", {eventId})) return {};
+    QVector<ParticipantRow> rows = fetchRows<ParticipantRow>(q, toParticipantRow);
+    QMutexLocker lock(&m_cacheMutex);
+    if (m_entityCacheEnabled && generation == m_cacheGeneration && conn().transactionLevel == 0) {
+        if (m_participants.size() >= ENTITY_CACHE_LIMIT) m_participants.clear();
+        m_participants.insert(eventId, rows);
+    }
+    return rows;
+}
+QVector<ResultRow> DatabaseManager::listResultRowsByParticipant(qint64 participantId)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT result_id, question_id, participant_id, event_id, result FROM result WHERE participant_id = ?;", {participantId})) return {};
+    return fetchRows<ResultRow>(q, toResultRow);
+}
+
+QVector<ResultRow> DatabaseManager::listResultRowsByQuestion(qint64 questionId)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT result_id, question_id, participant_id, event_id, result FROM result WHERE question_id = ?;", {questionId})) return {};
+    return fetchRows<ResultRow>(q, toResultRow);
+}
+
+/**
+ * Запрос страницы: SELECT ... [WHERE фильтр AND (sortExpr, id) >/< (?, ?)] ORDER BY sortExpr, id LIMIT ?.
+ * Параметры привязываются в порядке: фильтр, ключ, лимит.
+ */
+static QString pageSql(const QString &select, const QString &sortExpr, const QString &idColumn,
+                       const QString &filterColumn, bool hasKey, bool hasFilter, Qt::SortOrder order)
+{
+    QString dir = order == Qt::AscendingOrder ? "ASC" : "DESC";
+    QStringList where;
+    if (hasFilter) where << QString("%1 LIKE ? ESCAPE '\\'").arg(filterColumn);
+    if (hasKey) where << QString("(%1, %2) %3 (?, ?)").arg(sortExpr, idColumn, order == Qt::AscendingOrder ? ">" : "<");
+    QString sql = select;
+    if (!where.isEmpty()) sql += " WHERE " + where.join(" AND ");
+    sql += QString(" ORDER BY %1 %3, %2 %3 LIMIT ?;").arg(sortExpr, idColumn, dir);
+    return sql;
+}
+
+// LIKE без ICU не различает регистр только у латиницы: кириллица сравнивается точно.
+// Строка из уведомления и та же строка после перезагрузки страницы должны фильтроваться одинаково
+bool DatabaseManager::matchesFilter(const QString &text, const QString &filter)
+{
+    auto fold = [](QString s) {
+        for (QChar &c : s) {
+            if (c >= QLatin1Char('A') && c <= QLatin1Char('Z')) c = QChar(c.unicode() + ('a' - 'A'));
+        }
+        return s;
+    };
+    return fold(text).contains(fold(filter));
+}
+
+static QVariantList pageBinds(const PageKey &after, int limit, const QString &filter)
+{
+    QVariantList binds;
+    if (!filter.isEmpty()) {
+        QString pattern = filter;
+        pattern.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+        binds << "%" + pattern + "%";
+    }
+    if (!after.isFirst()) binds << after.value << after.id;
+    binds << limit;
+    return binds;
+}
+
+QVector<EventRow> DatabaseManager::listEventsPage(const PageKey &after, int limit, EventSort sort, Qt::SortOrder order, const QString &filter)
+{
+    static const char *columns[] = { "event_id", "IFNULL(title, '')", "time", "type" };
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    QString sql = pageSql("SELECT event_id, quiz_id, title, time, type FROM event", columns[sort], "event_id",
+                          "title", !after.isFirst(), !filter.isEmpty(), order);
+    if (!execUncached(q, sql, pageBinds(after, limit, filter))) return {};
+    return fetchRows<EventRow>(q, toEventRow);
+}
+
+PageKey DatabaseManager::eventPageKey(const EventRow &row, EventSort sort)
+{
+    PageKey key;
+    key.id = row.eventId;
+    switch (sort) {
+    case EventSortId: key.value = row.eventId; break;
+    case EventSortTitle: key.value = row.title; break;
+    case EventSortTime: key.value = row.time; break;
+    case EventSortType: key.value = row.type; break;
+    }
+    return key;
+}
+
+QVector<QuizRow> DatabaseManager::listQuizzesPage(const PageKey &after, int limit, QuizSort sort, Qt::SortOrder order, const QString &filter)
+{
+    static const char *columns[] = { "quiz_id", "IFNULL(topic, '')" };
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    QString sql = pageSql("SELECT quiz_id, topic, timer FROM quiz", columns[sort], "quiz_id",
+                          "topic", !after.isFirst(), !filter.isEmpty(), order);
+    if (!execUncached(q, sql, pageBinds(after, limit, filter))) return {};
+    return fetchRows<QuizRow>(q, toQuizRow);
+}
+
+PageKey DatabaseManager::quizPageKey(const QuizRow &row, QuizSort sort)
+{
+    PageKey key;
+    key.id = row.quizId;
+    key.value = sort == QuizSortTopic ? QVariant(row.topic) : QVariant(row.quizId);
+    return key;
+}
+
+QuizGraph DatabaseManager::loadQuizGraph(qint64 quizId)
+{
+    QuizGraph graph;
+    if (!db().isOpen() && !open()) return graph;
+    QSqlQuery q(db());
+    if (!execPrepared(q, "SELECT quiz_id, topic, timer FROM quiz WHERE quiz_id = ?;", {quizId})) return graph;
+    QVector<QuizRow> quiz = fetchRows<QuizRow>(q, toQuizRow);
+    if (quiz.isEmpty()) return graph;
+    graph.quiz = quiz.first();
+
+    if (!execPrepared(q, "SELECT question_id, quiz_id, text, points, answer FROM question WHERE quiz_id = ? ORDER BY question_id;", {quizId})) return QuizGraph();
+    QHash<qint64, int> index;
+    for (const QuestionRow &row : fetchRows<QuestionRow>(q, toQuestionRow)) {
+        index.insert(row.questionId, graph.questions.size());
+        graph.questions.append({row, {}});
+    }
+
+    // все ответы квиза одним запросом, раскладываем по вопросам
+    if (!execPrepared(q, R"sql(
+        SELECT answer.answer_id, answer.question_id, answer.text
+        FROM answer JOIN question ON question.question_id = answer.question_id
+        WHERE question.quiz_id = ?
+        ORDER BY answer.question_id, answer.answer_id;
+    )sql", {quizId})) return QuizGraph();
+    for (const AnswerRow &row : fetchRows<AnswerRow>(q, toAnswerRow)) {
+        auto it = index.constFind(row.questionId);
+        if (it != index.constEnd()) graph.questions[it.value()].answers.append(row);
+    }
+    return graph;
+}
+
+QVector<TeamResultRow> DatabaseManager::resultTeamRows(const QDateTime dateFrom, const QDateTime dateTo)
+{
+    if (!ensureArchivesFrom(dateFrom.toSecsSinceEpoch())) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, RESULT_TEAMS_SQL, {dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch()})) return {};
+    return fetchRows<TeamResultRow>(q, [](const QSqlQuery &q) {
+        TeamResultRow r;
+        r.teamId = q.value(0).toLongLong();
+        r.title = q.value(1).toString();
+        r.quizId = q.value(2).toLongLong();
+        r.points = q.value(3).toInt();
+        r.result = q.value(4).toBool();
+        return r;
+    });
+}
+
+QVector<UserResultRow> DatabaseManager::resultUserRows(const QDateTime dateFrom, const QDateTime dateTo)
+{
+    if (!ensureArchivesFrom(dateFrom.toSecsSinceEpoch())) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, RESULT_USERS_SQL, {dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch(), dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch()})) return {};
+    return fetchRows<UserResultRow>(q, [](const QSqlQuery &q) {
+        UserResultRow r;
+        r.userId = q.value(0).toLongLong();
+        r.surname = q.value(1).toString();
+        r.name = q.value(2).toString();
+        r.fatherName = q.value(3).toString();
+        r.quizId = q.value(4).toLongLong();
+        r.points = q.value(5).toInt();
+        r.result = q.value(6).toBool();
+        return r;
+    });
+}
+
+// Без ORDER BY: сортировка 10 млн строк ушла бы во временное B-дерево,
+// а обход по idx_event_time и покрывающим индексам и так идет по мероприятиям
+bool DatabaseManager::forEachAnswerRow(const AnswerExportFilter &filter, const std::function<bool(const AnswerExportRow&)> &visit)
+{
+    // выгрузка по мероприятиям без периода берет их по id, иначе нужен весь период
+    const bool byEvents = !filter.eventIds.isEmpty() && !filter.dateFrom.isValid();
+    if (!(byEvents ? ensureArchives()
+                   : ensureArchivesFrom(filter.dateFrom.isValid() ? filter.dateFrom.toSecsSinceEpoch() : std::numeric_limits<qint64>::min()))) return false;
+    QSqlQuery q(db());
+    QString eventFilter;
+    if (!filter.eventIds.isEmpty()) {
+        if (!exec(q, "CREATE TEMP TABLE IF NOT EXISTS export_events (event_id INTEGER PRIMARY KEY);")
+            || !exec(q, "DELETE FROM temp.export_events;")) {
+            conn().lastError = q.lastError().text();
+            return false;
+        }
+        for (qint64 id : filter.eventIds) {
+            if (!execPrepared(q, "INSERT OR IGNORE INTO temp.export_events (event_id) VALUES (?);", {id})) return false;
+        }
+        eventFilter = "AND event.event_id IN (SELECT event_id FROM temp.export_events)";
+    }
+    const qint64 from = filter.dateFrom.isValid() ? filter.dateFrom.toSecsSinceEpoch() : std::numeric_limits<qint64>::min();
+    const qint64 to = filter.dateTo.isValid() ? filter.dateTo.toSecsSinceEpoch() : std::numeric_limits<qint64>::max();
+    if (!execUncached(q, QString(R"sql(
+        SELECT result.result_id, event.event_id, event.title, event.time, event.quiz_id, quiz.topic,
+               participant.participant_id, participant.number, participant.user_id,
+               "user".surname, "user".name, "user".father_name, participant.team_id, team.title,
+               result.question_id, question.text, question.points, result.result
+        FROM all_event AS event
+        JOIN all_participant AS participant ON participant.event_id = event.event_id
+        JOIN all_result AS result ON result.participant_id = participant.participant_id
+        LEFT JOIN quiz ON quiz.quiz_id = event.quiz_id
+        LEFT JOIN question ON question.question_id = result.question_id
+        LEFT JOIN "user" ON "user".user_id = participant.user_id
+        LEFT JOIN team ON team.team_id = participant.team_id
+        WHERE event.time >= ? AND event.time <= ? %1;
+    )sql").arg(eventFilter), {from, to})) return false;
+
+    // одна структура на весь обход
+    AnswerExportRow r;
+    bool ok = true;
+    while (q.next()) {
+        r.resultId = q.value(0).toLongLong();
+        r.eventId = q.value(1).toLongLong();
+        r.eventTitle = q.value(2).toString();
+        r.eventTime = q.value(3).toLongLong();
+        r.quizId = q.value(4).toLongLong();
+        r.topic = q.value(5).toString();
+        r.participantId = q.value(6).toLongLong();
+        r.number = q.value(7).toInt();
+        r.userId = q.value(8).toLongLong();
+        r.surname = q.value(9).toString();
+        r.name = q.value(10).toString();
+        r.fatherName = q.value(11).toString();
+        r.teamId = q.value(12).toLongLong();
+        r.teamTitle = q.value(13).toString();
+        r.questionId = q.value(14).toLongLong();
+        r.questionText = q.value(15).toString();
+        r.points = q.value(16).toInt();
+        r.result = q.value(17).toInt();
+        if (!visit(r)) break;
+    }
+    if (q.lastError().isValid()) {
+        conn().lastError = q.lastError().text();
+        ok = false;
+    }
+    // закрыть курсор сразу, иначе открытое чтение держит снимок WAL до следующего запроса
+    q.finish();
+    return ok;
+}
+
+// Баллы берутся из participant_score: чтение O(участников), а не O(ответов)
+bool DatabaseManager::forEachTeamScore(const QDateTime dateFrom, const QDateTime dateTo, const std::function<bool(const TeamScoreRow&)> &visit)
+{
+    if (!ensureArchivesFrom(dateFrom.toSecsSinceEpoch())) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        WITH totals AS (
+            SELECT participant.team_id AS team_id, COUNT(DISTINCT participant.event_id) AS games,
+                   TOTAL(score.points) AS points, TOTAL(score.total_points) AS total_points
+            FROM all_event AS event
+            JOIN all_participant AS participant ON participant.event_id = event.event_id
+            JOIN all_participant_score AS score ON score.participant_id = participant.participant_id
+            WHERE event.time >= ? AND event.time <= ? AND participant.team_id IS NOT NULL AND score.answers > 0
+            GROUP BY participant.team_id
+        )
+        SELECT team.team_id, team.title, totals.games, totals.points, totals.total_points,
+               CASE WHEN totals.total_points > 0 THEN CAST(100 * totals.points / totals.total_points AS INTEGER) ELSE 0 END
+        FROM totals JOIN team ON team.team_id = totals.team_id
+        ORDER BY team.team_id;
+    )sql", {dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch()})) return false;
+    return forEachRow(q, [](const QSqlQuery &q) {
+        TeamScoreRow r;
+        r.teamId = q.value(0).toLongLong();
+        r.title = q.value(1).toString();
+        r.games = q.value(2).toInt();
+        r.points = q.value(3).toLongLong();
+        r.totalPoints = q.value(4).toLongLong();
+        r.percent = q.value(5).toInt();
+        return r;
+    }, visit);
+}
+
+bool DatabaseManager::forEachUserScore(const QDateTime dateFrom, const QDateTime dateTo, const std::function<bool(const UserScoreRow&)> &visit)
+{
+    if (!ensureArchivesFrom(dateFrom.toSecsSinceEpoch())) return false;
+    QSqlQuery q(db());
+    // личное участие плюс участие в составе команды, без двойного учета
+    if (!execPrepared(q, R"sql(
+        WITH played AS (
+            SELECT participant.user_id AS user_id, participant.team_id AS team_id, participant.event_id AS event_id,
+                   score.points AS points, score.total_points AS total_points
+            FROM all_event AS event
+            JOIN all_participant AS participant ON participant.event_id = event.event_id
+            JOIN all_participant_score AS score ON score.participant_id = participant.participant_id
+            WHERE event.time >= ? AND event.time <= ? AND score.answers > 0
+        ), scored AS (
+            SELECT user_id, event_id, points, total_points FROM played WHERE user_id IS NOT NULL
+            UNION ALL
+            SELECT team_user.user_id, played.event_id, played.points, played.total_points
+            FROM played JOIN team_user ON team_user.team_id = played.team_id
+            WHERE played.user_id IS NULL OR played.user_id <> team_user.user_id
+        ), totals AS (
+            SELECT user_id, COUNT(DISTINCT event_id) AS games,
+                   TOTAL(points) AS points, TOTAL(total_points) AS total_points
+            FROM scored GROUP BY user_id
+        )
+        SELECT "user".user_id, "user".surname, "user".name, "user".father_name,
+               totals.games, totals.points, totals.total_points,
+               CASE WHEN totals.total_points > 0 THEN CAST(100 * totals.points / totals.total_points AS INTEGER) ELSE 0 END
+        FROM totals JOIN "user" ON "user".user_id = totals.user_id
+        ORDER BY "user".user_id;
+    )sql", {dateFrom.toSecsSinceEpoch(), dateTo.toSecsSinceEpoch()})) return false;
+    return forEachRow(q, [](const QSqlQuery &q) {
+        UserScoreRow r;
+        r.userId = q.value(0).toLongLong();
+        r.surname = q.value(1).toString();
+        r.name = q.value(2).toString();
+        r.fatherName = q.value(3).toString();
+        r.games = q.value(4).toInt();
+        r.points = q.value(5).toLongLong();
+        r.totalPoints = q.value(6).toLongLong();
+        r.percent = q.value(7).toInt();
+        return r;
+    }, visit);
+}
+
+bool DatabaseManager::forEachEventScore(qint64 eventId, const std::function<bool(const ParticipantScoreRow&)> &visit)
+{
+    if (!ensureArchives()) return false;
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT participant.participant_id, participant.event_id, participant.user_id, participant.team_id, participant.number,
+               IFNULL(score.points, 0), IFNULL(score.total_points, 0), IFNULL(score.answers, 0)
+        FROM all_participant AS participant LEFT JOIN all_participant_score AS score ON score.participant_id = participant.participant_id
+        WHERE participant.event_id = ?
+        ORDER BY 6 DESC, participant.number;
+    )sql", {eventId})) return false;
+    return forEachRow(q, [](const QSqlQuery &q) {
+        ParticipantScoreRow r;
+        r.participant = toParticipantRow(q);
+        r.points = q.value(5).toLongLong();
+        r.totalPoints = q.value(6).toLongLong();
+        r.answers = q.value(7).toInt();
+        return r;
+    }, visit);
+}
+
+QVector<TeamScoreRow> DatabaseManager::teamScores(const QDateTime dateFrom, const QDateTime dateTo)
+{
+    QVector<TeamScoreRow> rows;
+    forEachTeamScore(dateFrom, dateTo, [&rows](const TeamScoreRow &r) { rows.append(r); return true; });
+    return rows;
+}
+
+QVector<UserScoreRow> DatabaseManager::userScores(const QDateTime dateFrom, const QDateTime dateTo)
+{
+    QVector<UserScoreRow> rows;
+    forEachUserScore(dateFrom, dateTo, [&rows](const UserScoreRow &r) { rows.append(r); return true; });
+    return rows;
+}
+
+QVector<ParticipantScoreRow> DatabaseManager::eventScores(qint64 eventId)
+{
+    QVector<ParticipantScoreRow> rows;
+    forEachEventScore(eventId, [&rows](const ParticipantScoreRow &r) { rows.append(r); return true; });
+    return rows;
+}
+
+qint64 DatabaseManager::rowCount(Table table)
+{
+    static const char *const names[] = { "\"user\"", "team", "quiz", "event", "question", "answer", "participant", "result", "participant_score" };
+    if (!db().isOpen() && !open()) return 0;
+    QSqlQuery q(db());
+    if (!execUncached(q, QString("SELECT COUNT(*) FROM %1;").arg(names[table]))) return 0;
+    qint64 n = q.next() ? q.value(0).toLongLong() : 0;
+    q.finish();
+    return n;
+}
+
+// Суммы для корреляции копятся по ходу чтения: в памяти O(вопросов), а не O(ответов)
+QVector<ItemStatsRow> DatabaseManager::itemAnalysis(qint64 quizId)
+{
+    struct Acc {
+        qint64 n = 0;
+        qint64 x = 0;    // верных
+        double y = 0;    // баллы участника без этого вопроса
+        double y2 = 0;
+        double xy = 0;
+    };
+    const QVector<QuestionRow> questions = listQuestionRowsByQuiz(quizId);
+    QHash<qint64, int> index;
+    index.reserve(questions.size());
+    for (int i = 0; i < questions.size(); ++i) index.insert(questions[i].questionId, i);
+    QVector<Acc> acc(questions.size());
+
+    if (!ensureArchivesFrom(std::numeric_limits<qint64>::min())) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT result.question_id, result.result, IFNULL(score.points, 0)
+        FROM all_event AS event
+        JOIN all_participant AS participant ON participant.event_id = event.event_id
+        JOIN all_result AS result ON result.participant_id = participant.participant_id
+        LEFT JOIN all_participant_score AS score ON score.participant_id = participant.participant_id
+        WHERE event.quiz_id = ?;
+    )sql", {quizId})) return {};
+    while (q.next()) {
+        auto it = index.constFind(q.value(0).toLongLong());
+        if (it == index.constEnd()) continue; // вопрос удален из квиза
+        const int x = q.value(1).toInt() ? 1 : 0;
+        const double y = q.value(2).toDouble() - x * questions[it.value()].points;
+        Acc &a = acc[it.value()];
+        ++a.n;
+        a.x += x;
+        a.y += y;
+        a.y2 += y * y;
+        a.xy += x * y;
+    }
+    if (q.lastError().isValid()) conn().lastError = q.lastError().text();
+    q.finish();
+
+    QVector<ItemStatsRow> rows(questions.size());
+    for (int i = 0; i < questions.size(); ++i) {
+        const Acc &a = acc[i];
+        ItemStatsRow &r = rows[i];
+        r.question = questions[i];
+        r.attempts = a.n;
+        r.correct = a.x;
+        if (a.n == 0) continue;
+        r.pValue = double(a.x) / a.n;
+        // r = (n*Sxy - Sx*Sy) / sqrt((n*Sx - Sx^2) * (n*Syy - Sy^2)), для 0/1 Sxx = Sx
+        const double n = double(a.n);
+        const double varX = n * a.x - double(a.x) * a.x;
+        const double varY = n * a.y2 - a.y * a.y;
+        if (varX > 0 && varY > 1e-9) r.discrimination = (n * a.xy - a.x * a.y) / std::sqrt(varX * varY);
+    }
+    return rows;
+}
+
+// ---------- Ratings ----------
+// порядок расчета - по времени мероприятия, при равном времени - по id
+static bool ratingBefore(qint64 timeA, qint64 idA, qint64 timeB, qint64 idB)
+{
+    return timeA < timeB || (timeA == timeB && idA < idB);
+}
+
+bool DatabaseManager::loadRatingEvents(QHash<qint64, RatingEventState> &events)
+{
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT event.event_id, CAST(event.time AS INTEGER), TOTAL(score.answers), TOTAL(score.points)
+        FROM all_event AS event
+        JOIN all_participant_score AS score ON score.event_id = event.event_id
+        GROUP BY event.event_id
+        HAVING TOTAL(score.answers) > 0;
+    )sql")) return false;
+    while (q.next()) {
+        RatingEventState e;
+        e.time = q.value(1).toLongLong();
+        e.answers = q.value(2).toLongLong();
+        e.points = q.value(3).toLongLong();
+        events.insert(q.value(0).toLongLong(), e);
+    }
+    q.finish();
+    return true;
+}
+
+void DatabaseManager::rateEvents(const QVector<qint64> &events, const QHash<qint64, QVector<RatingEntry>> &entries,
+                                 const RatingParams &params, QHash<RatingKey, RatingState> &ratings, QVector<RatingWrite> &history,
+                                 const std::atomic<bool> *cancel)
+{
+    QVector<Elo::Entry> elo;
+    QVector<RatingKey> keys;
+    for (qint64 eventId : events) {
+        if (cancel && *cancel) return;
+        const QVector<RatingEntry> participants = entries.value(eventId);
+        // физлица и команды одного мероприятия соревнуются только между собой
+        for (int kind : { int(RatingUser), int(RatingTeam) }) {
+            elo.clear();
+            keys.clear();
+            for (const RatingEntry &p : participants) {
+                if (p.key.first != kind) continue;
+                auto it = ratings.constFind(p.key);
+                Elo::Entry e;
+                e.rating = it != ratings.constEnd() ? it.value().rating : params.initial;
+                e.games = it != ratings.constEnd() ? it.value().games : 0;
+                e.points = p.points;
+                elo.append(e);
+                keys.append(p.key);
+            }
+            if (elo.size() < 2) continue;
+            Elo::rateEvent(elo, params);
+            for (int i = 0; i < elo.size(); ++i) {
+                RatingState &state = ratings[keys[i]];
+                state.rating = elo[i].newRating;
+                state.games = elo[i].games + 1;
+                history.append({ eventId, keys[i], elo[i].rating, elo[i].newRating });
+            }
+        }
+    }
+}
+
+bool DatabaseManager::insertRows(const QString &insert, int columns, const QVector<QVariantList> &rows)
+{
+    QStringList marks;
+    for (int i = 0; i < columns; ++i) marks << "?";
+    const QString row = "(" + marks.join(", ") + ")";
+    QStringList batchRows;
+    for (int i = 0; i < RATING_WRITE_ROWS; ++i) batchRows << row;
+    // текст пачки зависит только от таблицы: оба оператора берутся из кэша
+    const QString batch = insert + " VALUES " + batchRows.join(", ") + ";";
+    const QString single = insert + " VALUES " + row + ";";
+    QSqlQuery q(db());
+    QVariantList binds;
+    int i = 0;
+    for (; i + RATING_WRITE_ROWS <= rows.size(); i += RATING_WRITE_ROWS) {
+        binds.clear();
+        for (int j = i; j < i + RATING_WRITE_ROWS; ++j) binds += rows[j];
+        if (!execPrepared(q, batch, binds)) return false;
+    }
+    for (; i < rows.size(); ++i) {
+        if (!execPrepared(q, single, rows[i])) return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::writeRatings(const QVector<qint64> &events, const QHash<qint64, RatingEventState> &state,
+                                   const QVector<RatingWrite> &history, const QHash<RatingKey, RatingState> &ratings)
+{
+    QVector<QVariantList> rows;
+    rows.reserve(history.size());
+    for (const RatingWrite &h : history) rows.append({ h.eventId, h.key.first, h.key.second, h.before, h.after });
+    if (!insertRows("INSERT OR REPLACE INTO rating_history (event_id, kind, entity_id, rating_before, rating_after)", 5, rows)) return false;
+    rows.clear();
+    for (auto it = ratings.constBegin(); it != ratings.constEnd(); ++it) {
+        rows.append({ it.key().first, it.key().second, it.value().rating, it.value().games });
+    }
+    if (!insertRows("INSERT OR REPLACE INTO rating (kind, entity_id, rating, games)", 4, rows)) return false;
+    rows.clear();
+    for (qint64 eventId : events) {
+        const RatingEventState e = state.value(eventId);
+        rows.append({ eventId, e.time, e.answers, e.points });
+    }
+    return insertRows("INSERT OR REPLACE INTO rating_event (event_id, time, answers, points)", 4, rows);
+}
+
+bool DatabaseManager::updateRatings(int &ratedEvents)
+{
+    ratedEvents = 0;
+    QMutexLocker lock(&m_ratingMutex);
+    // ATTACH невозможен внутри транзакции - архивы подключаем до нее; рейтинг нужен по всей истории
+    if (!ensureArchivesFrom(std::numeric_limits<qint64>::min())) return false;
+    QElapsedTimer timer;
+    timer.start();
+
+    // чтение и расчет - в снимке без блокировки на запись: операторы пишут все это время,
+    // а отметки, поставленные после снимка, достаются следующему проходу
+    Transaction read(*this, Transaction::Read);
+    if (!read.isActive()) return false;
+    // мероприятия, отмеченные триггерами: позиция пересчета - самое раннее из их
+    // текущего и учтенного времени; 0 - пересчет с самого начала
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT dirty.event_id, dirty.seq, rated.time
+        FROM rating_dirty AS dirty LEFT JOIN rating_event AS rated ON rated.event_id = dirty.event_id;
+    )sql")) return false;
+    bool dirty = false;
+    qint64 fromTime = 0, fromId = 0, dirtySeq = 0;
+    auto mark = [&](qint64 time, qint64 id) {
+        if (!dirty || ratingBefore(time, id, fromTime, fromId)) {
+            fromTime = time;
+            fromId = id;
+        }
+        dirty = true;
+    };
+    QVector<qint64> marked;
+    while (q.next()) {
+        const qint64 eventId = q.value(0).toLongLong();
+        marked.append(eventId);
+        dirtySeq = qMax(dirtySeq, q.value(1).toLongLong());
+        if (eventId == 0) mark(std::numeric_limits<qint64>::min(), std::numeric_limits<qint64>::min());
+        if (!q.value(2).isNull()) mark(q.value(2).toLongLong(), eventId);
+    }
+    q.finish();
+    if (marked.isEmpty()) return true;
+    // условие по id уходит в каждую часть представления и читается по первичному ключу
+    for (qint64 eventId : marked) {
+        if (!execPrepared(q, "SELECT CAST(time AS INTEGER) FROM all_event WHERE event_id = ?;", { eventId })) return false;
+        if (q.next()) mark(q.value(0).toLongLong(), eventId);
+        q.finish();
+    }
+
+    // откат: рейтинг до первого отменяемого мероприятия - rating_before его записи
+    QHash<RatingKey, RatingState> ratings;
+    QHash<RatingKey, int> undone;
+    if (!execPrepared(q, R"sql(
+        SELECT h.kind, h.entity_id, h.rating_before
+        FROM rating_event AS e JOIN rating_history AS h ON h.event_id = e.event_id
+        WHERE e.time > ? OR (e.time = ? AND e.event_id >= ?)
+        ORDER BY e.time DESC, e.event_id DESC;
+    )sql", { fromTime, fromTime, fromId })) return false;
+    while (q.next()) {
+        RatingKey key(q.value(0).toInt(), q.value(1).toLongLong());
+        // от поздних к ранним: последней остается самая ранняя запись
+        ratings[key].rating = q.value(2).toDouble();
+        ++undone[key];
+    }
+    q.finish();
+    for (auto it = undone.constBegin(); it != undone.constEnd(); ++it) {
+        if (!execPrepared(q, "SELECT games FROM rating WHERE kind = ? AND entity_id = ?;", { it.key().first, it.key().second })) return false;
+        int games = q.next() ? q.value(0).toInt() : 0;
+        q.finish();
+        ratings[it.key()].games = qMax(games - it.value(), 0);
+    }
+    // после отката игр не осталось - запись рейтинга удаляется, если расчет ее не вернет
+    QVector<RatingKey> emptied;
+    for (auto it = ratings.constBegin(); it != ratings.constEnd(); ++it) {
+        if (it.value().games == 0) emptied.append(it.key());
+    }
+
+    // мероприятия от точки пересчета - по индексу времени, раньше нее история не читается;
+    // time хранится текстом той же длины, сравнение идет по индексу idx_event_time
+    QVector<qint64> events;
+    QHash<qint64, RatingEventState> state;
+    if (!execPrepared(q, "SELECT event_id, CAST(time AS INTEGER) FROM all_event WHERE time >= ?;", { fromTime })) return false;
+    while (q.next()) {
+        const qint64 eventId = q.value(0).toLongLong();
+        const qint64 time = q.value(1).toLongLong();
+        if (ratingBefore(time, eventId, fromTime, fromId)) continue;
+        events.append(eventId);
+        state[eventId].time = time;
+    }
+    q.finish();
+    std::sort(events.begin(), events.end(), [&state](qint64 a, qint64 b) {
+        return ratingBefore(state.value(a).time, a, state.value(b).time, b);
+    });
+    QHash<qint64, QVector<RatingEntry>> entries;
+    QVector<qint64> rated;
+    for (qint64 eventId : events) {
+        if (m_stopping) {
+            conn().lastError = "Rating calculation canceled";
+            return false;
+        }
+        // счет и участники - двумя выборками по индексам мероприятия: соединение двух
+        // представлений UNION ALL SQLite не разворачивает и читал бы их целиком
+        QHash<qint64, QPair<qint64, qint64>> scores; // участник -> баллы, ответы
+        if (!execPrepared(q, "SELECT participant_id, points, answers FROM all_participant_score WHERE event_id = ? AND answers > 0;", { eventId })) return false;
+        while (q.next()) scores.insert(q.value(0).toLongLong(), qMakePair(q.value(1).toLongLong(), q.value(2).toLongLong()));
+        q.finish();
+        if (scores.isEmpty()) continue;
+        if (!execPrepared(q, "SELECT participant_id, user_id, team_id FROM all_participant WHERE event_id = ?;", { eventId })) return false;
+        QVector<RatingEntry> list;
+        RatingEventState &totals = state[eventId];
+        while (q.next()) {
+            auto score = scores.constFind(q.value(0).toLongLong());
+            if (score == scores.constEnd()) continue;
+            RatingEntry e;
+            if (!q.value(2).isNull()) e.key = RatingKey(RatingTeam, q.value(2).toLongLong());
+            else if (!q.value(1).isNull()) e.key = RatingKey(RatingUser, q.value(1).toLongLong());
+            else continue;
+            e.points = score.value().first;
+            totals.points += score.value().first;
+            totals.answers += score.value().second;
+            list.append(e);
+        }
+        q.finish();
+        for (const RatingEntry &e : list) {
+            if (ratings.contains(e.key)) continue;
+            // текущий рейтинг тех, кого откат не затронул
+            if (!execPrepared(q, "SELECT rating, games FROM rating WHERE kind = ? AND entity_id = ?;", { e.key.first, e.key.second })) return false;
+            if (q.next()) ratings.insert(e.key, { q.value(0).toDouble(), q.value(1).toInt() });
+            q.finish();
+        }
+        // мероприятие без ответов в рейтинге не участвует
+        if (list.isEmpty()) continue;
+        entries.insert(eventId, list);
+        rated.append(eventId);
+    }
+    read.commit();
+
+    const RatingParams params = m_ratingParams;
+    QVector<RatingWrite> history;
+    rateEvents(rated, entries, params, ratings, history, &m_stopping);
+    if (m_stopping) {
+        conn().lastError = "Rating calculation canceled";
+        return false;
+    }
+    // в rating пишутся только участвовавшие хотя бы в одной игре
+    for (auto it = ratings.begin(); it != ratings.end();) {
+        if (it.value().games == 0) it = ratings.erase(it);
+        else ++it;
+    }
+
+    // блокировка на запись - только на замену хвоста истории
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+    for (const RatingKey &key : emptied) {
+        if (!execPrepared(q, "DELETE FROM rating WHERE kind = ? AND entity_id = ?;", { key.first, key.second })) return false;
+    }
+    if (!execPrepared(q, R"sql(
+            DELETE FROM rating_history WHERE event_id IN
+                (SELECT event_id FROM rating_event WHERE time > ? OR (time = ? AND event_id >= ?));
+        )sql", { fromTime, fromTime, fromId })
+        || !execPrepared(q, "DELETE FROM rating_event WHERE time > ? OR (time = ? AND event_id >= ?);", { fromTime, fromTime, fromId })) return false;
+    if (!writeRatings(rated, state, history, ratings)) return false;
+    if (!execPrepared(q, "DELETE FROM rating_dirty WHERE seq <= ?;", { dirtySeq })) return false;
+    if (!tr.commit()) return false;
+    ratedEvents = rated.size();
+    G_INFO() << "Ratings updated from event" << fromId << ":" << ratedEvents << "events," << history.size() << "changes in" << timer.elapsed() << "ms";
+    return true;
+}
+
+bool DatabaseManager::rebuildRatings(const RatingParams &params)
+{
+    QMutexLocker lock(&m_ratingMutex);
+    if (!ensureArchivesFrom(std::numeric_limits<qint64>::min())) return false;
+    QElapsedTimer timer;
+    timer.start();
+
+    // чтение - в снимке, расчет - вне транзакций: писатели ждут только запись результата
+    Transaction read(*this, Transaction::Read);
+    if (!read.isActive()) return false;
+    QHash<qint64, RatingEventState> current;
+    if (!loadRatingEvents(current)) return false;
+    // все участники одним проходом
+    QHash<qint64, QVector<RatingEntry>> entries;
+    entries.reserve(current.size());
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT participant.event_id, participant.user_id, participant.team_id, score.points
+        FROM all_participant AS participant
+        JOIN all_participant_score AS score ON score.participant_id = participant.participant_id
+        WHERE score.answers > 0;
+    )sql")) return false;
+    while (q.next()) {
+        qint64 eventId = q.value(0).toLongLong();
+        if (!current.contains(eventId)) continue;
+        RatingEntry e;
+        if (!q.value(2).isNull()) e.key = RatingKey(RatingTeam, q.value(2).toLongLong());
+        else if (!q.value(1).isNull()) e.key = RatingKey(RatingUser, q.value(1).toLongLong());
+        else continue;
+        e.points = q.value(3).toDouble();
+        entries[eventId].append(e);
+    }
+    q.finish();
+    // отметки после снимка остаются следующему updateRatings
+    if (!execPrepared(q, "SELECT IFNULL(MAX(seq), 0) FROM rating_dirty;")) return false;
+    const qint64 dirtySeq = q.next() ? q.value(0).toLongLong() : 0;
+    q.finish();
+    read.commit();
+
+    // компоненты связности: рейтинги из разных компонент друг на друга не влияют.
+    // Все участники мероприятия - физлица и команды - в одной компоненте: мероприятие
+    // рассчитывается целиком одной задачей и пишется один раз
+    QHash<RatingKey, int> node;
+    QVector<int> parent;
+    // итеративно, с сокращением пути через одного: глубина не растет с длиной истории
+    auto find = [&parent](int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+    auto nodeOf = [&](const RatingKey &key) {
+        auto it = node.constFind(key);
+        if (it != node.constEnd()) return it.value();
+        parent.append(parent.size());
+        node.insert(key, parent.size() - 1);
+        return parent.size() - 1;
+    };
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        int first = -1;
+        for (const RatingEntry &e : it.value()) {
+            int n = nodeOf(e.key);
+            if (first < 0) first = n;
+            else parent[find(n)] = find(first);
+        }
+    }
+    struct Job {
+        QVector<qint64> events;
+        QHash<RatingKey, RatingState> ratings;
+        QVector<RatingWrite> history;
+    };
+    QHash<int, int> jobOf;
+    QVector<Job> jobs;
+    QVector<qint64> events;
+    for (auto it = current.constBegin(); it != current.constEnd(); ++it) {
+        events.append(it.key());
+        const QVector<RatingEntry> list = entries.value(it.key());
+        if (list.isEmpty()) continue;
+        int root = find(node[list.first().key]);
+        if (!jobOf.contains(root)) {
+            jobOf.insert(root, jobs.size());
+            jobs.append(Job());
+        }
+        jobs[jobOf[root]].events.append(it.key());
+    }
+    // из потоков пула только чтение: value() не отделяет копию хэша
+    const QHash<qint64, RatingEventState> &state = current;
+    auto byTime = [&state](qint64 a, qint64 b) { return ratingBefore(state.value(a).time, a, state.value(b).time, b); };
+    QtConcurrent::blockingMap(jobs, [&](Job &job) {
+        std::sort(job.events.begin(), job.events.end(), byTime);
+        rateEvents(job.events, entries, params, job.ratings, job.history, &m_stopping);
+    });
+    if (m_stopping) {
+        conn().lastError = "Rating calculation canceled";
+        return false;
+    }
+
+    // запись в одной короткой транзакции: SQLite пишет последовательно
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+    if (!exec(q, "DELETE FROM rating_history;") || !exec(q, "DELETE FROM rating;") || !exec(q, "DELETE FROM rating_event;")) {
+        conn().lastError = q.lastError().text();
+        return false;
+    }
+    int changes = 0;
+    for (int i = 0; i < jobs.size(); ++i) {
+        if (!writeRatings(QVector<qint64>(), current, jobs[i].history, jobs[i].ratings)) return false;
+        changes += jobs[i].history.size();
+    }
+    if (!writeRatings(events, current, {}, {})) return false;
+    if (!execPrepared(q, "DELETE FROM rating_dirty WHERE seq <= ?;", { dirtySeq })) return false;
+    if (!tr.commit()) return false;
+    m_ratingParams = params;
+    G_INFO() << "Ratings rebuilt:" << events.size() << "events," << jobs.size() << "independent groups," << changes
+             << "changes in" << timer.elapsed() << "ms";
+    return true;
+}
+
+RatingParams DatabaseManager::ratingParams()
+{
+    QMutexLocker lock(&m_ratingMutex);
+    return m_ratingParams;
+}
+
+QVector<RatingRow> DatabaseManager::leaderboard(RatingKind kind, int limit, int offset)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT rating.kind, rating.entity_id,
+               CASE WHEN rating.kind = 1 THEN team.title
+                    ELSE TRIM("user".surname || ' ' || "user".name || ' ' || IFNULL("user".father_name, '')) END,
+               rating.rating, rating.games
+        FROM rating
+        LEFT JOIN "user" ON rating.kind = 0 AND "user".user_id = rating.entity_id
+        LEFT JOIN team ON rating.kind = 1 AND team.team_id = rating.entity_id
+        WHERE rating.kind = ? AND IFNULL("user".user_id, team.team_id) IS NOT NULL
+        ORDER BY rating.rating DESC
+        LIMIT ? OFFSET ?;
+    )sql", { int(kind), limit, offset })) return {};
+    return fetchRows<RatingRow>(q, [](const QSqlQuery &q) {
+        RatingRow r;
+        r.kind = q.value(0).toInt();
+        r.entityId = q.value(1).toLongLong();
+        r.name = q.value(2).toString();
+        r.rating = q.value(3).toDouble();
+        r.games = q.value(4).toInt();
+        return r;
+    });
+}
+
+int DatabaseManager::ratingRank(RatingKind kind, qint64 entityId)
+{
+    if (!db().isOpen() && !open()) return 0;
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT (SELECT COUNT(*) FROM rating AS other WHERE other.kind = own.kind AND other.rating > own.rating) + 1
+        FROM rating AS own WHERE own.kind = ? AND own.entity_id = ?;
+    )sql", { int(kind), entityId })) return 0;
+    int rank = q.next() ? q.value(0).toInt() : 0;
+    q.finish();
+    return rank;
+}
+
+QVector<RatingHistoryRow> DatabaseManager::ratingHistory(RatingKind kind, qint64 entityId)
+{
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT h.event_id, e.time, h.rating_before, h.rating_after
+        FROM rating_history AS h JOIN rating_event AS e ON e.event_id = h.event_id
+        WHERE h.kind = ? AND h.entity_id = ?
+        ORDER BY e.time, h.event_id;
+    )sql", { int(kind), entityId })) return {};
+    return fetchRows<RatingHistoryRow>(q, [](const QSqlQuery &q) {
+        RatingHistoryRow r;
+        r.eventId = q.value(0).toLongLong();
+        r.time = q.value(1).toLongLong();
+        r.ratingBefore = q.value(2).toDouble();
+        r.ratingAfter = q.value(3).toDouble();
+        return r;
+    });
+}
+
+void DatabaseManager::startRatingUpdates(int delayMs)
+{
+    m_ratingDelayMs = delayMs;
+    if (delayMs <= 0) {
+        m_ratingTimer->stop();
+        return;
+    }
+    m_ratingTimer->setInterval(delayMs);
+    // изменения, сделанные без программы, учитываются при запуске
+    m_ratingTimer->start();
+}
+
+bool DatabaseManager::rebuildScores()
+{
+    QElapsedTimer timer;
+    timer.start();
+    Transaction tr(*this);
+    if (!tr.isActive()) return false;
+    QSqlQuery q(db());
+    if (!exec(q, "DELETE FROM participant_score;") || !exec(q, REBUILD_SCORES_SQL)) {
+        conn().lastError = q.lastError().text();
+        G_ERROR() << "Rebuild scores failed:" << conn().lastError;
+        return false;
+    }
+    // поколение увеличили триггеры в этой же транзакции, сигнал уходит после фиксации
+    notify(RowUpdated, TableParticipantScore, 0);
+    if (!tr.commit()) return false;
+    G_INFO() << "Scores rebuilt in" << timer.elapsed() << "ms";
+    return true;
 }
 
+QVector<QuestionSearchRow> DatabaseManager::searchQuestions(const QString &query, int limit)
+{
+    // каждое слово - отдельная фраза с поиском по префиксу, спецсимволы FTS5 не интерпретируются
+    QStringList terms;
+    for (const QString &word : query.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts)) {
+        QString term = word;
+        terms << "\"" + term.replace("\"", "\"\"") + "\"*";
+    }
+    if (terms.isEmpty()) return {};
+
+    if (!db().isOpen() && !open()) return {};
+    QSqlQuery q(db());
+    if (!execPrepared(q, R"sql(
+        SELECT question.question_id, question.quiz_id, quiz.topic,
+               snippet(question_fts, -1, '[', ']', '…', 12), question_fts.rank
+        FROM question_fts
+        JOIN question ON question.question_id = question_fts.rowid
+        LEFT JOIN quiz ON quiz.quiz_id = question.quiz_id
+        WHERE question_fts MATCH ?
+        ORDER BY question_fts.rank
+        LIMIT ?;
+    )sql", {terms.join(' '), limit})) return {};
+    return fetchRows<QuestionSearchRow>(q, [](const QSqlQuery &q) {
+        QuestionSearchRow r;
+        r.questionId = q.value(0).toLongLong();
+        r.quizId = q.value(1).toLongLong();
+        r.topic = q.value(2).toString();
+        r.snippet = q.value(3).toString();
+        r.rank = q.value(4).toDouble();
+        return r;
+    });
+}
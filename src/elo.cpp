@@ -0,0 +1,41 @@
+#include "elo.h"
+#include "utils/settings.h"
+#include <QString>
+#include <cmath>
+
+RatingParams RatingParams::fromSettings()
+{
+    RatingParams p;
+    bool ok = false;
+    double initial = QString::fromStdString(Settings::getParam("rating_initial")).toDouble(&ok);
+    if (ok && initial > 0) p.initial = initial;
+    double k = QString::fromStdString(Settings::getParam("rating_k")).toDouble(&ok);
+    if (ok && k > 0) p.k = k;
+    int provisional = QString::fromStdString(Settings::getParam("rating_provisional")).toInt(&ok);
+    if (ok && provisional >= 0) p.provisionalGames = provisional;
+    return p;
+}
+
+double Elo::expected(double ratingA, double ratingB)
+{
+    return 1.0 / (1.0 + std::pow(10.0, (ratingB - ratingA) / 400.0));
+}
+
+void Elo::rateEvent(QVector<Entry> &entries, const RatingParams &params)
+{
+    const int n = entries.size();
+    for (Entry &e : entries) e.newRating = e.rating;
+    if (n < 2) return;
+    for (int i = 0; i < n; ++i) {
+        double actual = 0;
+        double expect = 0;
+        for (int j = 0; j < n; ++j) {
+            if (i == j) continue;
+            if (entries[i].points > entries[j].points) actual += 1;
+            else if (entries[i].points == entries[j].points) actual += 0.5;
+            expect += expected(entries[i].rating, entries[j].rating);
+        }
+        const double k = entries[i].games < params.provisionalGames ? 2 * params.k : params.k;
+        entries[i].newRating = entries[i].rating + k * (actual - expect) / (n - 1);
+    }
+}
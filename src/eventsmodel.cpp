@@ -1,11 +1,26 @@
 #include "eventsmodel.h"
-#include "databasemanager.h"
+#include "asyncdatabase.h"
 #include <QBrush>
 #include <QWidget>
+#include <algorithm>
+
+static Event toEvent(const EventRow &row)
+{
+    Event ev;
+    ev.id = row.eventId;
+    ev.title = row.title;
+    ev.date = QDateTime::fromSecsSinceEpoch(row.time);
+    ev.type = row.type;
+    return ev;
+}
 
 EventsModel::EventsModel(QObject *parent)
     : QAbstractTableModel(parent)
 {
+    DatabaseManager &db = DatabaseManager::instance();
+    connect(&db, &DatabaseManager::rowInserted, this, &EventsModel::onRowInserted);
+    connect(&db, &DatabaseManager::rowUpdated, this, &EventsModel::onRowUpdated);
+    connect(&db, &DatabaseManager::rowDeleted, this, &EventsModel::onRowDeleted);
 }
 
 int EventsModel::rowCount(const QModelIndex &parent) const
@@ -67,33 +82,175 @@ Qt::ItemFlags EventsModel::flags(const QModelIndex &index) const
     return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
 }
 
-void EventsModel::loadSampleData()
+bool EventsModel::canFetchMore(const QModelIndex &parent) const
 {
-    beginResetModel();
-    m_events.clear();
+    if (parent.isValid())
+        return false;
+    return m_hasMore && !m_loading;
+}
 
-    DatabaseManager& bd = DatabaseManager::instance();
-    QSqlDatabase db = bd.database(); // метод, возвращающий QSqlDatabase
+void EventsModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+    m_loading = true;
+    PageKey after = m_lastKey;
+    auto sort = m_sort;
+    auto order = m_order;
+    QString filter = m_filter;
+    auto future = AsyncDatabase::instance().submit("events", [=](DatabaseManager& bd) {
+        return bd.listEventsPage(after, PAGE_SIZE, sort, order, filter);
+    });
+    AsyncDatabase::then(this, future, [this](const QVector<EventRow>& rows) {
+        if (!rows.isEmpty()) {
+            beginInsertRows(QModelIndex(), m_events.size(), m_events.size() + rows.size() - 1);
+            appendPage(rows);
+            endInsertRows();
+        } else {
+            m_hasMore = false;
+        }
+        m_loading = false;
+    });
+}
 
-    QSqlQuery query(db);
-    if (!query.exec("SELECT event_id, title, time, quiz_id, type FROM event")) {
-        qWarning() << "Failed to load events:" << query.lastError().text();
-        endResetModel();
+void EventsModel::sort(int column, Qt::SortOrder order)
+{
+    static const DatabaseManager::EventSort columns[] = {
+        DatabaseManager::EventSortId, DatabaseManager::EventSortTitle,
+        DatabaseManager::EventSortTime, DatabaseManager::EventSortType
+    };
+    if (column < 0 || column >= columnCount())
         return;
-    }
+    m_sort = columns[column];
+    m_order = order;
+    loadSampleData();
+}
 
-    while (query.next()) {
-        Event ev;
-        ev.id = query.value("event_id").toInt();
-        ev.title = query.value("title").toString();
-        //ev.date = QDateTime::fromString(query.value("time").toString(), "yyyy-MM-dd");
-        ev.date = QDateTime::fromSecsSinceEpoch(query.value("time").toLongLong());
-        ev.type = query.value("type").toInt(); // если тип зависит от quiz_id
+void EventsModel::setFilter(const QString &filter)
+{
+    m_filter = filter;
+    loadSampleData();
+}
 
-        m_events.append(ev);
+void EventsModel::appendPage(const QVector<EventRow> &rows)
+{
+    m_events.reserve(m_events.size() + rows.size());
+    for (const EventRow &row : rows) {
+        // строка могла уже прийти через уведомление о вставке
+        if (rowOfId(row.eventId) < 0) m_events.append(toEvent(row));
     }
+    if (!rows.isEmpty()) m_lastKey = DatabaseManager::eventPageKey(rows.last(), m_sort);
+    m_hasMore = rows.size() == PAGE_SIZE;
+}
+
+void EventsModel::loadSampleData()
+{
+    // Читаем первую страницу в потоке БД, остальные - через fetchMore при прокрутке
+    m_loading = true;
+    auto sort = m_sort;
+    auto order = m_order;
+    QString filter = m_filter;
+    auto future = AsyncDatabase::instance().submit("events", [=](DatabaseManager& bd) {
+        return bd.listEventsPage(PageKey(), PAGE_SIZE, sort, order, filter);
+    });
+    AsyncDatabase::then(this, future, [this](const QVector<EventRow>& rows) {
+        beginResetModel();
+        m_events.clear();
+        m_lastKey = PageKey();
+        appendPage(rows);
+        m_loading = false;
+        endResetModel();
+    });
+}
 
-    endResetModel();
+int EventsModel::rowOfId(qint64 id) const
+{
+    for (int i = 0; i < m_events.size(); ++i)
+        if (m_events[i].id == id) return i;
+    return -1;
+}
+
+bool EventsModel::lessThan(const Event &a, const Event &b) const
+{
+    // тот же порядок, что и в listEventsPage: колонка сортировки, затем id
+    auto key = [this](const Event &e) -> QVariant {
+        switch (m_sort) {
+        case DatabaseManager::EventSortTitle: return e.title;
+        case DatabaseManager::EventSortTime: return e.date.toSecsSinceEpoch();
+        case DatabaseManager::EventSortType: return e.type;
+        default: return e.id;
+        }
+    };
+    QVariant ka = key(a), kb = key(b);
+    bool less = ka == kb ? a.id < b.id
+              : (m_sort == DatabaseManager::EventSortTitle ? ka.toString() < kb.toString() : ka.toLongLong() < kb.toLongLong());
+    return m_order == Qt::AscendingOrder ? less : !less && a.id != b.id;
+}
+
+void EventsModel::placeEvent(const EventRow &row)
+{
+    if (!m_filter.isEmpty() && !DatabaseManager::matchesFilter(row.title, m_filter))
+        return;
+    Event ev = toEvent(row);
+    int pos = std::lower_bound(m_events.begin(), m_events.end(), ev,
+                               [this](const Event &a, const Event &b) { return lessThan(a, b); }) - m_events.begin();
+    // строка за последней загруженной придет со следующей страницей
+    if (pos == m_events.size() && m_hasMore)
+        return;
+    beginInsertRows(QModelIndex(), pos, pos);
+    m_events.insert(pos, ev);
+    endInsertRows();
+}
+
+void EventsModel::onRowInserted(DatabaseManager::Table table, qint64 id)
+{
+    if (table != DatabaseManager::TableEvent)
+        return;
+    auto future = AsyncDatabase::instance().submit(QString(), [id](DatabaseManager& bd) {
+        return bd.getEventRow(id);
+    });
+    AsyncDatabase::then(this, future, [this](const EventRow& row) {
+        if (row.eventId != 0 && rowOfId(row.eventId) < 0) placeEvent(row);
+    });
+}
+
+void EventsModel::onRowUpdated(DatabaseManager::Table table, qint64 id)
+{
+    if (table != DatabaseManager::TableEvent || rowOfId(id) < 0)
+        return;
+    auto future = AsyncDatabase::instance().submit(QString(), [id](DatabaseManager& bd) {
+        return bd.getEventRow(id);
+    });
+    AsyncDatabase::then(this, future, [this, id](const EventRow& row) {
+        int r = rowOfId(id);
+        if (r < 0 || row.eventId == 0)
+            return;
+        Event ev = toEvent(row);
+        bool inPlace = (r == 0 || !lessThan(ev, m_events[r - 1]))
+                    && (r == m_events.size() - 1 || !lessThan(m_events[r + 1], ev));
+        if (inPlace) {
+            m_events[r] = ev;
+            emit dataChanged(index(r, 0), index(r, columnCount() - 1));
+        } else {
+            // изменилось значение колонки сортировки - переставляем строку
+            beginRemoveRows(QModelIndex(), r, r);
+            m_events.removeAt(r);
+            endRemoveRows();
+            placeEvent(row);
+        }
+    });
+}
+
+void EventsModel::onRowDeleted(DatabaseManager::Table table, qint64 id)
+{
+    if (table != DatabaseManager::TableEvent)
+        return;
+    int r = rowOfId(id);
+    if (r < 0)
+        return;
+    beginRemoveRows(QModelIndex(), r, r);
+    m_events.removeAt(r);
+    endRemoveRows();
 }
 
 bool EventsModel::addEvent(const Event& ev, int quizId)
@@ -1,6 +1,142 @@
 #include "exporthelper.h"
 #include <QApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPointer>
+#include <QProgressDialog>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+#include <array>
+#include <atomic>
+#include <memory>
 #include "databasemanager.h"
+#include "asyncdatabase.h"
+#include "unilog/unilog.h"
+
+namespace {
+
+quint32 crc32(quint32 crc, const char *data, int size)
+{
+    static const auto table = []() {
+        std::array<quint32, 256> t{};
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (int i = 0; i < size; ++i) crc = table[(crc ^ quint8(data[i])) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void appendLe32(QByteArray &out, quint32 v)
+{
+    for (int i = 0; i < 4; ++i) out.append(char((v >> (8 * i)) & 0xFF));
+}
+
+/**
+ * Буферизованная запись в файл. В режиме gzip каждый сброс буфера - отдельный член gzip
+ * (RFC 1952 допускает их склейку, gunzip и zlib читают такой файл как один поток).
+ * Deflate берется из qCompress: у его результата отрезаются длина и обертка zlib.
+ */
+class BufferedWriter
+{
+public:
+    BufferedWriter(QFile &file, bool gzip) : m_file(file), m_gzip(gzip)
+    {
+        m_buffer.reserve(ExportHelper::BUFFER_SIZE + 4096);
+    }
+
+    bool write(const QByteArray &data)
+    {
+        m_buffer.append(data);
+        return m_buffer.size() < ExportHelper::BUFFER_SIZE || flush();
+    }
+
+    bool flush()
+    {
+        if (m_buffer.isEmpty()) return true;
+        bool ok = m_gzip ? writeMember() : m_file.write(m_buffer) == m_buffer.size();
+        m_buffer.clear();
+        return ok;
+    }
+
+private:
+    bool writeMember()
+    {
+        QByteArray z = qCompress(m_buffer, 6);
+        // 4 байта длины qCompress, 2 байта заголовка zlib, в конце 4 байта adler32
+        if (z.size() < 10) return false;
+        QByteArray member;
+        member.reserve(z.size() + 8);
+        member.append("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10);
+        member.append(z.constData() + 6, z.size() - 10);
+        appendLe32(member, crc32(0, m_buffer.constData(), m_buffer.size()));
+        appendLe32(member, quint32(m_buffer.size()));
+        return m_file.write(member) == member.size();
+    }
+
+    QFile &m_file;
+    bool m_gzip;
+    QByteArray m_buffer;
+};
+
+const QStringList ANSWER_COLUMNS = {
+    "result_id", "event_id", "event_title", "event_time", "quiz_id", "topic",
+    "participant_id", "number", "user_id", "surname", "name", "father_name",
+    "team_id", "team_title", "question_id", "question_text", "points", "result"
+};
+
+QString csvField(const QString &value)
+{
+    if (!value.contains(',') && !value.contains('"') && !value.contains('\n') && !value.contains('\r')) return value;
+    return '"' + QString(value).replace('"', "\"\"") + '"';
+}
+
+QString isoTime(qint64 secs)
+{
+    return QDateTime::fromSecsSinceEpoch(secs, Qt::UTC).toString(Qt::ISODate);
+}
+
+QByteArray csvLine(const AnswerExportRow &r)
+{
+    const QStringList fields = {
+        QString::number(r.resultId), QString::number(r.eventId), csvField(r.eventTitle), isoTime(r.eventTime),
+        QString::number(r.quizId), csvField(r.topic), QString::number(r.participantId), QString::number(r.number),
+        r.userId ? QString::number(r.userId) : QString(), csvField(r.surname), csvField(r.name), csvField(r.fatherName),
+        r.teamId ? QString::number(r.teamId) : QString(), csvField(r.teamTitle),
+        QString::number(r.questionId), csvField(r.questionText), QString::number(r.points), QString::number(r.result)
+    };
+    return (fields.join(',') + "\r\n").toUtf8();
+}
+
+QByteArray jsonLine(const AnswerExportRow &r)
+{
+    QJsonObject o;
+    o.insert("result_id", r.resultId);
+    o.insert("event_id", r.eventId);
+    o.insert("event_title", r.eventTitle);
+    o.insert("event_time", isoTime(r.eventTime));
+    o.insert("quiz_id", r.quizId);
+    o.insert("topic", r.topic);
+    o.insert("participant_id", r.participantId);
+    o.insert("number", r.number);
+    o.insert("user_id", r.userId ? QJsonValue(r.userId) : QJsonValue());
+    o.insert("surname", r.surname);
+    o.insert("name", r.name);
+    o.insert("father_name", r.fatherName);
+    o.insert("team_id", r.teamId ? QJsonValue(r.teamId) : QJsonValue());
+    o.insert("team_title", r.teamTitle);
+    o.insert("question_id", r.questionId);
+    o.insert("question_text", r.questionText);
+    o.insert("points", r.points);
+    o.insert("result", r.result);
+    return QJsonDocument(o).toJson(QJsonDocument::Compact) + '\n';
+}
+
+} // namespace
 
 bool ExportHelper::exportQuiz(quint64 id, QWidget *parent)
 {
@@ -30,13 +166,12 @@ bool ExportHelper::exportQuiz(quint64 id, QWidget *parent)
 
     // Остальные страницы
     QString templ = readFile(templateDir.filePath("template1.html"));
-    DatabaseManager* db = &DatabaseManager::instance();
-    auto quiz = db->getQuiz(id);
-    QString quizName = quiz["topic"].toString();
-    int quizTimer = quiz["timer"].toInt();
+    QuizGraph graph = DatabaseManager::instance().loadQuizGraph(id);
+    QString quizName = graph.quiz.topic;
+    int quizTimer = graph.quiz.timer;
     int questionNumber = 1;
-    QVector<QVariantMap> questions = db->listQuestionsByQuiz(id);
-    for(auto& q : questions) {
+    for(auto& item : graph.questions) {
+        const QuestionRow& q = item.question;
         QString s = QString("<script>"
             "const sample = {"
             "id: \"Q-%1\","
@@ -47,12 +182,12 @@ bool ExportHelper::exportQuiz(quint64 id, QWidget *parent)
             "text: \"%5\","
             "correct_id: \"%6\","
             "next_href: \"%7.html\","
-            "options: [").arg(questionNumber).arg(quizName).arg(q["points"].toString())
-            .arg(quizTimer).arg(q["text"].toString()).arg(q["answer"].toString().arg(questionNumber+1));
+            "options: [").arg(questionNumber).arg(quizName).arg(q.points)
+            .arg(quizTimer).arg(q.text).arg(q.answer).arg(questionNumber+1);
             int answerNumber = 1;
-            for(auto& a : db->listAnswersByQuestion(q["question_id"].toInt())) {
+            for(auto& a : item.answers) {
                 if(answerNumber != 1) s += ",";
-                s += QString("{id: \"%1\", text: \"%2\"}").arg(answerNumber).arg(a["text"].toString());
+                s += QString("{id: \"%1\", text: \"%2\"}").arg(answerNumber).arg(a.text);
                 answerNumber++;
             }
         s += QString("]"
@@ -87,3 +222,96 @@ bool ExportHelper::writeFile(const QString &filePath, const QString &content) {
     file.close();
     return true;
 }
+
+ExportHelper::Result ExportHelper::exportAnswers(DatabaseManager &db, const QString &path, Format format, bool gzip,
+                                                 const AnswerExportFilter &filter, Progress progress)
+{
+    Result res;
+    const QString part = path + ".part";
+    QFile file(part);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        res.error = file.errorString();
+        return res;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    BufferedWriter writer(file, gzip);
+    bool written = format == Csv ? writer.write((ANSWER_COLUMNS.join(',') + "\r\n").toUtf8()) : true;
+    bool ok = written && db.forEachAnswerRow(filter, [&](const AnswerExportRow &row) {
+        if (!writer.write(format == Csv ? csvLine(row) : jsonLine(row))) {
+            written = false;
+            return false;
+        }
+        ++res.rows;
+        if (progress && res.rows % PROGRESS_ROWS == 0 && !progress(res.rows)) {
+            res.canceled = true;
+            return false;
+        }
+        return true;
+    });
+    written = written && writer.flush();
+    if (!written) {
+        res.error = file.errorString();
+    } else if (!ok && !res.canceled) {
+        // при отмене lastError - чужая ошибка от прошлого запроса соединения
+        res.error = db.lastError();
+    }
+    file.close();
+    if (res.canceled || !res.error.isEmpty()) {
+        QFile::remove(part);
+        return res;
+    }
+    QFile::remove(path);
+    if (!QFile::rename(part, path)) {
+        res.error = QString("Не удалось переименовать %1").arg(part);
+        QFile::remove(part);
+        return res;
+    }
+    res.ok = true;
+    res.bytes = QFileInfo(path).size();
+    G_INFO() << "Export" << path << ":" << res.rows << "rows," << res.bytes << "bytes in" << timer.elapsed() << "ms";
+    return res;
+}
+
+void ExportHelper::exportAnswersDialog(const AnswerExportFilter &filter, QWidget *parent)
+{
+    QString selected;
+    QString path = QFileDialog::getSaveFileName(parent,
+                                                "Выгрузка ответов",
+                                                QDir::home().filePath("answers.csv"),
+                                                "CSV (*.csv);;CSV gzip (*.csv.gz);;JSON Lines (*.jsonl);;JSON Lines gzip (*.jsonl.gz)",
+                                                &selected);
+    if (path.isEmpty()) return;
+    const bool gzip = path.endsWith(".gz", Qt::CaseInsensitive) || selected.contains("gzip");
+    if (gzip && !path.endsWith(".gz", Qt::CaseInsensitive)) path += ".gz";
+    const QString base = gzip ? path.left(path.size() - 3) : path;
+    const Format format = base.endsWith(".jsonl", Qt::CaseInsensitive) || base.endsWith(".ndjson", Qt::CaseInsensitive)
+                          || selected.startsWith("JSON") ? JsonLines : Csv;
+
+    auto *dialog = new QProgressDialog("Выгрузка...", "Отмена", 0, 0, parent);
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->setMinimumDuration(0);
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    QObject::connect(dialog, &QProgressDialog::canceled, dialog, [cancel]() { *cancel = true; });
+
+    // длинное чтение идет на своем соединении в пуле потоков, а не в очереди AsyncDatabase
+    QPointer<QProgressDialog> guard(dialog);
+    QFuture<Result> future = QtConcurrent::run([path, format, gzip, filter, cancel, guard]() {
+        return exportAnswers(DatabaseManager::instance(), path, format, gzip, filter, [cancel, guard](qint64 rows) {
+            QMetaObject::invokeMethod(qApp, [guard, rows]() {
+                if (guard) guard->setLabelText(QString("Выгружено строк: %1").arg(rows));
+            }, Qt::QueuedConnection);
+            return !*cancel && !DatabaseManager::instance().isStopping();
+        });
+    });
+    AsyncDatabase::then(dialog, future, [dialog, parent, path](const Result &res) {
+        dialog->close();
+        dialog->deleteLater();
+        if (res.canceled) return;
+        if (!res.ok) {
+            QMessageBox::critical(parent, "Ошибка выгрузки", res.error);
+            return;
+        }
+        QMessageBox::information(parent, "Готово", QString("Выгружено строк: %1\n%2").arg(res.rows).arg(path));
+    });
+}
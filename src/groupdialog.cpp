@@ -106,8 +106,12 @@ void GroupDialog::setGroup(const Group& g) {
 
     auto members = bd.listTeamUsers(m_groupId);
     qDebug() << members.size();
-    for (const auto& member : members) {
-        auto user = bd.getUser(member["user_id"].toInt());
+    QVector<qint64> userIds;
+    for (const auto& member : members) userIds.append(member["user_id"].toLongLong());
+    const auto users = bd.getUsers(userIds);
+    for (int i = 0; i < members.size(); ++i) {
+        const auto& member = members[i];
+        const auto& user = users[i];
         QStandardItem* it = new QStandardItem(user["surname"].toString() + " "
                                             + user["name"].toString() + " "
                                               + user["father_name"].toString());
@@ -179,31 +183,25 @@ void GroupDialog::onAccept() {
     if (m_nameEdit->text().trimmed().isEmpty()) return;
 
     DatabaseManager &bd = DatabaseManager::instance();
-    if (m_groupId < 0) {
+    // команда и ее состав сохраняются одной транзакцией
+    DatabaseManager::Transaction tr(bd);
+    int groupId = m_groupId;
+    if (groupId < 0) {
         qint64 newG;
         if (!bd.addTeam(m_nameEdit->text().trimmed(), newG)) {
             reject();
             return;
         }
-        m_groupId = (int)newG;
+        groupId = (int)newG;
     } else {
-        bd.updateTeam(m_groupId, m_nameEdit->text().trimmed());
+        bd.updateTeam(groupId, m_nameEdit->text().trimmed());
     }
 
-    QVector<QVariantMap> cur = bd.listTeamUsers(m_groupId);
-    QSet<int> curSet;
-    for (const auto &r : cur) curSet.insert(r.value("user_id").toInt());
-
-    QSet<int> newSet = QSet<int>::fromList(m_memberIds);
-
-    // удалить лишних
-    for (int uid : curSet) {
-        if (!newSet.contains(uid)) bd.removeTeamUser(uid, m_groupId);
-    }
-    // добавить новых
-    for (int uid : newSet) {
-        if (!curSet.contains(uid)) bd.addTeamUser(uid, m_groupId);
+    if (!bd.syncTeamUsers(groupId, QSet<int>::fromList(m_memberIds)) || !tr.commit()) {
+        reject();
+        return;
     }
+    m_groupId = groupId;
 
     accept();
 }
@@ -64,14 +64,9 @@ GroupManagerWidget::GroupManagerWidget(QWidget* parent)
 }
 
 void GroupManagerWidget::onCreateGroup() {
-    DatabaseManager& bd = DatabaseManager::instance();
-    auto users = bd.listUsers();
     GroupDialog dlg(m_peopleModel, this);
-    if (dlg.exec() == QDialog::Accepted) {
-        Group g = dlg.resultGroup();
-        // Уже добавлен в БД внутри dialog (см. onAccept). Просто обновим модель.
-        m_groupsModel->refreshFromDatabase();
-    }
+    // группа сохраняется в БД в dialog::onAccept, модель получит уведомление
+    dlg.exec();
 }
 
 void GroupManagerWidget::onEditGroup() {
@@ -82,10 +77,8 @@ void GroupManagerWidget::onEditGroup() {
 
     GroupDialog dlg(m_peopleModel, this);
     dlg.setGroup(g);
-    if (dlg.exec() == QDialog::Accepted) {
-        // изменения уже применены в БД в dialog::onAccept
-        m_groupsModel->refreshFromDatabase();
-    }
+    // изменения применяются в БД в dialog::onAccept, модель получит уведомление
+    dlg.exec();
 }
 
 void GroupManagerWidget::onDeleteGroup() {
@@ -96,9 +89,7 @@ void GroupManagerWidget::onDeleteGroup() {
     auto ret = QMessageBox::question(this, "Удалить группу", QString("Удалить группу \"%1\"?").arg(g.name));
     if (ret != QMessageBox::Yes) return;
     DatabaseManager &bd = DatabaseManager::instance();
-    if (bd.removeTeam(g.groupId)) {
-        m_groupsModel->refreshFromDatabase();
-    } else {
+    if (!bd.removeTeam(g.groupId)) {
         QMessageBox::warning(this, "Ошибка", "Не удалось удалить группу (БД).");
     }
 }
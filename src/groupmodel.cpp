@@ -5,6 +5,10 @@ GroupsModel::GroupsModel(QObject* parent)
     : QAbstractListModel(parent)
 {
     refreshFromDatabase();
+    DatabaseManager &db = DatabaseManager::instance();
+    connect(&db, &DatabaseManager::rowInserted, this, &GroupsModel::onRowInserted);
+    connect(&db, &DatabaseManager::rowUpdated, this, &GroupsModel::onRowUpdated);
+    connect(&db, &DatabaseManager::rowDeleted, this, &GroupsModel::onRowDeleted);
 }
 
 int GroupsModel::rowCount(const QModelIndex &parent) const {
@@ -41,7 +45,7 @@ void GroupsModel::refreshFromDatabase() {
         g.groupId = gmap.value("team_id").toInt();
         g.name = gmap.value("title").toString();
         // load members
-        QVector<QVariantMap> members = bd.listTeamMembers(g.groupId);
+        QVector<QVariantMap> members = bd.listTeamUsers(g.groupId);
         for (const auto &m : members) g.memberIds.append(m.value("user_id").toInt());
         m_groups.append(g);
     }
@@ -73,3 +77,38 @@ void GroupsModel::removeGroupAtRow(int row) {
     m_groups.removeAt(row);
     endRemoveRows();
 }
+
+Group GroupsModel::loadGroup(qint64 groupId) const {
+    DatabaseManager &bd = DatabaseManager::instance();
+    Group g;
+    QVariantMap team = bd.getTeam(groupId);
+    if (team.isEmpty()) return g;
+    g.groupId = groupId;
+    g.name = team.value("title").toString();
+    for (const auto &m : bd.listTeamUsers(groupId)) g.memberIds.append(m.value("user_id").toInt());
+    return g;
+}
+
+void GroupsModel::onRowInserted(DatabaseManager::Table table, qint64 id) {
+    if (table != DatabaseManager::TableTeam || rowOfGroupId(id) >= 0) return;
+    Group g = loadGroup(id);
+    if (g.groupId >= 0) addGroupToModel(g);
+}
+
+void GroupsModel::onRowUpdated(DatabaseManager::Table table, qint64 id) {
+    if (table != DatabaseManager::TableTeam) return;
+    int row = rowOfGroupId(id);
+    if (row < 0) {
+        onRowInserted(table, id);
+        return;
+    }
+    Group g = loadGroup(id);
+    if (g.groupId < 0) return;
+    m_groups[row] = g;
+    emit dataChanged(index(row), index(row));
+}
+
+void GroupsModel::onRowDeleted(DatabaseManager::Table table, qint64 id) {
+    if (table != DatabaseManager::TableTeam) return;
+    removeGroupAtRow(rowOfGroupId(id));
+}
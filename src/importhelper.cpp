@@ -0,0 +1,405 @@
+#include "importhelper.h"
+#include "databasemanager.h"
+#include "asyncdatabase.h"
+#include "unilog/unilog.h"
+#include <QApplication>
+#include <QFile>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QMessageBox>
+#include <QPointer>
+#include <QProgressDialog>
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <QSet>
+#include <atomic>
+#include <memory>
+
+namespace {
+
+// Колонки CSV по умолчанию, заголовок с такими именами меняет порядок
+const QStringList USER_COLUMNS = { "surname", "name", "father_name" };
+const QStringList QUESTION_COLUMNS = { "topic", "timer", "text", "points", "answer" };
+
+/**
+ * Разбор строки CSV с кавычками. complete = false - поле в кавычках продолжается на следующей строке.
+ */
+QStringList parseCsv(const QString &text, QChar delimiter, bool &complete)
+{
+    QStringList fields;
+    QString field;
+    bool quoted = false;
+    for (int i = 0; i < text.size(); ++i) {
+        QChar c = text[i];
+        if (quoted) {
+            if (c == '"') {
+                if (i + 1 < text.size() && text[i + 1] == '"') {
+                    field += '"';
+                    ++i;
+                } else {
+                    quoted = false;
+                }
+            } else {
+                field += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == delimiter) {
+            fields << field;
+            field.clear();
+        } else {
+            field += c;
+        }
+    }
+    fields << field;
+    complete = !quoted;
+    return fields;
+}
+
+/**
+ * Чтение файла по записям: файл целиком в память не загружается
+ */
+class RecordReader
+{
+public:
+    RecordReader(QFile &file, bool json) : m_file(file), m_json(json)
+    {
+        if (m_file.peek(3) == "\xEF\xBB\xBF") m_file.read(3);
+        if (!json) {
+            QByteArray first = m_file.peek(4096);
+            first.truncate(first.indexOf('\n') < 0 ? first.size() : first.indexOf('\n'));
+            m_delimiter = first.count(';') >= first.count(',') ? ';' : ',';
+        }
+    }
+
+    // следующая непустая запись; line - номер ее первой строки в файле
+    bool next(QVariantMap &record, const QStringList &columns, QString &error, qint64 &line)
+    {
+        QString text;
+        while (!m_file.atEnd()) {
+            QString chunk = QString::fromUtf8(m_file.readLine());
+            ++m_line;
+            if (text.isEmpty()) {
+                line = m_line;
+                if (chunk.trimmed().isEmpty()) continue;
+            }
+            text += chunk;
+            if (m_json) return parseJson(text, record, error);
+            bool complete = true;
+            QStringList fields = parseCsv(stripEol(text), m_delimiter, complete);
+            if (!complete && !m_file.atEnd()) continue;
+            return mapCsv(fields, columns, record, error);
+        }
+        return false;
+    }
+
+private:
+    static QString stripEol(const QString &s)
+    {
+        int n = s.size();
+        while (n > 0 && (s[n - 1] == '\n' || s[n - 1] == '\r')) --n;
+        return s.left(n);
+    }
+
+    bool parseJson(const QString &text, QVariantMap &record, QString &error)
+    {
+        QJsonParseError parseError;
+        QJsonDocument doc = QJsonDocument::fromJson(text.toUtf8(), &parseError);
+        if (!doc.isObject()) {
+            error = parseError.error != QJsonParseError::NoError ? parseError.errorString() : "Ожидается объект JSON";
+            record.clear();
+        } else {
+            record = doc.object().toVariantMap();
+        }
+        return true;
+    }
+
+    bool mapCsv(QStringList fields, const QStringList &columns, QVariantMap &record, QString &error)
+    {
+        record.clear();
+        for (QString &f : fields) f = f.trimmed();
+        // первая запись из известных имен колонок - заголовок
+        if (!m_headerChecked) {
+            m_headerChecked = true;
+            bool header = fields.size() >= 2;
+            for (const QString &f : fields) header &= columns.contains(f.toLower()) || f.toLower() == "answers";
+            if (header) {
+                m_columns.clear();
+                for (const QString &f : fields) m_columns << f.toLower();
+                error = QString(); // заголовок пропускается
+                record.insert("__header", true);
+                return true;
+            }
+        }
+        const QStringList &names = m_columns.isEmpty() ? columns : m_columns;
+        QStringList rest;
+        for (int i = 0; i < fields.size(); ++i) {
+            if (i < names.size() && names[i] != "answers") record.insert(names[i], fields[i]);
+            else if (!fields[i].isEmpty()) rest << fields[i];
+        }
+        // лишние колонки - варианты ответа
+        if (!rest.isEmpty()) record.insert("answers", rest);
+        return true;
+    }
+
+    QFile &m_file;
+    bool m_json;
+    QChar m_delimiter = ';';
+    qint64 m_line = 0;
+    bool m_headerChecked = false;
+    QStringList m_columns;
+};
+
+QString userKey(const QString &surname, const QString &name, const QString &fatherName)
+{
+    return surname.toLower() + QChar(0x1f) + name.toLower() + QChar(0x1f) + fatherName.toLower();
+}
+
+enum Outcome { Inserted, Duplicate, Invalid, Failed };
+
+/**
+ * Физлица: дубли ищутся по хэшу фамилия/имя/отчество без учета регистра
+ */
+class UserSink
+{
+public:
+    explicit UserSink(DatabaseManager &db) : m_db(db)
+    {
+        const auto users = db.listUserRows();
+        m_index.reserve(users.size());
+        for (const UserRow &u : users) m_index.insert(userKey(u.surname.simplified(), u.name.simplified(), u.fatherName.simplified()), u.userId);
+    }
+
+    Outcome add(const QVariantMap &r, QString &error)
+    {
+        QString surname = r.value("surname").toString().simplified();
+        QString name = r.value("name").toString().simplified();
+        QString fatherName = r.value("father_name").toString().simplified();
+        if (surname.isEmpty() || name.isEmpty()) {
+            error = "Не заполнены фамилия или имя";
+            return Invalid;
+        }
+        if (surname.size() > 100 || name.size() > 100 || fatherName.size() > 100) {
+            error = "Слишком длинное значение";
+            return Invalid;
+        }
+        QString key = userKey(surname, name, fatherName);
+        if (m_index.contains(key)) return Duplicate;
+        qint64 id;
+        if (!m_db.addUser(surname, name, fatherName, id)) {
+            error = m_db.lastError();
+            return Failed;
+        }
+        m_index.insert(key, id);
+        return Inserted;
+    }
+
+private:
+    DatabaseManager &m_db;
+    QHash<QString, qint64> m_index;
+};
+
+/**
+ * Вопросы: квиз по теме, дубль - вопрос с тем же текстом в том же квизе
+ */
+class QuestionSink
+{
+public:
+    explicit QuestionSink(DatabaseManager &db) : m_db(db)
+    {
+        for (const QuizRow &q : db.listQuizRows()) m_quizzes.insert(q.topic.simplified().toLower(), q.quizId);
+    }
+
+    Outcome add(const QVariantMap &r, QString &error)
+    {
+        QString topic = r.value("topic").toString().simplified();
+        QString text = r.value("text").toString().simplified();
+        QStringList answers;
+        for (const QVariant &a : r.value("answers").toList()) {
+            QString s = a.toString().simplified();
+            if (!s.isEmpty()) answers << s;
+        }
+        bool ok = true;
+        int timer = r.contains("timer") && !r.value("timer").toString().isEmpty() ? r.value("timer").toInt(&ok) : 30;
+        bool okPoints = true;
+        int points = r.contains("points") && !r.value("points").toString().isEmpty() ? r.value("points").toInt(&okPoints) : 1;
+        bool okAnswer = true;
+        int answer = r.value("answer").toInt(&okAnswer);
+        // те же правила, что в QuestionWidget
+        if (topic.isEmpty()) error = "Не указана тема квиза";
+        else if (text.size() < 5) error = "Текст вопроса короче 5 символов";
+        else if (answers.size() < 3) error = "Меньше трех вариантов ответа";
+        else if (!ok || timer <= 0) error = "Неверный таймер";
+        else if (!okPoints || points < 0) error = "Неверное число баллов";
+        else if (!okAnswer || answer < 1 || answer > answers.size()) error = "Номер правильного ответа вне списка";
+        if (!error.isEmpty()) return Invalid;
+
+        QString topicKey = topic.toLower();
+        qint64 quizId = m_quizzes.value(topicKey);
+        if (quizId == 0) {
+            if (!m_db.addQuiz(topic, timer, quizId)) {
+                error = m_db.lastError();
+                return Failed;
+            }
+            m_quizzes.insert(topicKey, quizId);
+            m_questions.insert(quizId, {});
+        } else if (!m_questions.contains(quizId)) {
+            QSet<QString> &texts = m_questions[quizId];
+            for (const QuestionRow &q : m_db.listQuestionRowsByQuiz(quizId)) texts.insert(q.text.simplified().toLower());
+        }
+        QSet<QString> &texts = m_questions[quizId];
+        if (texts.contains(text.toLower())) return Duplicate;
+
+        qint64 questionId, answerId;
+        if (!m_db.addQuestion(quizId, text, points, answer, questionId)) {
+            error = m_db.lastError();
+            return Failed;
+        }
+        for (const QString &a : answers) {
+            if (!m_db.addAnswer(questionId, a, answerId)) {
+                error = m_db.lastError();
+                return Failed;
+            }
+        }
+        texts.insert(text.toLower());
+        return Inserted;
+    }
+
+private:
+    DatabaseManager &m_db;
+    QHash<QString, qint64> m_quizzes;
+    QHash<qint64, QSet<QString>> m_questions;
+};
+
+template<typename Sink>
+void run(DatabaseManager &db, Sink &sink, RecordReader &reader, const QStringList &columns,
+         QFile &file, ImportHelper::Progress progress, ImportHelper::Result &res)
+{
+    auto addError = [&res](qint64 line, const QString &message) {
+        ++res.failed;
+        if (res.errors.size() < ImportHelper::MAX_ERRORS) res.errors.append({line, message});
+    };
+    const qint64 total = file.size();
+    auto tr = std::make_unique<DatabaseManager::Transaction>(db);
+    if (!tr->isActive()) {
+        res.error = db.lastError();
+        return;
+    }
+    int inBatch = 0;
+    QVariantMap record;
+    QString error;
+    qint64 line = 0;
+    while (reader.next(record, columns, error, line)) {
+        if (record.contains("__header")) continue;
+        ++res.rows;
+        if (!error.isEmpty()) {
+            addError(line, error);
+            error.clear();
+            continue;
+        }
+        switch (sink.add(record, error)) {
+        case Inserted: ++res.inserted; break;
+        case Duplicate: ++res.duplicates; break;
+        case Invalid: addError(line, error); break;
+        case Failed:
+            res.error = QString("Строка %1: %2").arg(line).arg(error);
+            return;
+        }
+        error.clear();
+        // пакет: одна транзакция на BATCH_SIZE записей
+        if (++inBatch >= ImportHelper::BATCH_SIZE) {
+            if (!tr->commit()) {
+                res.error = db.lastError();
+                return;
+            }
+            if (progress && !progress(file.pos(), total)) {
+                res.canceled = true;
+                return;
+            }
+            tr = std::make_unique<DatabaseManager::Transaction>(db);
+            if (!tr->isActive()) {
+                res.error = db.lastError();
+                return;
+            }
+            inBatch = 0;
+        }
+    }
+    if (!tr->commit()) {
+        res.error = db.lastError();
+        return;
+    }
+    if (progress) progress(total, total);
+    res.ok = true;
+}
+
+} // namespace
+
+ImportHelper::Result ImportHelper::importFile(DatabaseManager &db, Kind kind, const QString &path, Progress progress)
+{
+    Result res;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        res.error = file.errorString();
+        return res;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    const bool json = suffix == "jsonl" || suffix == "ndjson" || suffix == "json";
+    RecordReader reader(file, json);
+    if (kind == Users) {
+        UserSink sink(db);
+        run(db, sink, reader, USER_COLUMNS, file, progress, res);
+    } else {
+        QuestionSink sink(db);
+        run(db, sink, reader, QUESTION_COLUMNS, file, progress, res);
+    }
+    G_INFO() << "Import" << path << ":" << res.rows << "rows," << res.inserted << "inserted," << res.duplicates
+             << "duplicates," << res.failed << "rejected in" << timer.elapsed() << "ms" << res.error;
+    return res;
+}
+
+void ImportHelper::importDialog(Kind kind, QWidget *parent)
+{
+    QString path = QFileDialog::getOpenFileName(parent,
+                                                kind == Users ? "Импорт участников" : "Импорт вопросов",
+                                                QDir::homePath(),
+                                                "CSV, JSON Lines (*.csv *.txt *.jsonl *.ndjson);;Все файлы (*)");
+    if (path.isEmpty()) return;
+
+    auto *dialog = new QProgressDialog("Импорт...", "Отмена", 0, 1000, parent);
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->setMinimumDuration(0);
+    dialog->setValue(0);
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    QObject::connect(dialog, &QProgressDialog::canceled, dialog, [cancel]() { *cancel = true; });
+
+    // длинная запись идет на своем соединении в пуле потоков: очередь AsyncDatabase
+    // (страницы, предпросмотр, поиск) за ней не ждет
+    QPointer<QProgressDialog> guard(dialog);
+    QFuture<Result> future = QtConcurrent::run([kind, path, cancel, guard]() {
+        return importFile(DatabaseManager::instance(), kind, path, [cancel, guard](qint64 done, qint64 total) {
+            int value = total > 0 ? int(done * 1000 / total) : 1000;
+            QMetaObject::invokeMethod(qApp, [guard, value]() { if (guard) guard->setValue(value); }, Qt::QueuedConnection);
+            return !*cancel && !DatabaseManager::instance().isStopping();
+        });
+    });
+    AsyncDatabase::then(dialog, future, [dialog, parent](const Result &res) {
+        dialog->close();
+        dialog->deleteLater();
+        QString text = QString("Прочитано записей: %1\nДобавлено: %2\nУже были в базе: %3\nОтклонено: %4")
+                           .arg(res.rows).arg(res.inserted).arg(res.duplicates).arg(res.failed);
+        for (int i = 0; i < res.errors.size() && i < 10; ++i) {
+            text += QString("\nСтрока %1: %2").arg(res.errors[i].line).arg(res.errors[i].message);
+        }
+        if (res.errors.size() > 10) text += "\n...";
+        if (!res.error.isEmpty()) {
+            QMessageBox::critical(parent, "Ошибка импорта", res.error + "\n\n" + text);
+        } else {
+            QMessageBox::information(parent, res.canceled ? "Импорт прерван" : "Импорт завершен", text);
+        }
+    });
+}
@@ -6,6 +6,9 @@
 #include "mainwindow.h"
 
 #include "databasemanager.h"
+#include "asyncdatabase.h"
+#include "queryprofiler.h"
+#include "reportrunner.h"
 
 int main(int argc, char *argv[])
 {
@@ -34,11 +37,33 @@ int main(int argc, char *argv[])
     }
     G_INFO() << "Database is successfully initialized.";
 
+    // перевод старого файла в incremental auto_vacuum - полный VACUUM, только по запросу и до окна
+    if (Settings::getParam("db_vacuum_convert") == "1" && !db.convertIncrementalVacuum()) {
+        G_WARN() << "Incremental auto_vacuum conversion failed:" << db.lastError();
+    }
+
+    // мероприятия старше db_archive_months месяцев уходят в годовые архивы
+    int archiveMonths = QString::fromStdString(Settings::getParam("db_archive_months")).toInt();
+    if (archiveMonths > 0) {
+        QDateTime cutoff = QDateTime::currentDateTime().addMonths(-archiveMonths);
+        AsyncDatabase::instance().submit("archive", [cutoff](DatabaseManager& db) {
+            int moved = 0;
+            if (!db.archiveEvents(cutoff, moved)) G_ERROR() << "Archiving failed:" << db.lastError();
+            return moved;
+        });
+    }
+
     MainWindow w;
     w.show();
 
     int ret = a.exec();
-    UniLog::getInstance().shutdown();
+    ReportRunner::instance().cancelAll();
+    ReportRunner::instance().waitForDone();
+    // задачи глобального пула (таймеры базы, выгрузка, импорт, рейтинг) - до закрытия базы и журнала
+    DatabaseManager::instance().stopBackground();
+    AsyncDatabase::instance().shutdown();
+    if (QueryProfiler::instance().isEnabled()) QueryProfiler::instance().dump();
     DatabaseManager::instance().close();
+    UniLog::getInstance().shutdown();
     return ret;
 }
@@ -3,6 +3,11 @@
 #include "createeventdialog.h"
 #include "createquizdialog.h"
 #include "reporthelper.h"
+#include "reportrunner.h"
+#include "importhelper.h"
+#include "exporthelper.h"
+#include "asyncdatabase.h"
+#include "queryprofiler.h"
 
 
 #include <QHeaderView>
@@ -11,6 +16,8 @@
 #include <QDebug>
 #include <QButtonGroup>
 #include <QStandardItemModel>
+#include <QShortcut>
+#include <QtConcurrent>
 
 
 static QString iconPathOrFallback(const QString &path) {
@@ -191,6 +198,10 @@ MainWindow::MainWindow(QWidget *parent)
     connect(sidebar, &SidebarWidget::activeIndexChanged,
            centerWidget, &QTabWidget::setCurrentIndex);
 
+    // статистика SQL-запросов по запросу - в журнал SQL.log
+    QShortcut *dumpQueries = new QShortcut(QKeySequence("Ctrl+Alt+Shift+Q"), this);
+    connect(dumpQueries, &QShortcut::activated, this, []() { QueryProfiler::instance().dump(); });
+
 
 
     //splitter->addWidget(preview);
@@ -258,8 +269,13 @@ QWidget* MainWindow::createEventWidget()
 
     connect(addEventButton, &QPushButton::clicked, this, &MainWindow::onAddEventButtonClicked);
 
+    QPushButton* importUsersButton = new QPushButton("Импорт участников");
+    importUsersButton->setProperty("cssClass", "createButton");
+    connect(importUsersButton, &QPushButton::clicked, this, [this]() { ImportHelper::importDialog(ImportHelper::Users, this); });
+
     contlay->addStretch();
     contlay->addWidget(searchEdit);
+    contlay->addWidget(importUsersButton);
     contlay->addWidget(addEventButton);
 
     vbox->addWidget(cont);
@@ -291,20 +307,11 @@ QWidget* MainWindow::createEventWidget()
     //connect(tableView, &QTableView::clicked, preview, &PreViewWidget::onTableRowClicked);
 
 
-    // Прокси-модель
-    proxyModel = new QSortFilterProxyModel(this);
-    proxyModel->setSourceModel(eventsModel);
-    proxyModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
-    proxyModel->setFilterKeyColumn(1); // предполагаем, что колонка 0 — "название"
-    // Привязка proxy к таблице
-    tableView->setModel(proxyModel);
-    // Подключаем сигнал поиска
-    connect(searchEdit, &QLineEdit::textChanged,
-            proxyModel, &QSortFilterProxyModel::setFilterFixedString);
-
+    // Поиск и сортировка выполняются в БД
+    connect(searchEdit, &QLineEdit::textChanged, eventsModel, &EventsModel::setFilter);
 
     connect(tableView, &QTableView::clicked, this, [&](){
-        preview->onTableRowClicked(proxyModel->index(tableView->currentIndex().row(), 0).data().toInt());
+        preview->onTableRowClicked(eventsModel->index(tableView->currentIndex().row(), 0).data().toInt());
     });
 
     vbox->addWidget(tableView);
@@ -337,8 +344,13 @@ QWidget* MainWindow::createQuizWidget()
 
     connect(addQuizButton, &QPushButton::clicked, this, &MainWindow::onAddQuizButtonClicked);
 
+    QPushButton* importQuestionsButton = new QPushButton("Импорт вопросов");
+    importQuestionsButton->setProperty("cssClass", "createButton");
+    connect(importQuestionsButton, &QPushButton::clicked, this, [this]() { ImportHelper::importDialog(ImportHelper::Questions, this); });
+
     contlay->addStretch();
     contlay->addWidget(searchEdit);
+    contlay->addWidget(importQuestionsButton);
     contlay->addWidget(addQuizButton);
 
     vbox->addWidget(cont);
@@ -357,23 +369,33 @@ QWidget* MainWindow::createQuizWidget()
     quizView->setSortingEnabled(true);
     quizView->horizontalHeader()->setSortIndicatorShown(true);
 
-    quizProxyModel = new QSortFilterProxyModel(this);
-    quizProxyModel->setSourceModel(quizModel);
-    quizProxyModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
-    quizProxyModel->setFilterKeyColumn(1); // предполагаем, что колонка 0 — "название"
-    // Привязка proxy к таблице
-    quizView->setModel(quizProxyModel);
-    // Подключаем сигнал поиска
-    connect(searchEdit, &QLineEdit::textChanged,
-            quizProxyModel, &QSortFilterProxyModel::setFilterFixedString);
-
+    // Поиск и сортировка выполняются в БД
+    connect(searchEdit, &QLineEdit::textChanged, quizModel, &QuizModel::setFilter);
 
     connect(quizView, &QTableView::clicked, this, [&](){
-        quizPreview->onTableRowClicked(quizProxyModel->index(quizView->currentIndex().row(), 0).data().toInt());
+        quizPreview->onTableRowClicked(quizModel->index(quizView->currentIndex().row(), 0).data().toInt());
     });
 
     vbox->addWidget(quizView);
 
+    // Поиск вопроса по тексту во всех квизах
+    questionSearchEdit = new QLineEdit(this);
+    questionSearchEdit->setPlaceholderText("Поиск по вопросам и ответам...");
+    questionSearchEdit->setClearButtonEnabled(true);
+    vbox->addWidget(questionSearchEdit);
+    questionSearchList = new QListWidget(this);
+    questionSearchList->setVisible(false);
+    vbox->addWidget(questionSearchList);
+    // запрос уходит после паузы в наборе
+    questionSearchTimer = new QTimer(this);
+    questionSearchTimer->setSingleShot(true);
+    questionSearchTimer->setInterval(200);
+    connect(questionSearchEdit, &QLineEdit::textChanged, questionSearchTimer, qOverload<>(&QTimer::start));
+    connect(questionSearchTimer, &QTimer::timeout, this, &MainWindow::onQuestionSearch);
+    connect(questionSearchList, &QListWidget::itemClicked, this, [this](QListWidgetItem* item){
+        quizPreview->onTableRowClicked(item->data(Qt::UserRole).toInt());
+    });
+
     return w;
 }
 
@@ -395,10 +417,28 @@ QWidget* MainWindow::createStatisticWidget()
     generateUserReportButton->setProperty("cssClass", "createButton");
     QPushButton* generateEventReportButton = new QPushButton("Сформировать отчёт по мероприятию");
     generateEventReportButton->setProperty("cssClass", "createButton");
+    QPushButton* generateItemReportButton = new QPushButton("Анализ вопросов квиза");
+    generateItemReportButton->setProperty("cssClass", "createButton");
+    QPushButton* exportPeriodButton = new QPushButton("Выгрузить ответы за период");
+    exportPeriodButton->setProperty("cssClass", "createButton");
+    QPushButton* exportEventButton = new QPushButton("Выгрузить ответы по мероприятию");
+    exportEventButton->setProperty("cssClass", "createButton");
+    QPushButton* userRatingButton = new QPushButton("Рейтинг участников");
+    userRatingButton->setProperty("cssClass", "createButton");
+    QPushButton* teamRatingButton = new QPushButton("Рейтинг команд");
+    teamRatingButton->setProperty("cssClass", "createButton");
+    QPushButton* rebuildRatingButton = new QPushButton("Пересчитать рейтинг");
+    rebuildRatingButton->setProperty("cssClass", "createButton");
 
     generateTeamReportButton->setFixedWidth(300);
     generateUserReportButton->setFixedWidth(300);
     generateEventReportButton->setFixedWidth(300);
+    generateItemReportButton->setFixedWidth(300);
+    exportPeriodButton->setFixedWidth(300);
+    exportEventButton->setFixedWidth(300);
+    userRatingButton->setFixedWidth(300);
+    teamRatingButton->setFixedWidth(300);
+    rebuildRatingButton->setFixedWidth(300);
 
     QWidget* cont1 = new QWidget();
     cont1->setProperty("cssClass", "container");
@@ -483,19 +523,83 @@ QWidget* MainWindow::createStatisticWidget()
     vbox->addWidget(generateTeamReportButton, 0, Qt::AlignLeft);
     vbox->addWidget(generateUserReportButton, 0, Qt::AlignLeft);
     vbox->addWidget(generateEventReportButton, 0, Qt::AlignLeft);
+    vbox->addWidget(generateItemReportButton, 0, Qt::AlignLeft);
+    vbox->addWidget(exportPeriodButton, 0, Qt::AlignLeft);
+    vbox->addWidget(exportEventButton, 0, Qt::AlignLeft);
+    vbox->addWidget(userRatingButton, 0, Qt::AlignLeft);
+    vbox->addWidget(teamRatingButton, 0, Qt::AlignLeft);
+    vbox->addWidget(rebuildRatingButton, 0, Qt::AlignLeft);
+
+    connect(generateTeamReportButton, &QPushButton::clicked, this, [this, dateEdit1, dateEdit2, hour1, hour2, minute1, minute2](){
+        QDateTime from(dateEdit1->date(), QTime(hour1->currentText().toInt(), minute1->currentText().toInt()));
+        QDateTime to(dateEdit2->date(), QTime(hour2->currentText().toInt(), minute2->currentText().toInt()));
+        ReportRunner::instance().startWithProgress("Отчет по командам", [from, to](DatabaseManager &db, const ReportHelper::Progress &progress) {
+            return ReportHelper::writeTeams(db, from, to, progress);
+        }, this);
+    });
+
+    connect(generateUserReportButton, &QPushButton::clicked, this, [this, dateEdit1, dateEdit2, hour1, hour2, minute1, minute2](){
+        QDateTime from(dateEdit1->date(), QTime(hour1->currentText().toInt(), minute1->currentText().toInt()));
+        QDateTime to(dateEdit2->date(), QTime(hour2->currentText().toInt(), minute2->currentText().toInt()));
+        ReportRunner::instance().startWithProgress("Отчет по участникам", [from, to](DatabaseManager &db, const ReportHelper::Progress &progress) {
+            return ReportHelper::writeUsers(db, from, to, progress);
+        }, this);
+    });
 
-    connect(generateTeamReportButton, &QPushButton::clicked, this, [dateEdit1, dateEdit2, hour1, hour2, minute1, minute2](){
-        ReportHelper::reportTeams(QDateTime(dateEdit1->date(), QTime(hour1->currentText().toInt(), minute1->currentText().toInt())),
-                                  QDateTime(dateEdit2->date(), QTime(hour2->currentText().toInt(), minute2->currentText().toInt())));
+    connect(generateEventReportButton, &QPushButton::clicked, this, [this, eventCombo](){
+        quint64 eventId = eventCombo->currentData(Qt::UserRole).toULongLong();
+        ReportRunner::instance().startWithProgress("Отчет по мероприятию", [eventId](DatabaseManager &db, const ReportHelper::Progress &progress) {
+            return ReportHelper::writeQuiz(db, eventId, progress);
+        }, this);
     });
 
-    connect(generateUserReportButton, &QPushButton::clicked, this, [dateEdit1, dateEdit2, hour1, hour2, minute1, minute2](){
-        ReportHelper::reportUsers(QDateTime(dateEdit1->date(), QTime(hour1->currentText().toInt(), minute1->currentText().toInt())),
-                                  QDateTime(dateEdit2->date(), QTime(hour2->currentText().toInt(), minute2->currentText().toInt())));
+    // по квизу выбранного мероприятия, статистика собирается по всем его мероприятиям
+    connect(generateItemReportButton, &QPushButton::clicked, this, [this, eventCombo](){
+        qint64 eventId = eventCombo->currentData(Qt::UserRole).toLongLong();
+        ReportRunner::instance().startWithProgress("Анализ вопросов", [eventId](DatabaseManager &db, const ReportHelper::Progress &progress) {
+            return ReportHelper::writeItems(db, db.getEventRow(eventId).quizId, progress);
+        }, this);
     });
 
-    connect(generateEventReportButton, &QPushButton::clicked, this, [dateEdit1, dateEdit2, hour1, hour2, minute1, minute2, eventCombo](){
-        ReportHelper::reportQuiz(eventCombo->currentData(Qt::UserRole).toInt());
+    connect(exportPeriodButton, &QPushButton::clicked, this, [this, dateEdit1, dateEdit2, hour1, hour2, minute1, minute2](){
+        AnswerExportFilter filter;
+        filter.dateFrom = QDateTime(dateEdit1->date(), QTime(hour1->currentText().toInt(), minute1->currentText().toInt()));
+        filter.dateTo = QDateTime(dateEdit2->date(), QTime(hour2->currentText().toInt(), minute2->currentText().toInt()));
+        ExportHelper::exportAnswersDialog(filter, this);
+    });
+
+    connect(exportEventButton, &QPushButton::clicked, this, [this, eventCombo](){
+        AnswerExportFilter filter;
+        filter.eventIds.append(eventCombo->currentData(Qt::UserRole).toLongLong());
+        ExportHelper::exportAnswersDialog(filter, this);
+    });
+
+    // рейтинг обновляется в фоне после изменения результатов, отчет показывает последний расчет
+    connect(userRatingButton, &QPushButton::clicked, this, [this](){
+        ReportRunner::instance().startWithProgress("Рейтинг участников", [](DatabaseManager &db, const ReportHelper::Progress &progress) {
+            return ReportHelper::writeRatings(db, DatabaseManager::RatingUser, progress);
+        }, this);
+    });
+
+    connect(teamRatingButton, &QPushButton::clicked, this, [this](){
+        ReportRunner::instance().startWithProgress("Рейтинг команд", [](DatabaseManager &db, const ReportHelper::Progress &progress) {
+            return ReportHelper::writeRatings(db, DatabaseManager::RatingTeam, progress);
+        }, this);
+    });
+
+    // полный пересчет - после смены параметров рейтинга в настройках
+    connect(rebuildRatingButton, &QPushButton::clicked, this, [this, rebuildRatingButton](){
+        rebuildRatingButton->setEnabled(false);
+        // пересчет всей истории - на своем соединении в пуле потоков, очередь AsyncDatabase за ним не ждет
+        QFuture<QString> future = QtConcurrent::run([]() {
+            DatabaseManager &db = DatabaseManager::instance();
+            return db.rebuildRatings(RatingParams::fromSettings()) ? QString() : db.lastError();
+        });
+        AsyncDatabase::then(this, future, [this, rebuildRatingButton](const QString& error) {
+            rebuildRatingButton->setEnabled(true);
+            if (error.isEmpty()) QMessageBox::information(this, "Рейтинг", "Рейтинг пересчитан");
+            else QMessageBox::warning(this, "Рейтинг", "Ошибка пересчета рейтинга: " + error);
+        });
     });
 
     vbox->addStretch();
@@ -525,9 +629,8 @@ void MainWindow::onAddEventButtonClicked()
     connect(dlg, &CreateEventDialog::eventCreated,
             this, [&](const Event &ev, int quizId)
     {
+        // модель добавит строку по уведомлению БД
         eventsModel->addEvent(ev, quizId);
-
-        eventsModel->loadSampleData();
     });
 
     // 4. Показываем диалог
@@ -545,8 +648,8 @@ void MainWindow::onAddQuizButtonClicked()
     connect(dlg, &CreateQuizDialog::eventCreated,
             this, [&](const Quiz &ev)
             {
+                // модель добавит строку по уведомлению БД
                 quizModel->addQuiz(ev);
-                quizModel->loadSampleData();
             });
 
     // 4. Показываем диалог
@@ -554,3 +657,29 @@ void MainWindow::onAddQuizButtonClicked()
     dlg->deleteLater();
 
 }
+
+void MainWindow::onQuestionSearch()
+{
+    QString text = questionSearchEdit->text().trimmed();
+    if(text.isEmpty()) {
+        AsyncDatabase::instance().cancel("search");
+        questionSearchList->clear();
+        questionSearchList->setVisible(false);
+        return;
+    }
+    auto future = AsyncDatabase::instance().submit("search", [text](DatabaseManager& db) {
+        return db.searchQuestions(text, 50);
+    });
+    AsyncDatabase::then(this, future, [this](const QVector<QuestionSearchRow>& rows) {
+        questionSearchList->clear();
+        for(auto& r : rows) {
+            QListWidgetItem* item = new QListWidgetItem(r.topic + ": " + r.snippet, questionSearchList);
+            item->setData(Qt::UserRole, r.quizId);
+        }
+        if(rows.isEmpty()) {
+            QListWidgetItem* item = new QListWidgetItem("Ничего не найдено", questionSearchList);
+            item->setFlags(Qt::NoItemFlags);
+        }
+        questionSearchList->setVisible(true);
+    });
+}
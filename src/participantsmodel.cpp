@@ -1,5 +1,5 @@
 #include "participantsmodel.h"
-#include "databasemanager.h"
+#include "asyncdatabase.h"
 #include <QLayout>
 #include <QStringListModel>
 #include <QCompleter>
@@ -214,20 +214,26 @@ void ParticipantSelectorWidget::update(int eventId)
 {
     this->eventId = eventId;
 
-    DatabaseManager& bd = DatabaseManager::instance();
-
-    QVector<QVariantMap> parts = bd.listParticipantsByEvent(eventId);
-
-    m_participantsModel->reset();
-
-
-    for (const auto& part : parts) {
-        QVariantMap user = bd.getUser(part["user_id"].toInt());
-        Person p{user["user_id"].toInt(), user["surname"].toString(), user["name"].toString(), user["father_name"].toString()};
-        m_participantsModel->addParticipant(p);
-    }
-
-    m_participantsView->reset();
+    // Участников читаем в потоке БД, более ранний запрос отменяется
+    auto future = AsyncDatabase::instance().submit("participants", [eventId](DatabaseManager& bd) {
+        QList<Person> persons;
+        QVector<qint64> userIds;
+        for (const auto& part : bd.listParticipantRowsByEvent(eventId)) {
+            if (part.userId) userIds.append(part.userId);
+        }
+        for (const auto& user : bd.getUsers(userIds)) {
+            if (user.isEmpty()) continue;
+            persons.append(Person{user["user_id"].toInt(), user["surname"].toString(), user["name"].toString(), user["father_name"].toString()});
+        }
+        return persons;
+    });
+    AsyncDatabase::then(this, future, [this](const QList<Person>& persons) {
+        m_participantsModel->reset();
+        for (const auto& p : persons) {
+            m_participantsModel->addParticipant(p);
+        }
+        m_participantsView->reset();
+    });
 }
 
 
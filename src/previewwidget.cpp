@@ -1,7 +1,7 @@
 #include "previewwidget.h"
 #include "participantsmodel.h"
 #include "groupmanager.h"
-#include "databasemanager.h"
+#include "asyncdatabase.h"
 #include "exporthelper.h"
 
 #include <QVBoxLayout>
@@ -71,10 +71,19 @@ PreViewWidget::PreViewWidget(QWidget *parent): QWidget(parent)
     layout->addStretch();
 }
 
+/**
+ * Данные для карточки мероприятия
+ */
+struct EventPreview {
+    QVariantMap event;
+    QVector<QuizRow> quizzes;
+};
+
 void PreViewWidget::onTableRowClicked(int index)
 {
     eventId = index;
     if (index == -1) {
+        AsyncDatabase::instance().cancel("preview");
         this->hide();
         return;
     }
@@ -82,10 +91,20 @@ void PreViewWidget::onTableRowClicked(int index)
 
     participantSelectorWidget->update(index);
 
-    DatabaseManager& db = DatabaseManager::instance();
-
-    QVariantMap event = db.getEvent(index);
+    // Запрос уходит в поток БД, клик по другой строке отменяет устаревший
+    auto future = AsyncDatabase::instance().submit("preview", [index](DatabaseManager& db) {
+        EventPreview p;
+        p.event = db.getEvent(index);
+        p.quizzes = db.listQuizRows();
+        return p;
+    });
+    AsyncDatabase::then(this, future, [this](const EventPreview& p) {
+        showEventPreview(p.event, p.quizzes);
+    });
+}
 
+void PreViewWidget::showEventPreview(const QVariantMap &event, const QVector<QuizRow> &quizes)
+{
     QLocale ru(QLocale::Russian);
 
     title->setText(event["title"].toString());
@@ -102,13 +121,10 @@ void PreViewWidget::onTableRowClicked(int index)
     date->setText(ru.toString(dateTime.date(), "d MMMM yyyy"));
     time->setText(dateTime.time().toString("HH:mm"));
 
-    //QVariantMap quiz = db.getQuiz(event["quiz_id"].toInt());
-    QVector<QVariantMap> quizes = db.listQuizzes();
-
     QStandardItemModel *model = new QStandardItemModel(this);
     for (const auto&q : quizes) {
-        QStandardItem *item = new QStandardItem(q["topic"].toString());
-        item->setData(q["quiz_id"].toInt(), Qt::UserRole);        // userData сюда
+        QStandardItem *item = new QStandardItem(q.topic);
+        item->setData(q.quizId, Qt::UserRole);        // userData сюда
         model->appendRow(item);
     }
 
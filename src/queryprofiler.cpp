@@ -0,0 +1,106 @@
+#include "queryprofiler.h"
+#include "utils/settings.h"
+#include "unilog/unilog.h"
+#include <QSqlQuery>
+#include <QStringList>
+#include <algorithm>
+
+// отдельный логгер - журнал пишется в свой файл SQL.log
+static const char *SQL_LOGGER = "SQL";
+
+QueryProfiler::QueryProfiler()
+{
+    // db_profile=1 - собирать статистику, db_slow_query_ms - порог журнала медленных запросов
+    int slowMs = QString::fromStdString(Settings::getParam("db_slow_query_ms")).toInt();
+    setSlowThresholdMs(qMax(slowMs, 0));
+    setEnabled(Settings::getParam("db_profile") == "1" || slowMs > 0);
+}
+
+qint64 QueryProfiler::Stat::percentileNs(double p) const
+{
+    if (count == 0) return 0;
+    quint64 rank = quint64(p * count + 0.5);
+    quint64 seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) return qMin(qint64(2000) << i, maxNs);
+    }
+    return maxNs;
+}
+
+void QueryProfiler::record(const QString &sql, qint64 ns, const QSqlDatabase &db)
+{
+    qint64 us = ns / 1000;
+    int bucket = 0;
+    while (bucket < Stat::BUCKETS - 1 && (qint64(2) << bucket) <= us) ++bucket;
+
+    const qint64 slowNs = m_slowNs.load(std::memory_order_relaxed);
+    bool slow = slowNs > 0 && ns >= slowNs;
+    bool withPlan = false;
+    {
+        QMutexLocker lock(&m_mutex);
+        Stat &s = m_stats[sql];
+        if (s.count == 0) s.sql = sql;
+        ++s.count;
+        s.totalNs += ns;
+        s.maxNs = qMax(s.maxNs, ns);
+        ++s.buckets[bucket];
+        // план одного и того же запроса пишем один раз
+        if (slow && !s.planLogged) {
+            s.planLogged = true;
+            withPlan = true;
+        }
+    }
+    if (!slow) return;
+    if (withPlan) {
+        L_WARN(SQL_LOGGER).noquote() << "Slow query" << ns / 1000000.0 << "ms:" << sql.simplified()
+                                     << "\n" << explain(sql, db);
+    } else {
+        L_WARN(SQL_LOGGER).noquote() << "Slow query" << ns / 1000000.0 << "ms:" << sql.simplified();
+    }
+}
+
+QString QueryProfiler::explain(const QString &sql, const QSqlDatabase &db) const
+{
+    // параметры не привязываем - план от значений не зависит
+    QSqlQuery q(db);
+    if (!q.exec("EXPLAIN QUERY PLAN " + sql)) return "  (no plan)";
+    QStringList lines;
+    while (q.next()) {
+        // id, parent, notused, detail
+        lines << "  " + q.value(3).toString();
+    }
+    return lines.isEmpty() ? "  (no plan)" : lines.join('\n');
+}
+
+QVector<QueryProfiler::Stat> QueryProfiler::stats() const
+{
+    QVector<Stat> v;
+    {
+        QMutexLocker lock(&m_mutex);
+        v.reserve(m_stats.size());
+        for (const Stat &s : m_stats) v.append(s);
+    }
+    std::sort(v.begin(), v.end(), [](const Stat &a, const Stat &b) { return a.totalNs > b.totalNs; });
+    return v;
+}
+
+void QueryProfiler::dump() const
+{
+    const QVector<Stat> v = stats();
+    L_INFO(SQL_LOGGER) << "Query statistics," << v.size() << "statements";
+    for (const Stat &s : v) {
+        L_INFO(SQL_LOGGER).noquote() << QString("count %1 total %2 ms max %3 ms p99 %4 ms: %5")
+                                        .arg(s.count)
+                                        .arg(s.totalNs / 1000000.0, 0, 'f', 2)
+                                        .arg(s.maxNs / 1000000.0, 0, 'f', 2)
+                                        .arg(s.percentileNs(0.99) / 1000000.0, 0, 'f', 2)
+                                        .arg(s.sql.simplified());
+    }
+}
+
+void QueryProfiler::reset()
+{
+    QMutexLocker lock(&m_mutex);
+    m_stats.clear();
+}
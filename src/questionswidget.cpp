@@ -9,7 +9,7 @@
 #include <QMessageBox>
 #include "questionwidget.h"
 #include "questionswidget.h"
-#include "databasemanager.h"
+#include "asyncdatabase.h"
 
 QuestionsWidget::QuestionsWidget(QWidget *parent)
     : QScrollArea(parent)
@@ -39,12 +39,17 @@ void QuestionsWidget::showQuizData(QString topic, qint64 quizId)
     this->quizId = quizId;
     for(auto& q : questions) delete q;
     questions.clear();
-    DatabaseManager* db = &DatabaseManager::instance();
-    auto qst = db->listQuestionsByQuiz(quizId);
-    for(auto& q : qst) {
-        QuestionWidget* w = new QuestionWidget(topic, quizId, q["question_id"].toInt(), this);
-        mainLayout->addWidget(w);
-        questions.push_back(w);
-    }
-    addQuestionButton->setVisible(true);
+    addQuestionButton->setVisible(false);
+    // Загружаем квиз в потоке БД, виджеты создаем по готовности
+    auto future = AsyncDatabase::instance().submit("questions", [quizId](DatabaseManager& db) {
+        return db.loadQuizGraph(quizId);
+    });
+    AsyncDatabase::then(this, future, [this, topic, quizId](const QuizGraph& graph) {
+        for(auto& q : graph.questions) {
+            QuestionWidget* w = new QuestionWidget(topic, quizId, q, this);
+            mainLayout->addWidget(w);
+            questions.push_back(w);
+        }
+        addQuestionButton->setVisible(true);
+    });
 }
\ No newline at end of file
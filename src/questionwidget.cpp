@@ -12,6 +12,30 @@
 
 QuestionWidget::QuestionWidget(QString topic, qint64 quizId, qint64 questionId, QWidget *parent)
     : QWidget(parent), topic(topic), quizId(quizId), questionId(questionId)
+{
+    initUi();
+    if(questionId > 0) {
+        DatabaseManager* db = &DatabaseManager::instance();
+        auto q = db->getQuestion(questionId);
+        QuizQuestion question;
+        question.question.questionId = questionId;
+        question.question.quizId = quizId;
+        question.question.text = q["text"].toString();
+        question.question.points = q["points"].toLongLong();
+        question.question.answer = q["answer"].toLongLong();
+        question.answers = db->listAnswerRowsByQuestion(questionId);
+        fillQuestion(question);
+    }
+}
+
+QuestionWidget::QuestionWidget(QString topic, qint64 quizId, const QuizQuestion &question, QWidget *parent)
+    : QWidget(parent), topic(topic), quizId(quizId), questionId(question.question.questionId)
+{
+    initUi();
+    fillQuestion(question);
+}
+
+void QuestionWidget::initUi()
 {
     // Основной вертикальный layout
     QVBoxLayout *mainLayout = new QVBoxLayout(this);
@@ -59,21 +83,6 @@ QuestionWidget::QuestionWidget(QString topic, qint64 quizId, qint64 questionId,
     QPushButton *saveButton = new QPushButton("Сохранить", this);
     mainLayout->addWidget(saveButton);
 
-    if(questionId > 0) {
-        DatabaseManager* db = &DatabaseManager::instance();
-        auto result = db->getQuestion(questionId);
-        questionEdit->setText(result["text"].toString());
-        difficultyComboBox->setCurrentText(result["points"].toString());
-        rightAnswer->setValue(result["answer"].toInt());
-        answersList->clear();
-        auto answers = db->listAnswersByQuestion(result["question_id"].toInt());
-        for(auto& a : answers) {
-            answersList->addItem(a["text"].toString());
-        }
-        for(int i=0;i<answersList->count();i++) {
-            answersList->item(i)->setFlags(answersList->item(i)->flags() | Qt::ItemIsEditable);
-        }
-    }
     // Обработчики кнопок
     connect(addAnswerButton, &QPushButton::clicked, this, &QuestionWidget::onAddAnswerButton);
     connect(removeAnswerButton, &QPushButton::clicked, this, &QuestionWidget::onRemoveAnswerButton);
@@ -85,6 +94,18 @@ QuestionWidget::QuestionWidget(QString topic, qint64 quizId, qint64 questionId,
     connect(&lm, &LM::errorOccurred, this, &QuestionWidget::onLMError);
 }
 
+void QuestionWidget::fillQuestion(const QuizQuestion &question)
+{
+    questionEdit->setText(question.question.text);
+    difficultyComboBox->setCurrentText(QString::number(question.question.points));
+    rightAnswer->setValue(question.question.answer);
+    answersList->clear();
+    for(auto& a : question.answers) answersList->addItem(a.text);
+    for(int i=0;i<answersList->count();i++) {
+        answersList->item(i)->setFlags(answersList->item(i)->flags() | Qt::ItemIsEditable);
+    }
+}
+
 void QuestionWidget::onSaveButton()
 {
     if (questionEdit->text().size() < 5 || answersList->count() < 3) {
@@ -92,20 +113,24 @@ void QuestionWidget::onSaveButton()
         return;
     }
     DatabaseManager* db = &DatabaseManager::instance();
-    if(questionId > 0) {
-        db->updateQuestion(questionId, quizId, questionEdit->text(), difficultyComboBox->currentIndex() + 1, rightAnswer->value());
+    // Вопрос и ответы сохраняем одной транзакцией
+    DatabaseManager::Transaction tr(*db);
+    qint64 savedId = questionId;
+    bool ok;
+    if(savedId > 0) {
+        ok = db->updateQuestion(savedId, quizId, questionEdit->text(), difficultyComboBox->currentIndex() + 1, rightAnswer->value());
     } else {
-        db->addQuestion(quizId, questionEdit->text(), difficultyComboBox->currentIndex() + 1, rightAnswer->value(), questionId);
-    }
-    auto answers = db->listAnswersByQuestion(questionId);
-    for(auto& a : answers) {
-        db->removeAnswer(a["answer_id"].toInt());
+        ok = db->addQuestion(quizId, questionEdit->text(), difficultyComboBox->currentIndex() + 1, rightAnswer->value(), savedId);
     }
+    QStringList answers;
     for(int i=0;i<answersList->count();i++) {
-        answersList->item(i);
-        qint64 answerId;
-        db->addAnswer(questionId, answersList->item(i)->text(), answerId);
+        answers << answersList->item(i)->text();
+    }
+    if(!ok || !db->replaceAnswers(savedId, answers) || !tr.commit()) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось сохранить вопрос: " + db->lastError());
+        return;
     }
+    questionId = savedId;
 }
 
 void QuestionWidget::onAddAnswerButton()
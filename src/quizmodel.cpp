@@ -1,11 +1,25 @@
 #include "quizmodel.h"
-#include "databasemanager.h"
+#include "asyncdatabase.h"
 #include <QBrush>
 #include <QWidget>
+#include <algorithm>
+
+static Quiz toQuiz(const QuizRow &row)
+{
+    Quiz q;
+    q.id = row.quizId;
+    q.topic = row.topic;
+    q.timer = row.timer;
+    return q;
+}
 
 QuizModel::QuizModel(QObject *parent)
     : QAbstractTableModel(parent)
 {
+    DatabaseManager &db = DatabaseManager::instance();
+    connect(&db, &DatabaseManager::rowInserted, this, &QuizModel::onRowInserted);
+    connect(&db, &DatabaseManager::rowUpdated, this, &QuizModel::onRowUpdated);
+    connect(&db, &DatabaseManager::rowDeleted, this, &QuizModel::onRowDeleted);
 }
 
 int QuizModel::rowCount(const QModelIndex &parent) const
@@ -58,31 +72,161 @@ Qt::ItemFlags QuizModel::flags(const QModelIndex &index) const
     return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
 }
 
-void QuizModel::loadSampleData()
+bool QuizModel::canFetchMore(const QModelIndex &parent) const
 {
-    beginResetModel();
-    m_events.clear();
+    if (parent.isValid())
+        return false;
+    return m_hasMore && !m_loading;
+}
 
-    DatabaseManager& bd = DatabaseManager::instance();
-    QSqlDatabase db = bd.database(); // метод, возвращающий QSqlDatabase
+void QuizModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+    m_loading = true;
+    PageKey after = m_lastKey;
+    auto sort = m_sort;
+    auto order = m_order;
+    QString filter = m_filter;
+    auto future = AsyncDatabase::instance().submit("quizzes", [=](DatabaseManager& bd) {
+        return bd.listQuizzesPage(after, PAGE_SIZE, sort, order, filter);
+    });
+    AsyncDatabase::then(this, future, [this](const QVector<QuizRow>& rows) {
+        if (!rows.isEmpty()) {
+            beginInsertRows(QModelIndex(), m_events.size(), m_events.size() + rows.size() - 1);
+            appendPage(rows);
+            endInsertRows();
+        } else {
+            m_hasMore = false;
+        }
+        m_loading = false;
+    });
+}
 
-    QSqlQuery query(db);
-    if (!query.exec("SELECT quiz_id, topic, timer FROM quiz")) {
-        qWarning() << "Failed to load events:" << query.lastError().text();
-        endResetModel();
+void QuizModel::sort(int column, Qt::SortOrder order)
+{
+    if (column < 0 || column >= columnCount())
         return;
-    }
+    m_sort = column == 1 ? DatabaseManager::QuizSortTopic : DatabaseManager::QuizSortId;
+    m_order = order;
+    loadSampleData();
+}
 
-    while (query.next()) {
-        Quiz ev;
-        ev.id = query.value("quiz_id").toInt();
-        ev.topic = query.value("topic").toString();
-        ev.timer = query.value("timer").toInt();
+void QuizModel::setFilter(const QString &filter)
+{
+    m_filter = filter;
+    loadSampleData();
+}
 
-        m_events.append(ev);
+void QuizModel::appendPage(const QVector<QuizRow> &rows)
+{
+    m_events.reserve(m_events.size() + rows.size());
+    for (const QuizRow &row : rows) {
+        // строка могла уже прийти через уведомление о вставке
+        if (rowOfId(row.quizId) < 0) m_events.append(toQuiz(row));
     }
+    if (!rows.isEmpty()) m_lastKey = DatabaseManager::quizPageKey(rows.last(), m_sort);
+    m_hasMore = rows.size() == PAGE_SIZE;
+}
+
+void QuizModel::loadSampleData()
+{
+    // Читаем первую страницу в потоке БД, остальные - через fetchMore при прокрутке
+    m_loading = true;
+    auto sort = m_sort;
+    auto order = m_order;
+    QString filter = m_filter;
+    auto future = AsyncDatabase::instance().submit("quizzes", [=](DatabaseManager& bd) {
+        return bd.listQuizzesPage(PageKey(), PAGE_SIZE, sort, order, filter);
+    });
+    AsyncDatabase::then(this, future, [this](const QVector<QuizRow>& rows) {
+        beginResetModel();
+        m_events.clear();
+        m_lastKey = PageKey();
+        appendPage(rows);
+        m_loading = false;
+        endResetModel();
+    });
+}
 
-    endResetModel();
+int QuizModel::rowOfId(qint64 id) const
+{
+    for (int i = 0; i < m_events.size(); ++i)
+        if (m_events[i].id == id) return i;
+    return -1;
+}
+
+bool QuizModel::lessThan(const Quiz &a, const Quiz &b) const
+{
+    // тот же порядок, что и в listQuizzesPage: колонка сортировки, затем id
+    bool less = (m_sort == DatabaseManager::QuizSortTopic && a.topic != b.topic) ? a.topic < b.topic : a.id < b.id;
+    return m_order == Qt::AscendingOrder ? less : !less && a.id != b.id;
+}
+
+void QuizModel::placeQuiz(const QuizRow &row)
+{
+    if (!m_filter.isEmpty() && !DatabaseManager::matchesFilter(row.topic, m_filter))
+        return;
+    Quiz q = toQuiz(row);
+    int pos = std::lower_bound(m_events.begin(), m_events.end(), q,
+                               [this](const Quiz &a, const Quiz &b) { return lessThan(a, b); }) - m_events.begin();
+    // строка за последней загруженной придет со следующей страницей
+    if (pos == m_events.size() && m_hasMore)
+        return;
+    beginInsertRows(QModelIndex(), pos, pos);
+    m_events.insert(pos, q);
+    endInsertRows();
+}
+
+void QuizModel::onRowInserted(DatabaseManager::Table table, qint64 id)
+{
+    if (table != DatabaseManager::TableQuiz)
+        return;
+    auto future = AsyncDatabase::instance().submit(QString(), [id](DatabaseManager& bd) {
+        return bd.getQuizRow(id);
+    });
+    AsyncDatabase::then(this, future, [this](const QuizRow& row) {
+        if (row.quizId != 0 && rowOfId(row.quizId) < 0) placeQuiz(row);
+    });
+}
+
+void QuizModel::onRowUpdated(DatabaseManager::Table table, qint64 id)
+{
+    if (table != DatabaseManager::TableQuiz || rowOfId(id) < 0)
+        return;
+    auto future = AsyncDatabase::instance().submit(QString(), [id](DatabaseManager& bd) {
+        return bd.getQuizRow(id);
+    });
+    AsyncDatabase::then(this, future, [this, id](const QuizRow& row) {
+        int r = rowOfId(id);
+        if (r < 0 || row.quizId == 0)
+            return;
+        Quiz q = toQuiz(row);
+        bool inPlace = (r == 0 || !lessThan(q, m_events[r - 1]))
+                    && (r == m_events.size() - 1 || !lessThan(m_events[r + 1], q));
+        if (inPlace) {
+            m_events[r] = q;
+            emit dataChanged(index(r, 0), index(r, columnCount() - 1));
+        } else {
+            // изменилась тема при сортировке по теме - переставляем строку
+            beginRemoveRows(QModelIndex(), r, r);
+            m_events.removeAt(r);
+            endRemoveRows();
+            placeQuiz(row);
+        }
+    });
+}
+
+void QuizModel::onRowDeleted(DatabaseManager::Table table, qint64 id)
+{
+    if (table != DatabaseManager::TableQuiz)
+        return;
+    int r = rowOfId(id);
+    if (r < 0)
+        return;
+    beginRemoveRows(QModelIndex(), r, r);
+    m_events.removeAt(r);
+    endRemoveRows();
 }
 
 bool QuizModel::addQuiz(const Quiz& ev)
@@ -0,0 +1,161 @@
+#include "reportcache.h"
+#include "utils/settings.h"
+#include "unilog/unilog.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+
+// версия разметки: при изменении формата отчетов старые файлы не подходят
+static const char *REPORT_FORMAT = "html-1";
+
+ReportCache::ReportCache()
+    : m_dir(QString::fromStdString(Settings::dbDir()) + "/report_cache")
+{
+    // report_cache_mb, report_cache_entries - пределы кэша, report_cache=0 - выключить
+    int mb = QString::fromStdString(Settings::getParam("report_cache_mb")).toInt();
+    int entries = QString::fromStdString(Settings::getParam("report_cache_entries")).toInt();
+    setLimits(mb > 0 ? qint64(mb) * 1024 * 1024 : m_maxBytes, entries > 0 ? entries : m_maxEntries);
+    setEnabled(Settings::getParam("report_cache") != "0");
+}
+
+QString ReportCache::key(const QString &kind, const QStringList &params, qint64 generation)
+{
+    QStringList parts;
+    parts << REPORT_FORMAT << kind << QString::number(generation) << params;
+    return QString::fromLatin1(QCryptographicHash::hash(parts.join('\x1f').toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+QString ReportCache::filePath(const QString &key) const
+{
+    return m_dir.filePath(key + ".html");
+}
+
+void ReportCache::load()
+{
+    // индекс строится по каталогу при первом обращении, отдельного файла индекса нет
+    if (m_loaded) return;
+    m_loaded = true;
+    m_dir.mkpath(".");
+    const QFileInfoList files = m_dir.entryInfoList({ "*.html" }, QDir::Files);
+    for (const QFileInfo &fi : files) {
+        Entry e;
+        e.size = fi.size();
+        e.lastUsed = fi.lastModified().toMSecsSinceEpoch();
+        m_entries.insert(fi.fileName(), e);
+        m_bytes += e.size;
+    }
+    // недописанные при сбое копии
+    for (const QString &part : m_dir.entryList({ "*.part" }, QDir::Files)) m_dir.remove(part);
+    evict();
+}
+
+QString ReportCache::lookup(const QString &key)
+{
+    if (!isEnabled()) return QString();
+    QMutexLocker lock(&m_mutex);
+    load();
+    const QString name = key + ".html";
+    auto it = m_entries.find(name);
+    const QString path = filePath(key);
+    if (it == m_entries.end() || !QFile::exists(path)) {
+        if (it != m_entries.end()) {
+            m_bytes -= it.value().size;
+            m_entries.erase(it);
+        }
+        ++m_misses;
+        return QString();
+    }
+    ++m_hits;
+    it.value().lastUsed = QDateTime::currentMSecsSinceEpoch();
+    // mtime - время использования, чтобы порядок LRU пережил перезапуск
+    QFile file(path);
+    if (file.open(QIODevice::ReadWrite)) {
+        file.setFileTime(QDateTime::fromMSecsSinceEpoch(it.value().lastUsed), QFileDevice::FileModificationTime);
+    }
+    return path;
+}
+
+QString ReportCache::store(const QString &key, const QString &fileName)
+{
+    if (!isEnabled()) return fileName;
+    QMutexLocker lock(&m_mutex);
+    load();
+    const QString path = filePath(key);
+    const QString name = key + ".html";
+    // тот же отчет мог сформироваться параллельно - оставляем уже лежащий
+    if (QFile::exists(path)) {
+        QFile::remove(fileName);
+        if (!m_entries.contains(name)) {
+            Entry e;
+            e.size = QFileInfo(path).size();
+            e.lastUsed = QDateTime::currentMSecsSinceEpoch();
+            m_entries.insert(name, e);
+            m_bytes += e.size;
+        }
+        return path;
+    }
+    // между томами rename не работает - копируем через .part
+    if (!QFile::rename(fileName, path)) {
+        const QString part = path + ".part";
+        if (!QFile::copy(fileName, part) || !QFile::rename(part, path)) {
+            G_WARN() << "Report cache: could not store" << fileName << "to" << path;
+            QFile::remove(part);
+            return fileName;
+        }
+        QFile::remove(fileName);
+    }
+    Entry e;
+    e.size = QFileInfo(path).size();
+    e.lastUsed = QDateTime::currentMSecsSinceEpoch();
+    m_entries.insert(name, e);
+    m_bytes += e.size;
+    evict();
+    return path;
+}
+
+void ReportCache::evict()
+{
+    if (m_bytes <= m_maxBytes && m_entries.size() <= m_maxEntries) return;
+    QVector<QPair<qint64, QString>> order;
+    order.reserve(m_entries.size());
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) order.append({ it.value().lastUsed, it.key() });
+    std::sort(order.begin(), order.end());
+    // самый свежий файл не удаляем - его только что отдали
+    for (int i = 0; i + 1 < order.size() && (m_bytes > m_maxBytes || m_entries.size() > m_maxEntries); ++i) {
+        auto it = m_entries.find(order[i].second);
+        m_bytes -= it.value().size;
+        m_entries.erase(it);
+        m_dir.remove(order[i].second);
+    }
+}
+
+void ReportCache::setLimits(qint64 maxBytes, int maxEntries)
+{
+    QMutexLocker lock(&m_mutex);
+    m_maxBytes = maxBytes;
+    m_maxEntries = maxEntries;
+    if (m_loaded) evict();
+}
+
+void ReportCache::clear()
+{
+    QMutexLocker lock(&m_mutex);
+    load();
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) m_dir.remove(it.key());
+    m_entries.clear();
+    m_bytes = 0;
+}
+
+ReportCache::Stats ReportCache::stats()
+{
+    QMutexLocker lock(&m_mutex);
+    load();
+    Stats s;
+    s.hits = m_hits;
+    s.misses = m_misses;
+    s.entries = m_entries.size();
+    s.bytes = m_bytes;
+    return s;
+}
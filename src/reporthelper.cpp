@@ -2,205 +2,451 @@
 #include <QApplication>
 #include <QDesktopServices>
 #include "databasemanager.h"
+#include "reportcache.h"
 #include "unilog/unilog.h"
+#include <atomic>
+#include <cstring>
 
-class UnicodedStream : QTextStream
+bool ReportHelper::s_openInBrowser = true;
+
+namespace {
+
+/**
+ * Потоковая запись HTML: UTF-8 кодируется прямо в переиспользуемый буфер,
+ * текст из базы экранируется, на диск буфер уходит кусками по BUFFER_SIZE.
+ * Постоянные фрагменты разметки - строковые литералы с длиной, известной при компиляции.
+ */
+class HtmlWriter
 {
-    using QTextStream::QTextStream;
 public:
-    using QTextStream::setCodec;
-    template<typename T>
-    UnicodedStream& operator<<(T const& t)
+    static const int BUFFER_SIZE = 256 * 1024;
+    // самая длинная запись одного символа - "&quot;"
+    static const int MAX_CHAR_BYTES = 6;
+
+    explicit HtmlWriter(QFile &file) : m_file(file) { m_buffer.resize(BUFFER_SIZE); }
+
+    template<int N>
+    HtmlWriter& raw(const char (&literal)[N]) { return raw(literal, N - 1); }
+
+    HtmlWriter& raw(const char *data, int size)
+    {
+        if (m_size + size > BUFFER_SIZE && !flush()) return *this;
+        if (size > BUFFER_SIZE) {
+            m_ok = m_file.write(data, size) == size;
+            return *this;
+        }
+        memcpy(m_buffer.data() + m_size, data, size);
+        m_size += size;
+        return *this;
+    }
+
+    HtmlWriter& text(const QString &value)
+    {
+        const QChar *c = value.constData();
+        const int n = value.size();
+        for (int i = 0; i < n; ++i) {
+            if (m_size + MAX_CHAR_BYTES > BUFFER_SIZE && !flush()) return *this;
+            char *out = m_buffer.data() + m_size;
+            uint u = c[i].unicode();
+            switch (u) {
+            case '&': memcpy(out, "&amp;", 5); m_size += 5; continue;
+            case '<': memcpy(out, "&lt;", 4); m_size += 4; continue;
+            case '>': memcpy(out, "&gt;", 4); m_size += 4; continue;
+            case '"': memcpy(out, "&quot;", 6); m_size += 6; continue;
+            case '\'': memcpy(out, "&#39;", 5); m_size += 5; continue;
+            }
+            if (u < 0x80) {
+                out[0] = char(u);
+                m_size += 1;
+            } else if (u < 0x800) {
+                out[0] = char(0xC0 | (u >> 6));
+                out[1] = char(0x80 | (u & 0x3F));
+                m_size += 2;
+            } else if (QChar::isHighSurrogate(u) && i + 1 < n && c[i + 1].isLowSurrogate()) {
+                uint cp = QChar::surrogateToUcs4(ushort(u), c[++i].unicode());
+                out[0] = char(0xF0 | (cp >> 18));
+                out[1] = char(0x80 | ((cp >> 12) & 0x3F));
+                out[2] = char(0x80 | ((cp >> 6) & 0x3F));
+                out[3] = char(0x80 | (cp & 0x3F));
+                m_size += 4;
+            } else {
+                // одиночная половина суррогатной пары заменяется на U+FFFD
+                if (QChar::isSurrogate(u)) u = 0xFFFD;
+                out[0] = char(0xE0 | (u >> 12));
+                out[1] = char(0x80 | ((u >> 6) & 0x3F));
+                out[2] = char(0x80 | (u & 0x3F));
+                m_size += 3;
+            }
+        }
+        return *this;
+    }
+
+    HtmlWriter& number(qint64 value)
     {
-        return static_cast<UnicodedStream&>(static_cast<QTextStream&>(*this) << t);
+        char digits[24];
+        int len = 0;
+        quint64 v = value < 0 ? 0 - quint64(value) : quint64(value);
+        do {
+            digits[len++] = char('0' + v % 10);
+            v /= 10;
+        } while (v);
+        if (value < 0) digits[len++] = '-';
+        char reversed[24];
+        for (int i = 0; i < len; ++i) reversed[i] = digits[len - 1 - i];
+        return raw(reversed, len);
     }
-    UnicodedStream& operator<<(char const* ptr)
+
+    HtmlWriter& number(double value, int precision)
     {
-        return static_cast<UnicodedStream&>(*this << QString(ptr));
+        const QByteArray digits = QByteArray::number(value, 'f', precision);
+        return raw(digits.constData(), digits.size());
     }
+
+    bool flush()
+    {
+        if (m_ok && m_size > 0) m_ok = m_file.write(m_buffer.constData(), m_size) == m_size;
+        m_size = 0;
+        return m_ok;
+    }
+    bool ok() const { return m_ok; }
+
+private:
+    QFile &m_file;
+    QByteArray m_buffer;
+    int m_size = 0;
+    bool m_ok = true;
 };
 
-bool ReportHelper::reportQuiz(quint64 id)
+/**
+ * Прогресс по строкам таблицы: первые 10% - выборка, дальше - запись.
+ * Число строк известно только оценкой сверху, поэтому до конца выборки не больше 99%.
+ * Колбэк зовется только при смене процента, отмена проверяется на каждой строке.
+ */
+class RowProgress
 {
-    QString fileName =  QString::fromStdString(Settings::dbDir()) + QDateTime::currentDateTime().toString("yyyy_MM_dd_hh_mm_ss") + ".html";
-    QFile file(fileName);
-    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        G_ERROR() << "Could not create file:" << file.errorString();
-        QMessageBox::critical(nullptr, "Ошибка", "Невозможно создать файл отчета");
-        return false;
+public:
+    explicit RowProgress(const ReportHelper::Progress &progress) : m_progress(progress) {}
+
+    bool step(int percent)
+    {
+        if (!m_progress) return true;
+        if (percent != m_percent) {
+            m_percent = percent;
+            m_canceled = !m_progress(percent);
+        }
+        return !m_canceled;
     }
-    UnicodedStream out(&file);
-    out.setCodec("UTF-8");
-    out << "<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Результаты</title></head><body>\r\n";
-    //
-    DatabaseManager* db = &DatabaseManager::instance();
-    auto event = db->getEvent(id);
-    auto quiz = db->getQuiz(event["quiz_id"].toInt());
-    out << quiz["text"].toString() << " (" << (quiz["type"].toInt() == 1 ? "Групповой)" : "Индивидуальный)");
-    // Считаем результат
-    QMap<int, int> resMap;
-    auto questions = db->listQuestionsByQuiz(id);
-    for(auto& q : questions) {
-        // Смотрим на результаты
-        for(auto& r : db->listResultsByQuestion(q["question_id"].toInt())) {
-            int participant = r["participant_id"].toInt();
-            if(r["result"].toInt()) {
-                if(!resMap.contains(participant)) resMap[participant] = 0;
-                resMap[participant] += q["points"].toInt();
-            }
+    bool row(qint64 done, qint64 total) { return step(total > 0 ? int(qMin<qint64>(10 + 90 * done / total, 99)) : 10); }
+    bool canceled() const { return m_canceled; }
+
+private:
+    const ReportHelper::Progress &m_progress;
+    int m_percent = -1;
+    bool m_canceled = false;
+};
+
+ReportHelper::Output canceledOutput()
+{
+    ReportHelper::Output res;
+    res.canceled = true;
+    return res;
+}
+
+/**
+ * Ключ кэша для отчета по текущему поколению данных, пустой - не кэшировать
+ */
+QString cacheKey(DatabaseManager &db, const QString &kind, const QStringList &params)
+{
+    if (!ReportCache::instance().isEnabled()) return QString();
+    const qint64 generation = db.dataGeneration();
+    return generation < 0 ? QString() : ReportCache::key(kind, params, generation);
+}
+
+// готовый отчет с теми же параметрами по тем же данным
+bool fromCache(const QString &key, RowProgress &rows, ReportHelper::Output &res)
+{
+    if (key.isEmpty()) return false;
+    res.fileName = ReportCache::instance().lookup(key);
+    if (res.fileName.isEmpty()) return false;
+    rows.step(100);
+    res.ok = true;
+    return true;
+}
+
+/**
+ * Дописать буфер и закрыть файл. Недописанный файл (отмена, ошибка записи или чтения) удаляется,
+ * готовый переносится в кэш.
+ */
+ReportHelper::Output finish(ReportHelper::Output res, QFile &file, HtmlWriter &out, RowProgress &rows,
+                            const QString &dbError, const QString &key)
+{
+    bool written = out.flush();
+    QString fileError = file.errorString();
+    file.close();
+    if (rows.canceled() || !written || !dbError.isEmpty() || !rows.step(100)) {
+        QFile::remove(res.fileName);
+        res.fileName.clear();
+        if (!written) {
+            G_ERROR() << "Could not write report:" << fileError;
+            res.error = "Ошибка записи файла отчета";
+        } else if (!dbError.isEmpty()) {
+            res.error = dbError;
+        } else {
+            res.canceled = true;
         }
+        return res;
     }
-    // Копируем в вектор пар
-    QVector<QPair<int,int>> tv;
-    for(auto it = resMap.begin(); it != resMap.end(); ++it) { 
-        tv.push_back(qMakePair(it.key(), it.value()));
+    if (!key.isEmpty()) res.fileName = ReportCache::instance().store(key, res.fileName);
+    res.ok = true;
+    return res;
+}
+
+} // namespace
+
+QString ReportHelper::newFileName()
+{
+    // отчеты могут формироваться параллельно - к времени добавляется порядковый номер
+    static std::atomic<int> seq{0};
+    return QString::fromStdString(Settings::dbDir()) + QDateTime::currentDateTime().toString("yyyy_MM_dd_hh_mm_ss")
+           + QString("_%1.html").arg(++seq);
+}
+
+bool ReportHelper::show(const Output &output)
+{
+    if (!output.ok) {
+        if (!output.canceled) QMessageBox::critical(nullptr, "Ошибка", output.error);
+        return false;
     }
-    // Сортируем по значению в порядке убывания
-    std::sort(tv.begin(), tv.end(), [](const QPair<int, int>& a, const QPair<int, int>& b) {
-        return a.second > b.second; // убывание значений
-    });
-    // Выводим результат
-    out << "<table border=1><tr>";
-    out << "<td>" <<(quiz["type"].toInt() == 1 ? "Команда" : "Участник") << "</td>";
-    out << "<td>Набрано баллов</td></tr>\r\n";
-    for (const auto& p : tv) {
-        out << "<tr>";
-        auto participant = db->getParticipant(p.second);
-        out << "<td>" << participant["number"].toString() << "</td>";
-        out << "<td>" << p.first << "</td>";
-        out << "</tr>\r\n";
-    }
-    out << "</table>\r\n";
-    // Завершение
-    out << "</body></html>\r\n";
-    file.close();
-    // Открываем браузер
-    QUrl url = QUrl::fromLocalFile(fileName);
-    QDesktopServices::openUrl(url);
+    openReport(output.fileName);
     return true;
 }
 
+void ReportHelper::openReport(const QString &fileName)
+{
+    if (s_openInBrowser) QDesktopServices::openUrl(QUrl::fromLocalFile(fileName));
+}
+
+bool ReportHelper::reportQuiz(quint64 id)
+{
+    return show(writeQuiz(DatabaseManager::instance(), id));
+}
+
 bool ReportHelper::reportTeams(QDateTime dateFrom, QDateTime dateTo)
 {
-    QString fileName =  QString::fromStdString(Settings::dbDir()) + QDateTime::currentDateTime().toString("yyyy_MM_dd_hh_mm_ss") + ".html";
-    QFile file(fileName);
-    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+    return show(writeTeams(DatabaseManager::instance(), dateFrom, dateTo));
+}
+
+bool ReportHelper::reportUsers(QDateTime dateFrom, QDateTime dateTo)
+{
+    return show(writeUsers(DatabaseManager::instance(), dateFrom, dateTo));
+}
+
+bool ReportHelper::reportItems(quint64 quizId)
+{
+    return show(writeItems(DatabaseManager::instance(), quizId));
+}
+
+bool ReportHelper::reportRatings(int kind)
+{
+    return show(writeRatings(DatabaseManager::instance(), kind));
+}
+
+ReportHelper::Output ReportHelper::writeQuiz(DatabaseManager &db, quint64 id, const Progress &progress)
+{
+    RowProgress rows(progress);
+    if (!rows.step(0)) return canceledOutput();
+    Output res;
+    const QString key = cacheKey(db, "quiz", { QString::number(id) });
+    if (fromCache(key, rows, res)) return res;
+    EventRow event = db.getEventRow(id);
+    QuizRow quiz = db.getQuizRow(event.quizId);
+    const qint64 total = db.listParticipantRowsByEvent(id).size();
+    res.fileName = newFileName();
+    QFile file(res.fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
         G_ERROR() << "Could not create file:" << file.errorString();
-        QMessageBox::critical(nullptr, "Ошибка", "Невозможно создать файл отчета");
-        return false;
+        res.error = "Невозможно создать файл отчета";
+        return res;
     }
-    UnicodedStream out(&file);
-    out.setCodec("UTF-8");
-    out << "<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Результаты команды</title></head><body>\r\n";
-    //
-    DatabaseManager* db = &DatabaseManager::instance();
-    auto rteams = db->resultTeams(dateFrom, dateTo);
-    QString teamTitle;
-    int quizId = -1;
-    int games = 0;
-    int points = 0;
-    int totalPoints = 0;
-    out << "Командные результаты с " << dateFrom.toString("dd.MM.yyyy") << " по " << dateTo.toString("dd.MM.yyyy");
-    out << "<table border=1>";
-    out << "<tr><td>Команда</td><td>Игры</td><td>Баллы</td><td>%</td></tr>\r\n";
-    for(auto& r : rteams) {
-        if(r["title"].toString() != teamTitle) {
-            if(!teamTitle.isEmpty()) {
-                out << "<tr>";
-                out << "<td>"<< teamTitle << "</td>";
-                out << "<td>" << games << "</td>";
-                out << "<td>" << points << "</td>";
-                out << "<td>" << (totalPoints > 0 ? 100*points/totalPoints : 0) << "</td>";
-                out << "</tr>\r\n";
-            }
-            teamTitle = r["title"].toString();
-            quizId = -1;
-            games = 0;
-            points = 0;
-            totalPoints = 0;
-        }
-        if(quizId != r["quiz_id"].toInt()) {
-            games++;
-            quizId = r["quiz_id"].toInt();
-        }
-        totalPoints += r["points"].toInt();
-        if(r["result"].toInt() > 0) points += r["points"].toInt();
-    }
-    if(!teamTitle.isEmpty()) {
-        out << "<tr>";
-        out << "<td>" << teamTitle << "</td>";
-        out << "<td>" << games << "</td>";
-        out << "<td>" << points << "</td>";
-        out << "<td>" << (totalPoints > 0 ? 100*points/totalPoints : 0) << "</td>";
-        out << "</tr>\r\n";
-    }
-    out << "</table></body></html>\r\n";
-    file.close();
-    // Открываем браузер
-    QUrl url = QUrl::fromLocalFile(fileName);
-    QDesktopServices::openUrl(url);
-    return true;
+    HtmlWriter out(file);
+    out.raw("<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Результаты</title></head><body>\r\n");
+    out.text(quiz.topic);
+    // Выводим результат, участники уже отсортированы по убыванию баллов
+    if (event.type == 1) {
+        out.raw(" (Групповой)<table border=1><tr><td>Команда</td>");
+    } else {
+        out.raw(" (Индивидуальный)<table border=1><tr><td>Участник</td>");
+    }
+    out.raw("<td>Набрано баллов</td></tr>\r\n");
+    qint64 n = 0;
+    bool ok = db.forEachEventScore(id, [&](const ParticipantScoreRow &p) {
+        if (!rows.row(n++, total)) return false;
+        if (p.answers == 0) return true;
+        out.raw("<tr><td>").number(p.participant.number).raw("</td><td>").number(p.points).raw("</td></tr>\r\n");
+        return out.ok();
+    });
+    // Завершение
+    out.raw("</table>\r\n</body></html>\r\n");
+    return finish(res, file, out, rows, ok ? QString() : db.lastError(), key);
 }
-bool ReportHelper::reportUsers(QDateTime dateFrom, QDateTime dateTo)
+
+ReportHelper::Output ReportHelper::writeTeams(DatabaseManager &db, QDateTime dateFrom, QDateTime dateTo, const Progress &progress)
 {
-    QString fileName =  QString::fromStdString(Settings::dbDir()) + QDateTime::currentDateTime().toString("yyyy_MM_dd_hh_mm_ss") + ".html";
-    QFile file(fileName);
-    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+    RowProgress rows(progress);
+    if (!rows.step(0)) return canceledOutput();
+    Output res;
+    const QString key = cacheKey(db, "teams", { QString::number(dateFrom.toSecsSinceEpoch()), QString::number(dateTo.toSecsSinceEpoch()) });
+    if (fromCache(key, rows, res)) return res;
+    const qint64 total = db.rowCount(DatabaseManager::TableTeam);
+    res.fileName = newFileName();
+    QFile file(res.fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
         G_ERROR() << "Could not create file:" << file.errorString();
-        QMessageBox::critical(nullptr, "Ошибка", "Невозможно создать файл отчета");
-        return false;
+        res.error = "Невозможно создать файл отчета";
+        return res;
     }
-    UnicodedStream out(&file);
-    out.setCodec("UTF-8");
-    out << "<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Результаты участника</title></head><body>\r\n";
-    //
-    DatabaseManager* db = &DatabaseManager::instance();
-    auto rteams = db->resultUsers(dateFrom, dateTo);
-    QString userTitle;
-    int userId = -1;
-    int quizId = -1;
-    int games = 0;
-    int points = 0;
-    int totalPoints = 0;
-    out << "Личные результаты с " << dateFrom.toString("dd.MM.yyyy") << " по " << dateTo.toString("dd.MM.yyyy");
-    out << "<table border=1>";
-    out << "<tr><td>Участник</td><td>Игры</td><td>Баллы</td><td>%</td></tr>\r\n";
-    for(auto& r : rteams) {
-        if(r["user_id"].toInt() != userId) {
-            if(userId != -1) {
-                out << "<tr>";
-                out << "<td>"<< userTitle << "</td>";
-                out << "<td>" << games << "</td>";
-                out << "<td>" << points << "</td>";
-                out << "<td>" << (totalPoints > 0 ? 100*points/totalPoints : 0) << "</td>";
-                out << "</tr>\r\n";
-            }
-            userId = r["user_id"].toInt();
-            userTitle = r["name"].toString() + " " + r["father_name"].toString() + " " + r["surname"].toString();
-            quizId = -1;
-            games = 0;
-            points = 0;
-            totalPoints = 0;
-        }
-        if(quizId != r["quiz_id"].toInt()) {
-            games++;
-            quizId = r["quiz_id"].toInt();
+    HtmlWriter out(file);
+    out.raw("<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Результаты команды</title></head><body>\r\n");
+    out.raw("Командные результаты с ").text(dateFrom.toString("dd.MM.yyyy")).raw(" по ").text(dateTo.toString("dd.MM.yyyy"));
+    out.raw("<table border=1>");
+    out.raw("<tr><td>Команда</td><td>Игры</td><td>Баллы</td><td>%</td></tr>\r\n");
+    qint64 n = 0;
+    bool ok = db.forEachTeamScore(dateFrom, dateTo, [&](const TeamScoreRow &r) {
+        if (!rows.row(n++, total)) return false;
+        out.raw("<tr><td>").text(r.title)
+           .raw("</td><td>").number(r.games)
+           .raw("</td><td>").number(r.points)
+           .raw("</td><td>").number(r.percent)
+           .raw("</td></tr>\r\n");
+        return out.ok();
+    });
+    out.raw("</table></body></html>\r\n");
+    return finish(res, file, out, rows, ok ? QString() : db.lastError(), key);
+}
+
+ReportHelper::Output ReportHelper::writeUsers(DatabaseManager &db, QDateTime dateFrom, QDateTime dateTo, const Progress &progress)
+{
+    RowProgress rows(progress);
+    if (!rows.step(0)) return canceledOutput();
+    Output res;
+    const QString key = cacheKey(db, "users", { QString::number(dateFrom.toSecsSinceEpoch()), QString::number(dateTo.toSecsSinceEpoch()) });
+    if (fromCache(key, rows, res)) return res;
+    const qint64 total = db.rowCount(DatabaseManager::TableUser);
+    res.fileName = newFileName();
+    QFile file(res.fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        G_ERROR() << "Could not create file:" << file.errorString();
+        res.error = "Невозможно создать файл отчета";
+        return res;
+    }
+    HtmlWriter out(file);
+    out.raw("<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Результаты участника</title></head><body>\r\n");
+    out.raw("Личные результаты с ").text(dateFrom.toString("dd.MM.yyyy")).raw(" по ").text(dateTo.toString("dd.MM.yyyy"));
+    out.raw("<table border=1>");
+    out.raw("<tr><td>Участник</td><td>Игры</td><td>Баллы</td><td>%</td></tr>\r\n");
+    qint64 n = 0;
+    bool ok = db.forEachUserScore(dateFrom, dateTo, [&](const UserScoreRow &r) {
+        if (!rows.row(n++, total)) return false;
+        out.raw("<tr><td>").text(r.name).raw(" ").text(r.fatherName).raw(" ").text(r.surname)
+           .raw("</td><td>").number(r.games)
+           .raw("</td><td>").number(r.points)
+           .raw("</td><td>").number(r.percent)
+           .raw("</td></tr>\r\n");
+        return out.ok();
+    });
+    out.raw("</table></body></html>\r\n");
+    return finish(res, file, out, rows, ok ? QString() : db.lastError(), key);
+}
+
+ReportHelper::Output ReportHelper::writeItems(DatabaseManager &db, quint64 quizId, const Progress &progress)
+{
+    RowProgress rows(progress);
+    if (!rows.step(0)) return canceledOutput();
+    Output res;
+    const QString key = cacheKey(db, "items", { QString::number(quizId) });
+    if (fromCache(key, rows, res)) return res;
+    QuizRow quiz = db.getQuizRow(quizId);
+    const QVector<ItemStatsRow> items = db.itemAnalysis(quizId);
+    if (!rows.step(90)) return canceledOutput();
+    res.fileName = newFileName();
+    QFile file(res.fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        G_ERROR() << "Could not create file:" << file.errorString();
+        res.error = "Невозможно создать файл отчета";
+        return res;
+    }
+    HtmlWriter out(file);
+    out.raw("<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Анализ вопросов</title></head><body>\r\n");
+    out.raw("Анализ вопросов: ").text(quiz.topic);
+    out.raw("<table border=1>");
+    out.raw("<tr><td>№</td><td>Вопрос</td><td>Баллы</td><td>Ответов</td><td>Верно</td>"
+            "<td>Доля верных</td><td>Различающая способность</td><td>Оценка</td></tr>\r\n");
+    for (int i = 0; i < items.size(); ++i) {
+        const ItemStatsRow &r = items[i];
+        out.raw("<tr><td>").number(qint64(i + 1))
+           .raw("</td><td>").text(r.question.text)
+           .raw("</td><td>").number(r.question.points)
+           .raw("</td><td>").number(r.attempts)
+           .raw("</td><td>").number(r.correct)
+           .raw("</td><td>").number(r.pValue, 2)
+           .raw("</td><td>").number(r.discrimination, 2)
+           .raw("</td><td>");
+        // границы по классической теории тестов: 0.3-0.8 по доле, от 0.2 по корреляции
+        if (r.attempts == 0) out.raw("нет ответов");
+        else if (r.pValue > 0.8) out.raw("легкий");
+        else if (r.pValue < 0.3) out.raw("трудный");
+        else out.raw("средний");
+        if (r.attempts > 0 && r.discrimination < 0.2) out.raw(", слабо различает");
+        out.raw("</td></tr>\r\n");
+    }
+    out.raw("</table></body></html>\r\n");
+    return finish(res, file, out, rows, QString(), key);
+}
+
+ReportHelper::Output ReportHelper::writeRatings(DatabaseManager &db, int kind, const Progress &progress)
+{
+    // строк таблицы рейтинга за один запрос
+    static const int PAGE_SIZE = 5000;
+    RowProgress rows(progress);
+    if (!rows.step(0)) return canceledOutput();
+    Output res;
+    // рейтинги пишутся с новым поколением данных - отдельный параметр ключа не нужен
+    const QString key = cacheKey(db, "ratings", { QString::number(kind) });
+    if (fromCache(key, rows, res)) return res;
+    const DatabaseManager::RatingKind ratingKind = kind == DatabaseManager::RatingTeam ? DatabaseManager::RatingTeam : DatabaseManager::RatingUser;
+    const qint64 total = db.rowCount(ratingKind == DatabaseManager::RatingTeam ? DatabaseManager::TableTeam : DatabaseManager::TableUser);
+    const int provisionalGames = db.ratingParams().provisionalGames;
+    res.fileName = newFileName();
+    QFile file(res.fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        G_ERROR() << "Could not create file:" << file.errorString();
+        res.error = "Невозможно создать файл отчета";
+        return res;
+    }
+    HtmlWriter out(file);
+    out.raw("<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><title>Рейтинг</title></head><body>\r\n");
+    if (ratingKind == DatabaseManager::RatingTeam) {
+        out.raw("Рейтинг команд<table border=1><tr><td>Место</td><td>Команда</td>");
+    } else {
+        out.raw("Рейтинг участников<table border=1><tr><td>Место</td><td>Участник</td>");
+    }
+    out.raw("<td>Рейтинг</td><td>Игры</td></tr>\r\n");
+    qint64 n = 0;
+    bool more = true;
+    while (more && out.ok()) {
+        const QVector<RatingRow> page = db.leaderboard(ratingKind, PAGE_SIZE, int(n));
+        for (const RatingRow &r : page) {
+            if (!rows.row(n++, total)) break;
+            out.raw("<tr><td>").number(n)
+               .raw("</td><td>").text(r.name)
+               .raw("</td><td>").number(r.rating, 0)
+               .raw("</td><td>").number(qint64(r.games));
+            // рейтинг новичка еще не устоялся
+            if (r.games < provisionalGames) out.raw(" (предварительный)");
+            out.raw("</td></tr>\r\n");
         }
-        totalPoints += r["points"].toInt();
-        if(r["result"].toInt() > 0) points += r["points"].toInt();
-    }
-    if(!userTitle.isEmpty()) {
-        out << "<tr>";
-        out << "<td>"<< userTitle << "</td>";
-        out << "<td>" << games << "</td>";
-        out << "<td>" << points << "</td>";
-        out << "<td>" << (totalPoints > 0 ? 100*points/totalPoints : 0) << "</td>";
-        out << "</tr>\r\n";
-    }
-    out << "</table></body></html>\r\n";
-    file.close();
-    // Открываем браузер
-    QUrl url = QUrl::fromLocalFile(fileName);
-    QDesktopServices::openUrl(url);
-    return true;
+        more = page.size() == PAGE_SIZE && !rows.canceled();
+    }
+    out.raw("</table></body></html>\r\n");
+    return finish(res, file, out, rows, QString(), key);
 }
@@ -0,0 +1,113 @@
+#include "reportrunner.h"
+#include "databasemanager.h"
+#include "asyncdatabase.h"
+#include "unilog/unilog.h"
+#include <QApplication>
+#include <QPointer>
+#include <QProgressDialog>
+#include <QtConcurrent>
+
+ReportRunner::ReportRunner()
+{
+    // report_jobs - сколько отчетов формируется одновременно
+    int jobs = QString::fromStdString(Settings::getParam("report_jobs")).toInt();
+    setMaxConcurrent(jobs > 0 ? jobs : 2);
+}
+
+int ReportRunner::start(const QString &title, Job job)
+{
+    const int id = ++m_lastId;
+    auto cancelFlag = std::make_shared<std::atomic<bool>>(false);
+    m_jobs.insert(id, cancelFlag);
+
+    QFuture<ReportHelper::Output> future = QtConcurrent::run(&m_pool, [this, id, job, cancelFlag]() {
+        if (*cancelFlag) {
+            ReportHelper::Output out;
+            out.canceled = true;
+            return out;
+        }
+        return job(DatabaseManager::instance(), [this, id, cancelFlag](int percent) {
+            QMetaObject::invokeMethod(this, [this, id, percent]() { emit progress(id, percent); }, Qt::QueuedConnection);
+            return !*cancelFlag;
+        });
+    });
+    AsyncDatabase::then(this, future, [this, id, title](const ReportHelper::Output &out) {
+        m_jobs.remove(id);
+        if (out.canceled) {
+            emit canceled(id);
+        } else if (!out.ok) {
+            G_WARN() << "Report" << title << "failed:" << out.error;
+            emit failed(id, out.error);
+        } else {
+            emit finished(id, out.fileName);
+        }
+    });
+    emit started(id, title);
+    return id;
+}
+
+int ReportRunner::startQuiz(quint64 eventId)
+{
+    return start("Отчет по мероприятию", [eventId](DatabaseManager &db, const ReportHelper::Progress &progress) {
+        return ReportHelper::writeQuiz(db, eventId, progress);
+    });
+}
+
+int ReportRunner::startTeams(const QDateTime &dateFrom, const QDateTime &dateTo)
+{
+    return start("Отчет по командам", [dateFrom, dateTo](DatabaseManager &db, const ReportHelper::Progress &progress) {
+        return ReportHelper::writeTeams(db, dateFrom, dateTo, progress);
+    });
+}
+
+int ReportRunner::startUsers(const QDateTime &dateFrom, const QDateTime &dateTo)
+{
+    return start("Отчет по участникам", [dateFrom, dateTo](DatabaseManager &db, const ReportHelper::Progress &progress) {
+        return ReportHelper::writeUsers(db, dateFrom, dateTo, progress);
+    });
+}
+
+int ReportRunner::startWithProgress(const QString &title, Job job, QWidget *parent)
+{
+    // немодальное окно: можно запустить следующий отчет, не дожидаясь этого
+    auto *dialog = new QProgressDialog(title + "...", "Отмена", 0, 100, parent);
+    dialog->setWindowModality(Qt::NonModal);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->setMinimumDuration(500);
+    dialog->setAutoClose(false);
+    dialog->setAutoReset(false);
+    dialog->setValue(0);
+
+    const int id = start(title, job);
+    QPointer<QProgressDialog> guard(dialog);
+    connect(dialog, &QProgressDialog::canceled, this, [this, id]() { cancel(id); });
+    auto *context = new QObject(dialog);
+    connect(this, &ReportRunner::progress, context, [guard, id](int jobId, int percent) {
+        if (jobId == id && guard) guard->setValue(percent);
+    });
+    connect(this, &ReportRunner::finished, context, [guard, id](int jobId, const QString &fileName) {
+        if (jobId != id) return;
+        if (guard) guard->close();
+        ReportHelper::openReport(fileName);
+    });
+    connect(this, &ReportRunner::failed, context, [guard, id, parent](int jobId, const QString &error) {
+        if (jobId != id) return;
+        if (guard) guard->close();
+        QMessageBox::critical(parent, "Ошибка", error);
+    });
+    connect(this, &ReportRunner::canceled, context, [guard, id](int jobId) {
+        if (jobId == id && guard) guard->close();
+    });
+    return id;
+}
+
+void ReportRunner::cancel(int id)
+{
+    auto it = m_jobs.find(id);
+    if (it != m_jobs.end()) *it.value() = true;
+}
+
+void ReportRunner::cancelAll()
+{
+    for (auto &flag : m_jobs) *flag = true;
+}
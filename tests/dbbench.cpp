@@ -0,0 +1,331 @@
+#include "databasemanager.h"
+#include "reporthelper.h"
+#include "queryprofiler.h"
+#include "reportcache.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/**
+ * Бенчмарк БД на синтетических данных нашего масштаба.
+ * Генератор детерминирован (seed), размеры задаются ключами. Данные пишутся в quiz.db
+ * одной транзакцией и по умолчанию откатываются в конце (--keep - оставить).
+ * Каждая операция замеряется отдельно, результат - JSON с p50/p95/p99, строк/с и пиковой памятью.
+ */
+
+struct Sizes {
+    int users = 20000;
+    int teams = 500;
+    int teamSize = 5;
+    int quizzes = 200;
+    int questions = 20;   // на квиз
+    int answers = 4;      // на вопрос
+    int events = 2000;
+    int participants = 30; // на мероприятие
+    int iterations = 200; // замеров точечных чтений
+    int reports = 3;      // замеров отчетов
+};
+
+struct Samples {
+    QVector<qint64> ns;
+    qint64 rows = 0;
+};
+
+static QMap<QString, Samples> samples;
+
+// fn возвращает число обработанных строк
+template<typename F>
+static void measure(const QString &op, F fn)
+{
+    QElapsedTimer timer;
+    timer.start();
+    int rows = fn();
+    Samples &s = samples[op];
+    s.ns.append(timer.nsecsElapsed());
+    s.rows += rows;
+}
+
+static qint64 percentile(const QVector<qint64> &sorted, double p)
+{
+    // nearest-rank
+    int idx = qBound(0, int(std::ceil(p * sorted.size())) - 1, sorted.size() - 1);
+    return sorted[idx];
+}
+
+static qint64 peakRssKb()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return qint64(pmc.PeakWorkingSetSize / 1024);
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef Q_OS_MACOS
+    return usage.ru_maxrss / 1024; // байты
+#else
+    return usage.ru_maxrss;        // килобайты
+#endif
+#endif
+}
+
+static const char *SYLLABLES[] = { "ка", "ло", "ми", "ра", "то", "ве", "ни", "су", "де", "по", "ша", "ко" };
+
+static QString word(std::mt19937_64 &rng, int syllables)
+{
+    QString w;
+    for (int i = 0; i < syllables; ++i) w += QString::fromUtf8(SYLLABLES[rng() % (sizeof(SYLLABLES) / sizeof(*SYLLABLES))]);
+    return w;
+}
+
+static QString sentence(std::mt19937_64 &rng, int words)
+{
+    QStringList list;
+    for (int i = 0; i < words; ++i) list << word(rng, 2 + int(rng() % 3));
+    return list.join(' ');
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    Sizes size;
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Бенчмарк базы данных на синтетических данных");
+    parser.addHelpOption();
+    QCommandLineOption seedOpt("seed", "Зерно генератора", "n", "1");
+    QCommandLineOption usersOpt("users", "Физлиц", "n", QString::number(size.users));
+    QCommandLineOption teamsOpt("teams", "Команд", "n", QString::number(size.teams));
+    QCommandLineOption quizzesOpt("quizzes", "Квизов", "n", QString::number(size.quizzes));
+    QCommandLineOption questionsOpt("questions", "Вопросов на квиз", "n", QString::number(size.questions));
+    QCommandLineOption eventsOpt("events", "Мероприятий", "n", QString::number(size.events));
+    QCommandLineOption participantsOpt("participants", "Участников на мероприятие", "n", QString::number(size.participants));
+    QCommandLineOption iterationsOpt("iterations", "Замеров точечных чтений", "n", QString::number(size.iterations));
+    QCommandLineOption outOpt("out", "Файл для JSON (по умолчанию stdout)", "file");
+    QCommandLineOption keepOpt("keep", "Зафиксировать сгенерированные данные в quiz.db");
+    QCommandLineOption profileOpt("profile", "Добавить статистику по SQL-запросам");
+    parser.addOptions({seedOpt, usersOpt, teamsOpt, quizzesOpt, questionsOpt, eventsOpt, participantsOpt, iterationsOpt, outOpt, keepOpt, profileOpt});
+    parser.process(app);
+
+    const quint64 seed = parser.value(seedOpt).toULongLong();
+    size.users = qMax(1, parser.value(usersOpt).toInt());
+    size.teams = qMax(1, parser.value(teamsOpt).toInt());
+    size.quizzes = qMax(1, parser.value(quizzesOpt).toInt());
+    size.questions = qMax(1, parser.value(questionsOpt).toInt());
+    size.events = qMax(1, parser.value(eventsOpt).toInt());
+    size.participants = qMax(1, parser.value(participantsOpt).toInt());
+    size.iterations = qMax(1, parser.value(iterationsOpt).toInt());
+    std::mt19937_64 rng(seed);
+
+    DatabaseManager* db = &DatabaseManager::instance();
+    if(!db->open() || !db->createTables()) {
+        qWarning() << "Ошибка открытия/создания базы данных" << db->lastError();
+        return 1;
+    }
+    // меряем SQLite, а не кэш сущностей и готовых отчетов
+    db->setEntityCacheEnabled(false);
+    ReportCache::instance().setEnabled(false);
+    ReportHelper::setOpenInBrowser(false);
+    QueryProfiler::instance().setEnabled(parser.isSet(profileOpt));
+
+    QElapsedTimer total;
+    total.start();
+    DatabaseManager::Transaction tr(*db);
+    if(!tr.isActive()) {
+        qWarning() << "Ошибка начала транзакции" << db->lastError();
+        return 1;
+    }
+
+    // --- Генерация ---
+    QVector<qint64> users, teams, quizzes, events;
+    QHash<qint64, QVector<qint64>> quizQuestions;
+    bool ok = true;
+    for (int i = 0; i < size.users && ok; ++i) {
+        qint64 id;
+        QString surname = word(rng, 3), name = word(rng, 2), father = word(rng, 3);
+        measure("addUser", [&]() { ok = db->addUser(surname, name, father, id); return 1; });
+        users.append(id);
+    }
+    for (int i = 0; i < size.teams && ok; ++i) {
+        qint64 id;
+        QString title = sentence(rng, 2);
+        measure("addTeam", [&]() { ok = db->addTeam(title, id); return 1; });
+        teams.append(id);
+        QSet<qint64> members;
+        while (members.size() < qMin(size.teamSize, users.size())) members.insert(users[rng() % users.size()]);
+        for (qint64 userId : members) {
+            measure("addTeamUser", [&]() { ok &= db->addTeamUser(userId, id); return 1; });
+        }
+    }
+    for (int i = 0; i < size.quizzes && ok; ++i) {
+        qint64 quizId;
+        QString topic = sentence(rng, 3);
+        measure("addQuiz", [&]() { ok = db->addQuiz(topic, 30 + qint64(rng() % 60), quizId); return 1; });
+        quizzes.append(quizId);
+        for (int j = 0; j < size.questions && ok; ++j) {
+            qint64 questionId;
+            QString text = sentence(rng, 8) + "?";
+            qint64 points = 1 + qint64(rng() % 5);
+            measure("addQuestion", [&]() { ok = db->addQuestion(quizId, text, points, 1 + qint64(rng() % size.answers), questionId); return 1; });
+            quizQuestions[quizId].append(questionId);
+            QStringList answers;
+            for (int k = 0; k < size.answers; ++k) answers << sentence(rng, 2);
+            measure("replaceAnswers", [&]() { ok &= db->replaceAnswers(questionId, answers); return answers.size(); });
+        }
+    }
+    // мероприятия за последние два года
+    const QDateTime now = QDateTime::currentDateTime();
+    for (int i = 0; i < size.events && ok; ++i) {
+        qint64 eventId;
+        qint64 quizId = quizzes[rng() % quizzes.size()];
+        int type = rng() % 10 < 3 ? 1 : 0;
+        QDateTime time = now.addSecs(-qint64(rng() % (730LL * 24 * 3600)));
+        QString title = sentence(rng, 3);
+        measure("addEvent", [&]() { ok = db->addEvent(quizId, title, time, type, eventId); return 1; });
+        events.append(eventId);
+        const QVector<qint64> &questions = quizQuestions[quizId];
+        for (int p = 0; p < size.participants && ok; ++p) {
+            qint64 participantId;
+            qint64 userId = type == 0 ? users[rng() % users.size()] : 0;
+            qint64 teamId = type == 1 ? teams[rng() % teams.size()] : 0;
+            measure("addParticipant", [&]() { ok = db->addParticipant(eventId, userId, teamId, p + 1, participantId); return 1; });
+            QVector<ResultRow> results;
+            results.reserve(questions.size());
+            for (qint64 questionId : questions) {
+                ResultRow r;
+                r.questionId = questionId;
+                r.participantId = participantId;
+                r.eventId = eventId;
+                r.result = rng() % 100 < 60;
+                results.append(r);
+            }
+            measure("addResults", [&]() { ok &= db->addResults(results); return results.size(); });
+        }
+    }
+    if (!ok) {
+        qWarning() << "Ошибка генерации данных" << db->lastError();
+        return 1;
+    }
+    const qint64 fillMs = total.elapsed();
+
+    // --- Чтение ---
+    for (int i = 0; i < size.iterations; ++i) {
+        qint64 userId = users[rng() % users.size()];
+        qint64 eventId = events[rng() % events.size()];
+        qint64 quizId = quizzes[rng() % quizzes.size()];
+        measure("getUser", [&]() { return db->getUser(userId).isEmpty() ? 0 : 1; });
+        measure("getEvent", [&]() { return db->getEvent(eventId).isEmpty() ? 0 : 1; });
+        measure("getQuiz", [&]() { return db->getQuiz(quizId).isEmpty() ? 0 : 1; });
+        measure("listParticipantRowsByEvent", [&]() { return db->listParticipantRowsByEvent(eventId).size(); });
+        measure("eventScores", [&]() { return db->eventScores(eventId).size(); });
+        measure("loadQuizGraph", [&]() { return db->loadQuizGraph(quizId).questions.size(); });
+        QString query = word(rng, 2);
+        measure("searchQuestions", [&]() { return db->searchQuestions(query).size(); });
+    }
+    // постраничный обход всего списка мероприятий и квизов
+    PageKey key;
+    for (;;) {
+        QVector<EventRow> page;
+        measure("listEventsPage", [&]() { page = db->listEventsPage(key, 100); return page.size(); });
+        if (page.size() < 100) break;
+        key = DatabaseManager::eventPageKey(page.last(), DatabaseManager::EventSortTime);
+    }
+    key = PageKey();
+    for (;;) {
+        QVector<QuizRow> page;
+        measure("listQuizzesPage", [&]() { page = db->listQuizzesPage(key, 100); return page.size(); });
+        if (page.size() < 100) break;
+        key = DatabaseManager::quizPageKey(page.last(), DatabaseManager::QuizSortId);
+    }
+    const QDateTime from = now.addYears(-1);
+    for (int i = 0; i < size.reports; ++i) {
+        measure("listUsers", [&]() { return db->listUsers().size(); });
+        measure("listEvents", [&]() { return db->listEvents().size(); });
+        measure("teamScores", [&]() { return db->teamScores(from, now).size(); });
+        measure("userScores", [&]() { return db->userScores(from, now).size(); });
+        measure("resultTeams", [&]() { return db->resultTeams(from, now).size(); });
+        measure("resultUsers", [&]() { return db->resultUsers(from, now).size(); });
+        qint64 eventId = events[rng() % events.size()];
+        measure("ReportHelper::reportQuiz", [&]() { return ReportHelper::reportQuiz(eventId) ? 1 : 0; });
+        measure("ReportHelper::reportTeams", [&]() { return ReportHelper::reportTeams(from, now) ? 1 : 0; });
+        measure("ReportHelper::reportUsers", [&]() { return ReportHelper::reportUsers(from, now) ? 1 : 0; });
+    }
+
+    if (parser.isSet(keepOpt)) tr.commit();
+    else tr.rollback();
+
+    // --- Отчет ---
+    QJsonObject operations;
+    for (auto it = samples.begin(); it != samples.end(); ++it) {
+        QVector<qint64> sorted = it.value().ns;
+        std::sort(sorted.begin(), sorted.end());
+        qint64 sum = 0;
+        for (qint64 ns : sorted) sum += ns;
+        QJsonObject op;
+        op["count"] = sorted.size();
+        op["rows"] = it.value().rows;
+        op["totalMs"] = sum / 1e6;
+        op["p50Us"] = percentile(sorted, 0.50) / 1e3;
+        op["p95Us"] = percentile(sorted, 0.95) / 1e3;
+        op["p99Us"] = percentile(sorted, 0.99) / 1e3;
+        op["maxUs"] = sorted.last() / 1e3;
+        op["rowsPerSec"] = sum > 0 ? it.value().rows * 1e9 / sum : 0.0;
+        operations[it.key()] = op;
+    }
+    QJsonObject sizes;
+    sizes["users"] = size.users;
+    sizes["teams"] = size.teams;
+    sizes["quizzes"] = size.quizzes;
+    sizes["questionsPerQuiz"] = size.questions;
+    sizes["events"] = size.events;
+    sizes["participantsPerEvent"] = size.participants;
+    sizes["results"] = qint64(size.events) * size.participants * size.questions;
+    QJsonObject root;
+    root["seed"] = QString::number(seed);
+    root["schemaVersion"] = db->schemaVersion();
+    root["synchronous"] = db->synchronous();
+    root["sizes"] = sizes;
+    root["fillMs"] = fillMs;
+    root["totalMs"] = total.elapsed();
+    root["peakRssKb"] = peakRssKb();
+    root["operations"] = operations;
+    if (parser.isSet(profileOpt)) {
+        QJsonArray statements;
+        for (const auto &st : QueryProfiler::instance().stats()) {
+            QJsonObject o;
+            o["sql"] = st.sql.simplified();
+            o["count"] = qint64(st.count);
+            o["totalMs"] = st.totalNs / 1e6;
+            o["maxMs"] = st.maxNs / 1e6;
+            o["p99Ms"] = st.percentileNs(0.99) / 1e6;
+            statements.append(o);
+        }
+        root["statements"] = statements;
+    }
+    QByteArray json = QJsonDocument(root).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet(outOpt)) {
+        QFile file(parser.value(outOpt));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "Ошибка записи" << file.fileName() << file.errorString();
+            return 1;
+        }
+        file.write(json);
+    } else {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    db->close();
+    return 0;
+}
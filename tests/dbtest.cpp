@@ -1,5 +1,8 @@
 #include "databasemanager.h"
+#include "importhelper.h"
 #include <QDebug>
+#include <QDir>
+#include <QFile>
 
 int main(int argc, char *argv[])
 {
@@ -12,6 +15,12 @@ int main(int argc, char *argv[])
         qWarning() << "Ошибка создания таблиц";
         return -1;
     }
+    // уведомления об изменениях: сразу вне транзакции, после фиксации внутри, ничего при откате
+    int inserted = 0, deleted = 0;
+    QObject::connect(&DatabaseManager::instance(), &DatabaseManager::rowInserted,
+                     [&](DatabaseManager::Table table, qint64) { if (table == DatabaseManager::TableUser) inserted++; });
+    QObject::connect(&DatabaseManager::instance(), &DatabaseManager::rowDeleted,
+                     [&](DatabaseManager::Table table, qint64) { if (table == DatabaseManager::TableUser) deleted++; });
     qint64 id;
     if(!DatabaseManager::instance().addUser("test", "test", "test", id)) {
         qWarning() << "Ошибка добавления участника";
@@ -21,6 +30,113 @@ int main(int argc, char *argv[])
         qWarning() << "Ошибка удаления участника";
         return 1;
     }
+    if(inserted != 1 || deleted != 1) {
+        qWarning() << "Нет уведомлений об изменениях";
+        return 1;
+    }
+    {
+        DatabaseManager::Transaction tr(DatabaseManager::instance());
+        DatabaseManager::instance().addUser("test", "test", "test", id);
+        if(inserted != 1) {
+            qWarning() << "Уведомление отправлено до фиксации транзакции";
+            return 1;
+        }
+    }
+    if(inserted != 1) {
+        qWarning() << "Уведомление отправлено после отката транзакции";
+        return 1;
+    }
+    // Полнотекстовый поиск: индекс обновляется триггерами, данные откатываются
+    {
+        DatabaseManager* db = &DatabaseManager::instance();
+        DatabaseManager::Transaction tr(*db);
+        qint64 quizId, questionId;
+        if(!db->addQuiz("Поиск", 30, quizId) || !db->addQuestion(quizId, "Столица Бразилии?", 1, 1, questionId)
+            || !db->replaceAnswers(questionId, {"Бразилиа", "Рио-де-Жанейро", "Сан-Паулу"})) {
+            qWarning() << "Ошибка добавления вопроса" << db->lastError();
+            return 1;
+        }
+        auto found = db->searchQuestions("столиц бразил");
+        if(found.isEmpty() || found.first().questionId != questionId) {
+            qWarning() << "Вопрос не найден по тексту" << db->lastError();
+            return 1;
+        }
+        if(db->searchQuestions("жанейро").isEmpty()) {
+            qWarning() << "Вопрос не найден по ответу" << db->lastError();
+            return 1;
+        }
+        db->removeQuestion(questionId);
+        if(!db->searchQuestions("бразилии").isEmpty()) {
+            qWarning() << "Удаленный вопрос остался в индексе";
+            return 1;
+        }
+    }
+    // кэш сущностей: повторное чтение без запроса, запись сбрасывает запись кэша
+    {
+        DatabaseManager* db = &DatabaseManager::instance();
+        qint64 userId;
+        if(!db->addUser("cache", "cache", "cache", userId)) {
+            qWarning() << "Ошибка добавления участника";
+            return 1;
+        }
+        db->getUser(userId);
+        auto before = db->entityCacheStats();
+        auto users = db->getUsers({userId, userId});
+        auto after = db->entityCacheStats();
+        if(users.size() != 2 || users[1]["name"].toString() != "cache" || after.hits != before.hits + 2) {
+            qWarning() << "Повторное чтение не попало в кэш";
+            return 1;
+        }
+        db->updateUser(userId, "cache", "changed", "cache");
+        if(db->getUser(userId)["name"].toString() != "changed") {
+            qWarning() << "Кэш не сброшен после изменения";
+            return 1;
+        }
+        db->removeUser(userId);
+        if(!db->getUser(userId).isEmpty()) {
+            qWarning() << "Удаленное физлицо осталось в кэше";
+            return 1;
+        }
+    }
+    // импорт: дубль без учета регистра, поле в кавычках с разделителем, строка без имени
+    {
+        DatabaseManager* db = &DatabaseManager::instance();
+        QString path = QDir::temp().filePath("viktorium-import-test.csv");
+        QFile csv(path);
+        if(!csv.open(QIODevice::WriteOnly)) {
+            qWarning() << "Ошибка создания файла импорта";
+            return 1;
+        }
+        csv.write("surname;name;father_name\n"
+                  "Импортов;Тест;Первый\n"
+                  "импортов;тест;первый\n"
+                  "\"Импортов; второй\";Тест;\n"
+                  "Импортов;;Без имени\n");
+        csv.close();
+        auto res = ImportHelper::importFile(*db, ImportHelper::Users, path);
+        QFile::remove(path);
+        if(!res.ok || res.rows != 4 || res.inserted != 2 || res.duplicates != 1 || res.failed != 1 || res.errors.first().line != 5) {
+            qWarning() << "Ошибка импорта" << res.error << res.rows << res.inserted << res.duplicates << res.failed;
+            return 1;
+        }
+        db->removeUser(db->getUser("Импортов", "Тест", "Первый"));
+        db->removeUser(db->getUser("Импортов; второй", "Тест", ""));
+    }
+    // горячая копия: файл проверяется и открывается как обычная БД
+    {
+        DatabaseManager* db = &DatabaseManager::instance();
+        QString path = QDir::temp().filePath("viktorium-backup-test.db");
+        int done = -1;
+        if(!db->backupTo(path, [&](int percent) { done = percent; }) || done != 100) {
+            qWarning() << "Ошибка резервного копирования" << db->lastError();
+            return 1;
+        }
+        if(!db->verifyBackup(path)) {
+            qWarning() << "Резервная копия не прошла проверку" << db->lastError();
+            return 1;
+        }
+        QFile::remove(path);
+    }
     DatabaseManager::instance().close();
     qDebug() << "OK";
     return 0;
@@ -1,8 +1,14 @@
 #include "databasemanager.h"
 #include "reporthelper.h"
+#include "exporthelper.h"
+#include "reportrunner.h"
+#include "reportcache.h"
 #include <QDateTime>
 #include <QApplication>
 #include <QDebug>
+#include <QEventLoop>
+#include <QDir>
+#include <QFile>
 
 int main(int argc, char *argv[])
 {
@@ -29,7 +35,7 @@ int main(int argc, char *argv[])
         return 1;
     }
     qint64 quizId;
-    if(!db->addQuiz("Test topic", 5, quizId)) {
+    if(!db->addQuiz("Test <topic> & \"ёж\" \U0001F600", 5, quizId)) {
         qWarning() << "Ошибка добавления квиза";
         return 1;
     }
@@ -78,6 +84,226 @@ int main(int argc, char *argv[])
         qWarning() << "Ошибка добавления результата 22";
         return 1;
     }
+    // база теста не очищается между запусками - проверяем только добавленных физлиц
+    QMap<qint64, UserScoreRow> scores;
+    for(auto& s : db->userScores(QDateTime::currentDateTime().addDays(-5), QDateTime::currentDateTime().addDays(5))) {
+        scores.insert(s.userId, s);
+    }
+    if(!scores.contains(userId1) || !scores.contains(userId2)) {
+        qWarning() << "Нет итогов добавленных физлиц";
+        return 1;
+    }
+    const UserScoreRow score1 = scores.value(userId1), score2 = scores.value(userId2);
+    if(score1.points != 5 || score1.totalPoints != 8 || score1.percent != 62
+        || score2.points != 8 || score2.percent != 100 || score2.games != 1) {
+        qWarning() << "Ошибка подсчета баллов участников";
+        return 1;
+    }
+    // счет поддерживается триггерами и должен совпасть с пересчетом с нуля
+    auto live = db->eventScores(eventId);
+    if(live.size() != 2 || live[0].points != 8 || live[1].points != 5) {
+        qWarning() << "Ошибка счета участников мероприятия";
+        return 1;
+    }
+    if(!db->rebuildScores()) {
+        qWarning() << "Ошибка пересчета счета" << db->lastError();
+        return 1;
+    }
+    auto rebuilt = db->eventScores(eventId);
+    for(int i = 0; i < live.size(); ++i) {
+        if(rebuilt[i].points != live[i].points || rebuilt[i].totalPoints != live[i].totalPoints) {
+            qWarning() << "Счет после пересчета отличается";
+            return 1;
+        }
+    }
+    // выгрузка по мероприятию: заголовок и четыре ответа, gzip начинается с сигнатуры 1f 8b
+    {
+        AnswerExportFilter filter;
+        filter.eventIds.append(eventId);
+        QString path = QDir::temp().filePath("viktorium-export-test.csv");
+        auto res = ExportHelper::exportAnswers(*db, path, ExportHelper::Csv, false, filter);
+        QFile csv(path);
+        int lines = 0;
+        if(csv.open(QIODevice::ReadOnly)) {
+            while(!csv.atEnd()) { csv.readLine(); ++lines; }
+            csv.close();
+        }
+        QFile::remove(path);
+        if(!res.ok || res.rows != 4 || lines != 5) {
+            qWarning() << "Ошибка выгрузки CSV" << res.error << res.rows << lines;
+            return 1;
+        }
+        res = ExportHelper::exportAnswers(*db, path + ".gz", ExportHelper::JsonLines, true, filter);
+        QFile gz(path + ".gz");
+        QByteArray magic = gz.open(QIODevice::ReadOnly) ? gz.read(2) : QByteArray();
+        gz.close();
+        QFile::remove(path + ".gz");
+        if(!res.ok || res.rows != 4 || magic != QByteArray("\x1f\x8b", 2)) {
+            qWarning() << "Ошибка выгрузки gzip" << res.error << res.rows;
+            return 1;
+        }
+    }
+    // потоковый HTML: текст из базы экранируется и пишется в UTF-8, включая символы вне BMP
+    {
+        auto out = ReportHelper::writeQuiz(*db, eventId);
+        QFile html(out.fileName);
+        QByteArray content = html.open(QIODevice::ReadOnly) ? html.readAll() : QByteArray();
+        html.close();
+        QFile::remove(out.fileName);
+        if(!out.ok || !content.contains(QString("Test &lt;topic&gt; &amp; &quot;ёж&quot; \U0001F600").toUtf8())
+            || content.count("<tr>") != 3) {
+            qWarning() << "Ошибка HTML отчета" << out.error;
+            return 1;
+        }
+    }
+    // анализ вопросов: на первый вопрос оба ответили верно, на второй - один из двух
+    {
+        auto items = db->itemAnalysis(quizId);
+        if(items.size() != 2 || items[0].attempts != 2 || items[0].pValue != 1.0 || items[0].discrimination != 0
+            || items[1].attempts != 2 || items[1].correct != 1 || items[1].pValue != 0.5) {
+            qWarning() << "Ошибка анализа вопросов";
+            return 1;
+        }
+        auto out = ReportHelper::writeItems(*db, quizId);
+        if(!out.ok || !QFile::exists(out.fileName)) {
+            qWarning() << "Ошибка отчета по вопросам" << out.error;
+            return 1;
+        }
+    }
+    // рейтинг: победитель мероприятия растет, полный пересчет совпадает с пошаговым
+    {
+        int rated = 0;
+        if(!db->updateRatings(rated) || rated < 1) {
+            qWarning() << "Ошибка обновления рейтинга" << db->lastError();
+            return 1;
+        }
+        auto winner = db->ratingHistory(DatabaseManager::RatingUser, userId2);
+        auto loser = db->ratingHistory(DatabaseManager::RatingUser, userId1);
+        if(winner.isEmpty() || loser.isEmpty() || winner.last().eventId != eventId
+            || winner.last().ratingAfter <= winner.last().ratingBefore || loser.last().ratingAfter >= loser.last().ratingBefore
+            || db->ratingRank(DatabaseManager::RatingUser, userId2) >= db->ratingRank(DatabaseManager::RatingUser, userId1)) {
+            qWarning() << "Ошибка расчета рейтинга";
+            return 1;
+        }
+        // повтор без изменений ничего не пересчитывает
+        if(!db->updateRatings(rated) || rated != 0) {
+            qWarning() << "Лишний пересчет рейтинга" << rated;
+            return 1;
+        }
+        if(!db->rebuildRatings(db->ratingParams())) {
+            qWarning() << "Ошибка полного пересчета рейтинга" << db->lastError();
+            return 1;
+        }
+        auto rebuilt = db->ratingHistory(DatabaseManager::RatingUser, userId2);
+        if(rebuilt.size() != winner.size() || qAbs(rebuilt.last().ratingAfter - winner.last().ratingAfter) > 1e-6) {
+            qWarning() << "Полный пересчет рейтинга отличается от пошагового";
+            return 1;
+        }
+        // баллы переходят между участниками при тех же суммах мероприятия - пересчет все равно нужен
+        if(!db->updateParticipant(participantId1, eventId, userId2, 0, 1) || !db->updateParticipant(participantId2, eventId, userId1, 0, 2)
+            || !db->updateRatings(rated) || rated < 1
+            || db->ratingRank(DatabaseManager::RatingUser, userId1) >= db->ratingRank(DatabaseManager::RatingUser, userId2)) {
+            qWarning() << "Обмен участниками не пересчитал рейтинг" << rated << db->lastError();
+            return 1;
+        }
+        if(!db->updateParticipant(participantId1, eventId, userId1, 0, 1) || !db->updateParticipant(participantId2, eventId, userId2, 0, 2)
+            || !db->updateRatings(rated) || rated < 1) {
+            qWarning() << "Ошибка обратного обмена участниками" << db->lastError();
+            return 1;
+        }
+    }
+    // рейтинг мероприятий с физлицами и командами: полный пересчет совпадает с пошаговым для обоих видов
+    {
+        qint64 userId3, userId4, teamId1, teamId2;
+        if(!db->addUser("test3", "test3", "test3", userId3) || !db->addUser("test4", "test4", "test4", userId4)
+            || !db->addTeam("Team 1", teamId1) || !db->addTeam("Team 2", teamId2)) {
+            qWarning() << "Ошибка добавления участников рейтинга" << db->lastError();
+            return 1;
+        }
+        auto play = [&](qint64 event, qint64 user, qint64 team, int number, bool first, bool second) {
+            qint64 participantId, resultId;
+            return db->addParticipant(event, user, team, number, participantId)
+                && db->addResult(questionId1, participantId, event, first, resultId)
+                && db->addResult(questionId2, participantId, event, second, resultId);
+        };
+        qint64 mixedId1, mixedId2;
+        if(!db->addEvent(quizId, "Mixed 1", QDateTime::currentDateTime().addSecs(3600), false, mixedId1)
+            || !db->addEvent(quizId, "Mixed 2", QDateTime::currentDateTime().addSecs(7200), false, mixedId2)
+            || !play(mixedId1, userId3, 0, 1, true, true) || !play(mixedId1, userId4, 0, 2, true, false)
+            || !play(mixedId1, 0, teamId1, 3, true, true) || !play(mixedId1, 0, teamId2, 4, false, false)
+            || !play(mixedId2, userId3, 0, 1, false, false) || !play(mixedId2, userId4, 0, 2, true, true)
+            || !play(mixedId2, 0, teamId1, 3, true, false) || !play(mixedId2, 0, teamId2, 4, true, true)) {
+            qWarning() << "Ошибка добавления смешанных мероприятий" << db->lastError();
+            return 1;
+        }
+        int rated = 0;
+        if(!db->updateRatings(rated) || rated < 2) {
+            qWarning() << "Ошибка обновления рейтинга смешанных мероприятий" << rated << db->lastError();
+            return 1;
+        }
+        const QVector<QPair<DatabaseManager::RatingKind, qint64>> keys = {
+            { DatabaseManager::RatingUser, userId3 }, { DatabaseManager::RatingUser, userId4 },
+            { DatabaseManager::RatingTeam, teamId1 }, { DatabaseManager::RatingTeam, teamId2 } };
+        QVector<QVector<RatingHistoryRow>> incremental;
+        for(const auto &key : keys) incremental.append(db->ratingHistory(key.first, key.second));
+        if(!db->rebuildRatings(db->ratingParams())) {
+            qWarning() << "Ошибка полного пересчета рейтинга" << db->lastError();
+            return 1;
+        }
+        for(int i = 0; i < keys.size(); ++i) {
+            auto rebuilt = db->ratingHistory(keys[i].first, keys[i].second);
+            bool same = rebuilt.size() == 2 && incremental[i].size() == 2;
+            for(int j = 0; same && j < rebuilt.size(); ++j) {
+                same = rebuilt[j].eventId == incremental[i][j].eventId
+                    && qAbs(rebuilt[j].ratingBefore - incremental[i][j].ratingBefore) < 1e-6
+                    && qAbs(rebuilt[j].ratingAfter - incremental[i][j].ratingAfter) < 1e-6;
+            }
+            if(!same) {
+                qWarning() << "Полный пересчет смешанных мероприятий отличается от пошагового" << i;
+                return 1;
+            }
+        }
+    }
+    // кэш отчетов: повтор по тем же данным отдает тот же файл, запись в базу меняет поколение
+    {
+        QDateTime from = QDateTime::currentDateTime().addDays(-5), to = QDateTime::currentDateTime().addDays(5);
+        auto first = ReportHelper::writeTeams(*db, from, to);
+        quint64 hits = ReportCache::instance().stats().hits;
+        auto second = ReportHelper::writeTeams(*db, from, to);
+        qint64 generation = db->dataGeneration();
+        if(!db->updateQuiz(quizId, "Test <topic> & \"ёж\" \U0001F600", 5)) {
+            qWarning() << "Ошибка изменения квиза" << db->lastError();
+            return 1;
+        }
+        auto third = ReportHelper::writeTeams(*db, from, to);
+        if(!first.ok || second.fileName != first.fileName || ReportCache::instance().stats().hits != hits + 1
+            || db->dataGeneration() <= generation || third.fileName == first.fileName || !QFile::exists(third.fileName)) {
+            qWarning() << "Ошибка кэша отчетов" << first.fileName << second.fileName << third.fileName;
+            return 1;
+        }
+    }
+    // фоновые отчеты: два параллельно и один отмененный до запуска
+    {
+        ReportHelper::setOpenInBrowser(false);
+        ReportRunner& runner = ReportRunner::instance();
+        runner.setMaxConcurrent(2);
+        QStringList files;
+        int canceled = 0, failed = 0, pending = 3;
+        QEventLoop loop;
+        QObject::connect(&runner, &ReportRunner::finished, &loop, [&](int, const QString &fileName) { files << fileName; if(--pending == 0) loop.quit(); });
+        QObject::connect(&runner, &ReportRunner::failed, &loop, [&](int, const QString &) { ++failed; if(--pending == 0) loop.quit(); });
+        QObject::connect(&runner, &ReportRunner::canceled, &loop, [&](int) { ++canceled; if(--pending == 0) loop.quit(); });
+        runner.startQuiz(eventId);
+        runner.startTeams(QDateTime::currentDateTime().addDays(-5), QDateTime::currentDateTime().addDays(5));
+        int third = runner.startUsers(QDateTime::currentDateTime().addDays(-5), QDateTime::currentDateTime().addDays(5));
+        runner.cancel(third);
+        loop.exec();
+        if(files.size() != 2 || canceled != 1 || failed != 0 || !QFile::exists(files[0]) || !QFile::exists(files[1])) {
+            qWarning() << "Ошибка фоновых отчетов" << files << canceled << failed;
+            return 1;
+        }
+        for(const QString &f : files) QFile::remove(f);
+    }
     ReportHelper::reportQuiz(quizId);
     ReportHelper::reportUsers(QDateTime::currentDateTime().addDays(-5), QDateTime::currentDateTime().addDays(5));
     ReportHelper::reportTeams(QDateTime::currentDateTime().addDays(-5), QDateTime::currentDateTime().addDays(5));
@@ -0,0 +1,78 @@
+#include "databasemanager.h"
+#include <QElapsedTimer>
+#include <QDebug>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Замер выделений памяти и времени чтения 100k строк:
+ * QVariantMap на строку против типизированных строк.
+ * Данные добавляются внутри транзакции, которая в конце откатывается.
+ */
+static const int ROWS = 100000;
+
+static std::atomic<quint64> allocations{0};
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+template<typename F>
+static void measure(const char *title, F fn)
+{
+    QElapsedTimer timer;
+    timer.start();
+    quint64 before = allocations.load();
+    int rows = fn();
+    quint64 count = allocations.load() - before;
+    qint64 ms = timer.elapsed();
+    qDebug() << title << rows << "строк," << count << "выделений," << ms << "мс";
+}
+
+int main(int argc, char *argv[])
+{
+    qDebug() << "Тест выделений памяти при чтении строк";
+    DatabaseManager* db = &DatabaseManager::instance();
+    if(!db->open()) {
+        qWarning() << "Ошибка открытия/создания базы данных";
+        return 1;
+    }
+    if(!db->createTables()) {
+        qWarning() << "Ошибка создания таблиц";
+        return -1;
+    }
+
+    DatabaseManager::Transaction tr(*db);
+    qint64 id;
+    for (int i = 0; i < ROWS; ++i) {
+        if(!db->addUser(QString("surname%1").arg(i), QString("name%1").arg(i), QString("father%1").arg(i), id)) {
+            qWarning() << "Ошибка добавления физлица" << db->lastError();
+            return 1;
+        }
+    }
+
+    // первый проход прогревает кэш запросов и подсказку размера выборки
+    db->listUsers();
+    db->listUserRows();
+    measure("QVariantMap:", [db]() { return db->listUsers().size(); });
+    measure("UserRow:    ", [db]() { return db->listUserRows().size(); });
+
+    tr.rollback();
+    db->close();
+    qDebug() << "OK";
+    return 0;
+}
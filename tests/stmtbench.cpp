@@ -0,0 +1,61 @@
+#include "databasemanager.h"
+#include <QElapsedTimer>
+#include <QDebug>
+
+/**
+ * Замер количества запросов в секунду с кэшем подготовленных запросов и без него.
+ * Данные добавляются внутри транзакции, которая в конце откатывается.
+ */
+static const int ROWS = 100000;
+static const int LOOKUPS = 200000;
+
+static double measure(DatabaseManager* db, bool cache, qint64 firstId)
+{
+    db->setStatementCacheEnabled(cache);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < LOOKUPS; ++i) {
+        db->getUser(firstId + (i * 7919) % ROWS);
+    }
+    qint64 ms = timer.elapsed();
+    return ms > 0 ? LOOKUPS * 1000.0 / ms : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    qDebug() << "Тест кэша подготовленных запросов";
+    DatabaseManager* db = &DatabaseManager::instance();
+    if(!db->open()) {
+        qWarning() << "Ошибка открытия/создания базы данных";
+        return 1;
+    }
+    if(!db->createTables()) {
+        qWarning() << "Ошибка создания таблиц";
+        return -1;
+    }
+
+    // меряем сами запросы, а не кэш сущностей
+    db->setEntityCacheEnabled(false);
+    QSqlDatabase sql = db->database();
+    sql.transaction();
+    qint64 id;
+    qint64 firstId = 0;
+    for (int i = 0; i < ROWS; ++i) {
+        if(!db->addUser(QString("surname%1").arg(i), QString("name%1").arg(i), QString("father%1").arg(i), id)) {
+            qWarning() << "Ошибка добавления физлица" << db->lastError();
+            sql.rollback();
+            return 1;
+        }
+        if (i == 0) firstId = id;
+    }
+
+    double before = measure(db, false, firstId);
+    double after = measure(db, true, firstId);
+    qDebug() << "Без кэша:" << qRound(before) << "запросов/с";
+    qDebug() << "С кэшем: " << qRound(after) << "запросов/с";
+
+    sql.rollback();
+    db->close();
+    qDebug() << "OK";
+    return 0;
+}